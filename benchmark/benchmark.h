@@ -0,0 +1,360 @@
+#ifndef WATCHER_BENCHMARK_BENCHMARK_H_
+#define WATCHER_BENCHMARK_BENCHMARK_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Minimal microbenchmark harness. The API follows Google Benchmark closely enough that a benchmark can be
+// moved over by swapping the include, and --benchmark_format=json output is readable by its tools
+// (e.g. compare.py).
+//
+//   static void BM_Foo(watcher::bench::State& state) {
+//     for (auto _ : state)
+//       watcher::bench::DoNotOptimize(foo());
+//   }
+//   WATCHER_BENCHMARK(BM_Foo);
+//   WATCHER_BENCHMARK(BM_Foo).Threads(4);
+//   WATCHER_BENCHMARK_CAPTURE(BM_Bar, 640x480, cv::Size(640, 480)); // static void BM_Bar(State&, cv::Size)
+//   WATCHER_BENCHMARK_MAIN();
+//
+// Flags: --benchmark_filter=<regex> --benchmark_min_time=<seconds> --benchmark_repetitions=<n>
+//        --benchmark_format=console|json --benchmark_out=<file>
+
+namespace watcher {
+namespace bench {
+
+template<typename T>
+inline void DoNotOptimize(T&& value) {
+  asm volatile("" : : "g"(value) : "memory");
+}
+
+inline void ClobberMemory() {
+  asm volatile("" : : : "memory");
+}
+
+class State {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(size_t remaining) : remaining_(remaining) {}
+
+    // Value of the `for (auto _ : state)` loop variable
+    struct Value {};
+
+    Value operator*() const { return {}; }
+    Iterator& operator++() { --remaining_; return *this; }
+    bool operator!=(const Iterator&) const { return remaining_ != 0; }
+
+   private:
+    size_t remaining_;
+  };
+
+  explicit State(size_t iterations, int threads = 1, int thread_index = 0)
+    : iterations_(iterations), threads_(threads), thread_index_(thread_index) {}
+
+  Iterator begin() {
+    started_ = true;
+    start_ = clock::now();
+    cpu_start_ = std::clock();
+    return Iterator(iterations_);
+  }
+
+  Iterator end() {
+    return Iterator(0);
+  }
+
+  // Called by the harness after the loop. A benchmark that returned before it, e.g. after SkipWithError(),
+  // reports no time
+  void stop() {
+    if (started_ && elapsed_ns_ == 0) {
+      elapsed_ns_ = std::chrono::duration<double, std::nano>(clock::now() - start_).count();
+      cpu_ns_ = static_cast<double>(std::clock() - cpu_start_) * 1e9 / CLOCKS_PER_SEC;
+    }
+  }
+
+  [[nodiscard]] size_t iterations() const { return iterations_; }
+  [[nodiscard]] int threads() const { return threads_; }
+  [[nodiscard]] int thread_index() const { return thread_index_; }
+
+  void SetBytesProcessed(int64_t bytes) { bytes_processed_ = bytes; }
+  void SetItemsProcessed(int64_t items) { items_processed_ = items; }
+  void SetLabel(std::string label) { label_ = std::move(label); }
+  void SkipWithError(std::string message) { error_ = std::move(message); }
+
+  [[nodiscard]] double elapsed_ns() const { return elapsed_ns_; }
+  [[nodiscard]] double cpu_ns() const { return cpu_ns_; }
+  [[nodiscard]] int64_t bytes_processed() const { return bytes_processed_; }
+  [[nodiscard]] int64_t items_processed() const { return items_processed_; }
+  [[nodiscard]] const std::string& label() const { return label_; }
+  [[nodiscard]] const std::string& error() const { return error_; }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  size_t iterations_;
+  int threads_;
+  int thread_index_;
+  bool started_ = false;
+  clock::time_point start_;
+  std::clock_t cpu_start_ = 0;
+  double elapsed_ns_ = 0;
+  double cpu_ns_ = 0;
+  int64_t bytes_processed_ = 0;
+  int64_t items_processed_ = 0;
+  std::string label_;
+  std::string error_;
+};
+
+struct Benchmark {
+  std::string name;
+  std::function<void(State&)> fn;
+  int threads = 1;
+
+  Benchmark& Threads(int n) { threads = n; return *this; }
+};
+
+// A deque, so the references returned by Register() stay valid
+inline std::deque<Benchmark>& registry() {
+  static std::deque<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+inline Benchmark& Register(std::string name, std::function<void(State&)> fn) {
+  registry().push_back({std::move(name), std::move(fn)});
+  return registry().back();
+}
+
+struct Run {
+  std::string name;
+  size_t iterations = 0;
+  double real_ns = 0; // Per iteration
+  double cpu_ns = 0;  // Per iteration
+  double bytes_per_second = 0;
+  double items_per_second = 0;
+  std::string label;
+  std::string error;
+};
+
+// Runs `iterations` of a benchmark on every thread and combines the per-thread results
+inline Run RunOnce(const Benchmark& b, size_t iterations) {
+  std::vector<State> states;
+  states.reserve(b.threads);
+  for (int i = 0; i < b.threads; ++i)
+    states.emplace_back(iterations, b.threads, i);
+
+  if (b.threads == 1) {
+    b.fn(states[0]);
+    states[0].stop();
+  } else {
+    std::vector<std::thread> threads;
+    for (auto& s : states) {
+      threads.emplace_back([&b, &s]() {
+        b.fn(s);
+        s.stop();
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+  }
+
+  Run run;
+  run.name = b.threads == 1 ? b.name : b.name + "/threads:" + std::to_string(b.threads);
+  run.iterations = iterations;
+
+  double real_ns = 0;
+  double cpu_ns = 0;
+  int64_t bytes = 0;
+  int64_t items = 0;
+  for (const auto& s : states) {
+    real_ns = std::max(real_ns, s.elapsed_ns());
+    cpu_ns += s.cpu_ns() / b.threads;
+    bytes += s.bytes_processed();
+    items += s.items_processed();
+    if (!s.label().empty())
+      run.label = s.label();
+    if (!s.error().empty())
+      run.error = s.error();
+  }
+
+  run.real_ns = real_ns / iterations;
+  run.cpu_ns = cpu_ns / iterations;
+  if (real_ns > 0) {
+    run.bytes_per_second = static_cast<double>(bytes) * 1e9 / real_ns;
+    run.items_per_second = static_cast<double>(items) * 1e9 / real_ns;
+  }
+  return run;
+}
+
+// Grows the iteration count until one run takes at least `min_time` seconds
+inline Run RunBenchmark(const Benchmark& b, double min_time) {
+  size_t iterations = 1;
+  for (;;) {
+    auto run = RunOnce(b, iterations);
+    const auto elapsed = run.real_ns * iterations * 1e-9;
+    if (!run.error.empty() || elapsed >= min_time || iterations >= 1'000'000'000)
+      return run;
+
+    const auto multiplier = elapsed > 0 ? std::min(10.0, 1.4 * min_time / elapsed) : 10.0;
+    iterations = std::max(iterations + 1, static_cast<size_t>(iterations * multiplier));
+  }
+}
+
+inline std::string JsonEscape(const std::string& s) {
+  std::string out;
+  for (const char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+inline std::string ToJson(const std::vector<Run>& runs, const char* executable) {
+  char date[64];
+  const auto now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+  std::ostringstream os;
+  os << "{\n"
+     << "  \"context\": {\n"
+     << "    \"date\": \"" << date << "\",\n"
+     << "    \"executable\": \"" << JsonEscape(executable) << "\",\n"
+     << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+     << "    \"library_build_type\": \"release\"\n"
+#else
+     << "    \"library_build_type\": \"debug\"\n"
+#endif
+     << "  },\n"
+     << "  \"benchmarks\": [\n";
+
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const auto& r = runs[i];
+    os << "    {\n"
+       << "      \"name\": \"" << JsonEscape(r.name) << "\",\n"
+       << "      \"run_name\": \"" << JsonEscape(r.name) << "\",\n"
+       << "      \"run_type\": \"iteration\",\n"
+       << "      \"iterations\": " << r.iterations << ",\n"
+       << "      \"real_time\": " << r.real_ns << ",\n"
+       << "      \"cpu_time\": " << r.cpu_ns << ",\n"
+       << "      \"time_unit\": \"ns\"";
+    if (r.bytes_per_second > 0)
+      os << ",\n      \"bytes_per_second\": " << r.bytes_per_second;
+    if (r.items_per_second > 0)
+      os << ",\n      \"items_per_second\": " << r.items_per_second;
+    if (!r.label.empty())
+      os << ",\n      \"label\": \"" << JsonEscape(r.label) << "\"";
+    if (!r.error.empty())
+      os << ",\n      \"error_occurred\": true,\n      \"error_message\": \"" << JsonEscape(r.error) << "\"";
+    os << "\n    }" << (i + 1 < runs.size() ? "," : "") << "\n";
+  }
+
+  os << "  ]\n}\n";
+  return os.str();
+}
+
+inline void PrintConsole(const Run& r) {
+  if (!r.error.empty()) {
+    std::printf("%-48s ERROR: %s\n", r.name.c_str(), r.error.c_str());
+    return;
+  }
+  std::printf("%-48s %12.1f ns %12.1f ns %12zu", r.name.c_str(), r.real_ns, r.cpu_ns, r.iterations);
+  if (r.bytes_per_second > 0)
+    std::printf(" %10.1fMB/s", r.bytes_per_second * 1e-6);
+  if (r.items_per_second > 0)
+    std::printf(" %10.3fM items/s", r.items_per_second * 1e-6);
+  if (!r.label.empty())
+    std::printf(" %s", r.label.c_str());
+  std::printf("\n");
+}
+
+inline int Main(int argc, char** argv) {
+  std::string filter = ".";
+  std::string format = "console";
+  std::string out;
+  double min_time = 0.5;
+  int repetitions = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto value = [&](const char* flag) -> const char* {
+      const auto prefix = std::string(flag) + "=";
+      return arg.rfind(prefix, 0) == 0 ? argv[i] + prefix.size() : nullptr;
+    };
+
+    if (const auto v = value("--benchmark_filter")) {
+      filter = v;
+    } else if (const auto v = value("--benchmark_min_time")) {
+      min_time = std::atof(v);
+    } else if (const auto v = value("--benchmark_repetitions")) {
+      repetitions = std::max(1, std::atoi(v));
+    } else if (const auto v = value("--benchmark_format")) {
+      format = v;
+    } else if (const auto v = value("--benchmark_out")) {
+      out = v;
+    } else {
+      std::cerr << "Unknown argument: " << arg << '\n';
+      return 1;
+    }
+  }
+
+  const std::regex filter_regex(filter);
+  const bool console = format == "console";
+
+  if (console)
+    std::printf("%-48s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+
+  std::vector<Run> runs;
+  for (const auto& b : registry()) {
+    if (!std::regex_search(b.name, filter_regex))
+      continue;
+    for (int r = 0; r < repetitions; ++r) {
+      runs.push_back(RunBenchmark(b, min_time));
+      if (console)
+        PrintConsole(runs.back());
+    }
+  }
+
+  const auto json = ToJson(runs, argv[0]);
+  if (!console)
+    std::cout << json;
+  if (!out.empty())
+    std::ofstream(out) << json;
+
+  return 0;
+}
+
+} // namespace bench
+} // namespace watcher
+
+#define WATCHER_BENCHMARK_CONCAT_IMPL(a, b) a##b
+#define WATCHER_BENCHMARK_CONCAT(a, b) WATCHER_BENCHMARK_CONCAT_IMPL(a, b)
+
+#define WATCHER_BENCHMARK(fn) \
+  static ::watcher::bench::Benchmark& WATCHER_BENCHMARK_CONCAT(watcher_benchmark_, __LINE__) = \
+    ::watcher::bench::Register(#fn, fn)
+
+// Registers `fn(state, args...)` as "fn/name", e.g. to run one benchmark over several input sizes
+#define WATCHER_BENCHMARK_CAPTURE(fn, name, ...) \
+  static ::watcher::bench::Benchmark& WATCHER_BENCHMARK_CONCAT(watcher_benchmark_, __LINE__) = \
+    ::watcher::bench::Register(#fn "/" #name, [](::watcher::bench::State& state) { fn(state, __VA_ARGS__); })
+
+#define WATCHER_BENCHMARK_MAIN() \
+  int main(int argc, char** argv) { return ::watcher::bench::Main(argc, argv); }
+
+#endif // WATCHER_BENCHMARK_BENCHMARK_H_
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/detector/nms.h"
+#include "watcher/detector/object_detection_model.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::DoNotOptimize;
+using watcher::bench::State;
+
+// Candidates as a YOLO-style model leaves them: a few boxes jittered around each object
+static void BM_Nms2(State& state, int candidates) {
+  cv::RNG rng(1234);
+  std::vector<cv::Rect> rects;
+  std::vector<float> scores;
+  const int objects = std::max(1, candidates / 8);
+  for (int i = 0; i < candidates; ++i) {
+    cv::RNG object_rng(i % objects);
+    const cv::Rect object(object_rng.uniform(0, 320), object_rng.uniform(0, 320),
+                          object_rng.uniform(20, 96), object_rng.uniform(20, 96));
+    rects.emplace_back(object.x + rng.uniform(-4, 5), object.y + rng.uniform(-4, 5),
+                       object.width + rng.uniform(-4, 5), object.height + rng.uniform(-4, 5));
+    scores.emplace_back(rng.uniform(0.05f, 1.f));
+  }
+
+  for (auto _ : state)
+    DoNotOptimize(watcher::nms2(rects, scores, 0.05f));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * candidates);
+}
+WATCHER_BENCHMARK_CAPTURE(BM_Nms2, 10, 10);
+WATCHER_BENCHMARK_CAPTURE(BM_Nms2, 100, 100);
+WATCHER_BENCHMARK_CAPTURE(BM_Nms2, 1000, 1000);
+
+// The pre- and postprocessing need a model for their tensor shapes. Set WATCHER_BENCHMARK_MODEL and
+// WATCHER_BENCHMARK_LABELMAP to measure another one than model/model.tflite
+watcher::ObjectDetectionModel* Model() {
+  static const auto model = []() -> std::unique_ptr<watcher::ObjectDetectionModel> {
+    const char* model_path = std::getenv("WATCHER_BENCHMARK_MODEL");
+    const char* labelmap_path = std::getenv("WATCHER_BENCHMARK_LABELMAP");
+    const std::string model_file = model_path ? model_path : "model/model.tflite";
+    const std::string labelmap_file = labelmap_path ? labelmap_path : "model/labelmap.txt";
+    if (!std::ifstream(model_file) || !std::ifstream(labelmap_file))
+      return nullptr;
+
+    auto m = std::make_unique<watcher::ObjectDetectionModel>();
+    m->num_threads(1);
+    m->load(model_file, labelmap_file);
+    return m;
+  }();
+  return model.get();
+}
+
+cv::Mat Frame(cv::Size size) {
+  cv::Mat frame(size, CV_8UC3);
+  cv::RNG(1234).fill(frame, cv::RNG::UNIFORM, 0, 256);
+  return frame;
+}
+
+// Resize, BGR to RGB and, for float models, normalization into the input tensor
+static void BM_Preprocess(State& state, cv::Size size) {
+  auto model = Model();
+  if (!model) {
+    state.SkipWithError("model/model.tflite not found");
+    return;
+  }
+  const auto frame = Frame(size);
+
+  for (auto _ : state)
+    model->preprocess(frame);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+WATCHER_BENCHMARK_CAPTURE(BM_Preprocess, 640x480, cv::Size(640, 480));
+WATCHER_BENCHMARK_CAPTURE(BM_Preprocess, 1280x960, cv::Size(1280, 960));
+
+// Decoding the output tensors of one inference, including nms2 for YOLO-style models
+static void BM_Postprocess(State& state) {
+  auto model = Model();
+  if (!model) {
+    state.SkipWithError("model/model.tflite not found");
+    return;
+  }
+  model->invoke(Frame({640, 480}));
+
+  for (auto _ : state)
+    DoNotOptimize(model->postprocess());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+WATCHER_BENCHMARK(BM_Postprocess);
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
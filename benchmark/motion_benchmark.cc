@@ -0,0 +1,72 @@
+#include <cstdint>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/detector/movement_detector.h"
+#include "watcher/option_controller.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::DoNotOptimize;
+using watcher::bench::State;
+
+// A textured scene, and the same scene with sensor noise well below the motion threshold.
+// A still camera is the common case, and the slowest one: nothing stops the scan early
+struct Scene {
+  explicit Scene(cv::Size size) : background(size, CV_8UC3), still(size, CV_8UC3) {
+    cv::RNG rng(1234);
+    rng.fill(background, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(background, background, {15, 15}, 0);
+
+    cv::Mat noise(size, CV_8SC3);
+    rng.fill(noise, cv::RNG::UNIFORM, -4, 5);
+    cv::add(background, noise, still, cv::noArray(), CV_8U);
+  }
+
+  cv::Mat background;
+  cv::Mat still;
+};
+
+cv::Mat Gray(const cv::Mat& image) {
+  cv::Mat gray;
+  cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+  return gray;
+}
+
+static void BM_FindExceed(State& state, cv::Size size) {
+  const Scene scene(size);
+  const auto a = Gray(scene.background);
+  const auto b = Gray(scene.still);
+  const auto threshold = watcher::OptionController::get().options()->motion_threshold;
+
+  for (auto _ : state)
+    DoNotOptimize(watcher::MovementDetector::find_exceed(a, b, threshold));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * a.total() * 2);
+}
+WATCHER_BENCHMARK_CAPTURE(BM_FindExceed, 640x480, cv::Size(640, 480));
+WATCHER_BENCHMARK_CAPTURE(BM_FindExceed, 1280x960, cv::Size(1280, 960));
+
+// movement_detected() through screen(): grayscale, blur, diff, dilate, contours, then find_exceed
+static void BM_Screen(State& state, cv::Size size) {
+  const Scene scene(size);
+  const auto options = watcher::OptionController::get().options();
+  watcher::MovementDetector detector;
+
+  // The first frame becomes the background. Committing it as a frame without detections makes
+  // the following frames go through find_exceed instead of being passed for the motion hold
+  detector.screen(scene.background, 0, 0, *options);
+  detector.commit(scene.background, 0, 0, {}, nullptr, *options);
+
+  uint64_t frame = 1;
+  for (auto _ : state)
+    DoNotOptimize(detector.screen(scene.still, 1, frame++, *options));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+WATCHER_BENCHMARK_CAPTURE(BM_Screen, 640x480, cv::Size(640, 480));
+WATCHER_BENCHMARK_CAPTURE(BM_Screen, 1280x960, cv::Size(1280, 960));
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
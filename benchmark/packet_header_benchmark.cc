@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+
+#include "watcher/network/packet.h"
+#include "watcher/network/packet_header.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::DoNotOptimize;
+using watcher::bench::State;
+
+constexpr size_t kTotalSize = 2'345'678;
+
+const std::unordered_map<std::string, std::string> kCustomHeader = {
+  {"Timestamp", "2026-10-19 12:34:56.789"},
+  {"FileFormat", ".jpg"},
+  {"Objects", "person,car"},
+};
+
+// What Protocol::WritePost does for every packet in the text format
+static void BM_TextHeaderEncode(State& state) {
+  char buffer[kPacketMaxHeaderSize];
+
+  for (auto _ : state) {
+    std::unordered_map<std::string, std::string> header = {
+      {kRequest, kRequestPost},
+      {kHeaderTotalSize, std::to_string(kTotalSize)},
+      {kHeaderDone, "0"}
+    };
+    auto custom = kCustomHeader;
+    header.merge(std::move(custom));
+
+    const auto header_size = Packet::CalcHeaderSize(header);
+    header[kHeaderDone] = std::to_string(header_size + kTotalSize <= kPacketSize);
+    DoNotOptimize(Packet::WriteHeader(buffer, sizeof(buffer), header));
+  }
+}
+WATCHER_BENCHMARK(BM_TextHeaderEncode);
+
+static void BM_BinaryHeaderEncode(State& state) {
+  char buffer[kPacketMaxHeaderSize];
+
+  for (auto _ : state) {
+    watcher::PacketHeader header;
+    header
+      .request(watcher::PacketHeader::Request::kPost)
+      .total_size(kTotalSize);
+    for (const auto& p : kCustomHeader)
+      header.add_extension(p.first, p.second);
+
+    header.done(header.size() + kTotalSize <= kPacketSize);
+    DoNotOptimize(header.encode(buffer, sizeof(buffer)));
+  }
+}
+WATCHER_BENCHMARK(BM_BinaryHeaderEncode);
+
+// What Protocol::ConsumePacket does for every packet in the text format
+static void BM_TextHeaderDecode(State& state) {
+  auto header = kCustomHeader;
+  header.emplace(kRequest, kRequestPost);
+  header.emplace(kHeaderTotalSize, std::to_string(kTotalSize));
+  header.emplace(kHeaderDone, "1");
+
+  Packet packet(kPacketMaxHeaderSize);
+  packet.write_header(header);
+
+  for (auto _ : state) {
+    const auto tokens = packet.header();
+    const auto done = tokens.find(kHeaderDone);
+    DoNotOptimize(done != tokens.end() && done->second == "1");
+    if (const auto ts = tokens.find(kHeaderTotalSize); ts != tokens.end())
+      DoNotOptimize(std::strtoull(std::string(ts->second).c_str(), nullptr, 10));
+  }
+}
+WATCHER_BENCHMARK(BM_TextHeaderDecode);
+
+static void BM_BinaryHeaderDecode(State& state) {
+  watcher::PacketHeader header;
+  header
+    .request(watcher::PacketHeader::Request::kPost)
+    .total_size(kTotalSize)
+    .done(true);
+  for (const auto& p : kCustomHeader)
+    header.add_extension(p.first, p.second);
+
+  char buffer[kPacketMaxHeaderSize];
+  const auto size = header.encode(buffer, sizeof(buffer));
+
+  for (auto _ : state) {
+    watcher::PacketHeader decoded;
+    DoNotOptimize(watcher::PacketHeader::decode(buffer, size, decoded));
+    DoNotOptimize(decoded.done());
+    DoNotOptimize(decoded.total_size());
+  }
+}
+WATCHER_BENCHMARK(BM_BinaryHeaderDecode);
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
@@ -0,0 +1,66 @@
+#include <string>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/drawable/text_cache.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::ClobberMemory;
+using watcher::bench::State;
+
+// The HUD main draws on every frame of the half-size view
+struct Hud {
+  const char* text;
+  cv::Point org;
+  int line_type;
+};
+
+constexpr Hud kHud[] = {
+  {"Criteria: 0.500000", {0, 10}, cv::LINE_8},
+  {"FPS: 30", {0, 25}, cv::LINE_8},
+  {"Inference: 83ms", {0, 40}, cv::LINE_8},
+  {"2026-10-19 12:34:56", {5, 210}, cv::LINE_AA},
+};
+
+static void BM_PutText(State& state) {
+  cv::Mat view(240, 320, CV_8UC3, cv::Scalar(40, 80, 120));
+
+  for (auto _ : state) {
+    for (const auto& hud : kHud)
+      cv::putText(view, hud.text, hud.org, cv::FONT_HERSHEY_DUPLEX, 0.5, {0, 255, 0}, 1, hud.line_type);
+    ClobberMemory();
+  }
+}
+WATCHER_BENCHMARK(BM_PutText);
+
+static void BM_TextCache(State& state) {
+  cv::Mat view(240, 320, CV_8UC3, cv::Scalar(40, 80, 120));
+  watcher::TextCache cache;
+
+  for (auto _ : state) {
+    for (const auto& hud : kHud)
+      cache.draw(view, hud.text, hud.org, cv::FONT_HERSHEY_DUPLEX, 0.5, {0, 255, 0}, 1, hud.line_type);
+    ClobberMemory();
+  }
+}
+WATCHER_BENCHMARK(BM_TextCache);
+
+// Worst case: every string is new, e.g. a detection label with its score
+static void BM_TextCacheMiss(State& state) {
+  cv::Mat view(240, 320, CV_8UC3, cv::Scalar(40, 80, 120));
+  watcher::TextCache cache;
+  int n = 0;
+
+  for (auto _ : state) {
+    cache.draw(view, "person(" + std::to_string(n++) + "%)", {20, 100}, cv::FONT_ITALIC, 0.5, {0, 0, 0}, 1);
+    ClobberMemory();
+  }
+}
+WATCHER_BENCHMARK(BM_TextCacheMiss);
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <string>
+
+#include "watcher/utility/date_time.h"
+#include "watcher/utility/timestamp_formatter.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::DoNotOptimize;
+using watcher::bench::State;
+
+using clock_type = std::chrono::system_clock;
+
+// Frames and log lines come a few milliseconds apart, so most calls stay within the cached second
+constexpr auto kStep = std::chrono::milliseconds(7);
+
+// What main does for every frame and the logger for every line
+static void BM_DateTimeToString(State& state) {
+  auto tp = clock_type::now();
+
+  for (auto _ : state) {
+    DoNotOptimize(watcher::DateTime<>(tp, std::chrono::hours(9)).to_string());
+    tp += kStep;
+  }
+}
+WATCHER_BENCHMARK(BM_DateTimeToString);
+
+static void BM_TimestampFormatter(State& state) {
+  watcher::TimestampFormatter formatter(std::chrono::hours(9));
+  char buffer[watcher::TimestampFormatter::kBufferSize];
+  auto tp = clock_type::now();
+
+  for (auto _ : state) {
+    DoNotOptimize(formatter.format(tp, buffer));
+    tp += kStep;
+  }
+}
+WATCHER_BENCHMARK(BM_TimestampFormatter);
+
+// Worst case: every call is in a new second
+static void BM_TimestampFormatterEverySecond(State& state) {
+  watcher::TimestampFormatter formatter(std::chrono::hours(9));
+  char buffer[watcher::TimestampFormatter::kBufferSize];
+  auto tp = clock_type::now();
+
+  for (auto _ : state) {
+    DoNotOptimize(formatter.format(tp, buffer));
+    tp += std::chrono::milliseconds(1001);
+  }
+}
+WATCHER_BENCHMARK(BM_TimestampFormatterEverySecond);
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
@@ -0,0 +1,53 @@
+#include <cstdint>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/utility/frequency.h"
+#include "watcher/utility/ring_buffer.h"
+
+#include "benchmark.h"
+
+namespace {
+
+using watcher::bench::DoNotOptimize;
+using watcher::bench::State;
+
+// The camera stores into the detector's and the uploader's RingBuffer while their threads load from it.
+// With several threads, even ones store and odd ones load
+static void BM_RingBuffer(State& state) {
+  static watcher::RingBuffer<cv::Mat> ring(2);
+  const cv::Mat frame(480, 640, CV_8UC3);
+
+  if (state.threads() == 1) {
+    for (auto _ : state) {
+      ring.store(frame);
+      DoNotOptimize(ring.load());
+    }
+  } else if (state.thread_index() % 2 == 0) {
+    for (auto _ : state)
+      ring.store(frame);
+  } else {
+    for (auto _ : state)
+      DoNotOptimize(ring.load());
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+WATCHER_BENCHMARK(BM_RingBuffer);
+WATCHER_BENCHMARK(BM_RingBuffer).Threads(2);
+WATCHER_BENCHMARK(BM_RingBuffer).Threads(4);
+
+// Every stage ticks its own Frequency per frame; the metrics exporter reads them from another thread
+static void BM_FrequencyTick(State& state) {
+  static watcher::Frequency<> frequency;
+
+  for (auto _ : state)
+    frequency.tick();
+  DoNotOptimize(frequency.freq<double>());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+WATCHER_BENCHMARK(BM_FrequencyTick);
+WATCHER_BENCHMARK(BM_FrequencyTick).Threads(4);
+
+} // namespace
+
+WATCHER_BENCHMARK_MAIN();
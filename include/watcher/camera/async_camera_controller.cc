@@ -4,8 +4,31 @@
 
 #include "watcher/camera/async_camera_controller.h"
 
+#include <atomic>
+#include <chrono>
+
+#include "watcher/trace/trace.h"
+
 namespace watcher {
 
+namespace {
+
+// Shared by every controller, as run() recreates it on each restart
+std::atomic<uint64_t> next_frame_id{1};
+
+} // namespace
+
+AsyncCameraController::AsyncCameraController()
+  : frames_(MetricsRegistry::instance().counter("watcher_capture_frames_total", "Frames captured")),
+    grab_time_(MetricsRegistry::instance().histogram("watcher_capture_grab_ms", "Time spent grabbing a frame")),
+    async_runner_(true)
+{
+  fps_metric_ = MetricsRegistry::instance().gauge("watcher_capture_fps", "Frames captured per second",
+                                                  [this]() { return freq_.freq<double>(); });
+  async_runner_.name("camera");
+  async_runner_.AddWakeUpListener([this]() { OnWakeUp(); });
+}
+
 void AsyncCameraController::open() {
   camera_.set( cv::CAP_PROP_FORMAT, CV_8UC3);
 //    camera_.set( cv::CAP_PROP_FRAME_WIDTH, 640 );
@@ -20,9 +43,16 @@ void AsyncCameraController::open() {
 }
 
 void AsyncCameraController::OnWakeUp() {
+  const auto frame_id = next_frame_id.fetch_add(1, std::memory_order_relaxed);
+  const auto start = std::chrono::steady_clock::now();
   camera_ >> frame_;
-  freq_.tick();
-  listener_(frame_);
+  const auto end = std::chrono::steady_clock::now();
+  freq_.tick(end);
+  frames_.inc();
+  grab_time_.observe(std::chrono::duration<double, std::milli>(end - start).count());
+  if (Tracer::enabled())
+    Tracer::instance().record("capture", frame_id, start, end);
+  listener_(frame_, frame_id);
 }
 
 } // namespace watcher
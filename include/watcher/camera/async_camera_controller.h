@@ -5,12 +5,14 @@
 #ifndef WATCHER_CAMERA_ASYNC_CAMERA_CONTROLLER_H_
 #define WATCHER_CAMERA_ASYNC_CAMERA_CONTROLLER_H_
 
+#include <cstdint>
 #include <vector>
 
 #include "boost/signals2.hpp"
 #include "opencv2/opencv.hpp"
 
 #include "watcher/camera/cross_camera.h"
+#include "watcher/metrics/metrics.h"
 #include "watcher/utility/async_runner.h"
 #include "watcher/utility/frequency.h"
 #include "watcher/utility/ring_buffer.h"
@@ -19,9 +21,7 @@ namespace watcher {
 
 class AsyncCameraController {
  public:
-  explicit AsyncCameraController() : async_runner_(true) {
-    async_runner_.AddWakeUpListener([this]() { OnWakeUp(); });
-  }
+  AsyncCameraController();
 
   void open();
 
@@ -30,8 +30,15 @@ class AsyncCameraController {
   CrossCamera& camera() { return camera_; }
   [[nodiscard]] const CrossCamera& camera() const { return camera_; }
 
+  // Safe to call from any thread
   int fps() const { return freq_.freq(); }
 
+  // Time spent grabbing a frame, in milliseconds
+  [[nodiscard]] WindowStats<>::Snapshot grab_stats() const { return grab_time_.snapshot(); }
+
+  // `func(cv::Mat frame, uint64_t frame_id)` is called on the camera thread for every frame.
+  // Frame ids count up from 1 over the life of the process, so they stay unique when the controller is
+  // recreated, and tag the frame's trace spans down the pipeline
   template<typename F>
   boost::signals2::connection add_listener(F func) {
     return listener_.connect(std::move(func));
@@ -48,7 +55,10 @@ class AsyncCameraController {
   cv::Mat frame_;
 
   Frequency<> freq_;
-  boost::signals2::signal<void(cv::Mat)> listener_;
+  Counter& frames_;
+  Histogram& grab_time_;
+  MetricsRegistry::Registration fps_metric_;
+  boost::signals2::signal<void(cv::Mat, uint64_t)> listener_;
 
   AsyncRunner async_runner_;
 };
@@ -0,0 +1,62 @@
+#include "watcher/detector/gate_classifier.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "tensorflow/lite/c/c_api.h"
+
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+void GateClassifier::loadFromBuffer(const char* model_buffer, size_t model_size, int num_threads) {
+  if (model_.isBuilt()) {
+    return;
+  }
+
+  model_.loadBuffer(model_buffer, model_size)
+        .setNumThreads(num_threads)
+        .build();
+
+  if (const auto dim = model_.inputTensorDims(0); dim.size() >= 3) {
+    input_size_ = cv::Size(dim[2], dim[1]);
+  }
+
+  Log.d(model_.summarize());
+}
+
+float GateClassifier::invoke(const cv::Mat& image) {
+  cv::resize(image, buffer_, input_size_);
+  cv::cvtColor(buffer_, buffer_, cv::COLOR_BGR2RGB);
+  if (TfLiteTensorType(model_.inputTensor(0)) == kTfLiteFloat32) {
+    buffer_.convertTo(buffer_, CV_32FC3, 1./255);
+  }
+
+  model_.setInput(buffer_.data);
+  model_.invoke();
+
+  const auto output = model_.outputTensor(0);
+  const auto count = TfLiteTensorDim(output, TfLiteTensorNumDims(output) - 1);
+  const auto index = count > 1 ? 1 : 0;
+
+  switch (TfLiteTensorType(output)) {
+    case kTfLiteFloat32:
+      return static_cast<const float*>(TfLiteTensorData(output))[index];
+
+    case kTfLiteUInt8: {
+      const auto q = TfLiteTensorQuantizationParams(output);
+      return q.scale * (static_cast<const uint8_t*>(TfLiteTensorData(output))[index] - q.zero_point);
+    }
+
+    case kTfLiteInt8: {
+      const auto q = TfLiteTensorQuantizationParams(output);
+      return q.scale * (static_cast<const int8_t*>(TfLiteTensorData(output))[index] - q.zero_point);
+    }
+
+    default:
+      Log.e("Unsupported gate output type: ", TfLiteTypeGetName(TfLiteTensorType(output)));
+      return 1.f;
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,32 @@
+#ifndef WATCHER_DETECTOR_GATE_CLASSIFIER_H_
+#define WATCHER_DETECTOR_GATE_CLASSIFIER_H_
+
+#include <cstddef>
+
+#include "opencv2/opencv.hpp"
+#include "cutemodel/cute_model.h"
+
+namespace watcher {
+
+// Tiny binary classifier that decides whether a motion crop is worth running the full detector on.
+// The model must have a single output of either 1 (sigmoid) or 2 (softmax, [negative, positive]) elements.
+class GateClassifier {
+ public:
+  GateClassifier() = default;
+
+  void loadFromBuffer(const char* model_buffer, size_t model_size, int num_threads = 1);
+
+  bool is_loaded() const { return model_.isBuilt(); }
+
+  // Probability that the image contains something interesting, in [0, 1]
+  float invoke(const cv::Mat& image);
+
+ private:
+  cute::CuteModel model_;
+  cv::Mat buffer_;
+  cv::Size input_size_{96, 96};
+};
+
+} // namespace watcher
+
+#endif // WATCHER_DETECTOR_GATE_CLASSIFIER_H_
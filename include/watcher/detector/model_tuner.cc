@@ -0,0 +1,137 @@
+#include "watcher/detector/model_tuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/detector/object_detection_model.h"
+#include "watcher/utility/logger.h"
+
+#ifndef USE_XNN_DELEGATE
+#define USE_XNN_DELEGATE 1
+#endif
+
+namespace watcher {
+
+ModelTuner::ModelTuner() {
+  const auto cores = static_cast<int>(std::thread::hardware_concurrency());
+  cpu_budget_ = std::max(1, cores - 1);
+}
+
+uint64_t ModelTuner::hash(const char* data, size_t size) {
+  // FNV-1a
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::vector<ModelTuner::Config> ModelTuner::candidates() const {
+  std::vector<Config> configs;
+  for (int threads = 1; threads <= cpu_budget_; ++threads) {
+#if USE_XNN_DELEGATE
+    configs.push_back({threads, true});
+#endif
+    configs.push_back({threads, false});
+  }
+  return configs;
+}
+
+double ModelTuner::measure(const char* model, size_t model_size, const Config& config) const {
+  ObjectDetectionModel detector;
+  detector.num_threads(config.num_threads)
+          .use_xnnpack(config.use_xnnpack)
+          .loadFromBuffer(model, model_size, "", 0);
+
+  const auto size = detector.input_size().empty() ? cv::Size(300, 300) : detector.input_size();
+  cv::Mat image(size, CV_8UC3);
+  cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+
+  for (int i = 0; i < warmup_; ++i)
+    detector.invoke(image);
+
+  std::vector<double> latency;
+  latency.reserve(iterations_);
+  for (int i = 0; i < iterations_; ++i) {
+    const auto t0 = std::chrono::steady_clock::now();
+    detector.invoke(image);
+    latency.emplace_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+  }
+
+  // Median is robust against the other pipeline threads waking up in the middle of a run
+  std::nth_element(latency.begin(), latency.begin() + latency.size() / 2, latency.end());
+  return latency[latency.size() / 2];
+}
+
+ModelTuner::Config ModelTuner::tune(const char* model, size_t model_size) {
+  const auto key = hash(model, model_size);
+
+  if (auto cached = load_cache(key); cached && cached->num_threads <= cpu_budget_) {
+    Log.d("Loaded tuned model config: threads=", cached->num_threads,
+          ", xnnpack=", cached->use_xnnpack, ", latency=", cached->latency_ms, "ms");
+    return *cached;
+  }
+
+  Config best;
+  for (auto config : candidates()) {
+    config.latency_ms = measure(model, model_size, config);
+    Log.d("Tuning model: threads=", config.num_threads,
+          ", xnnpack=", config.use_xnnpack, ", latency=", config.latency_ms, "ms");
+
+    if (best.latency_ms < 0 || config.latency_ms < best.latency_ms)
+      best = config;
+  }
+
+  Log.d("Tuned model config: threads=", best.num_threads,
+        ", xnnpack=", best.use_xnnpack, ", latency=", best.latency_ms, "ms");
+  save_cache(key, best);
+  return best;
+}
+
+std::optional<ModelTuner::Config> ModelTuner::load_cache(uint64_t key) const {
+  std::ifstream ifs(cache_path_);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    uint64_t k;
+    Config config;
+    if (iss >> std::hex >> k >> std::dec >> config.num_threads >> config.use_xnnpack >> config.latency_ms; iss && k == key)
+      return config;
+  }
+  return std::nullopt;
+}
+
+void ModelTuner::save_cache(uint64_t key, const Config& config) const {
+  // Keep entries of other models, replace this one
+  std::vector<std::string> lines;
+  {
+    std::ifstream ifs(cache_path_);
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::istringstream iss(line);
+      uint64_t k;
+      if (iss >> std::hex >> k; iss && k != key)
+        lines.emplace_back(std::move(line));
+    }
+  }
+
+  std::ofstream ofs(cache_path_, std::ios::trunc);
+  if (!ofs.is_open()) {
+    Log.e("Failed to write ", cache_path_);
+    return;
+  }
+  for (const auto& line : lines)
+    ofs << line << '\n';
+  ofs << std::hex << key << std::dec << ' '
+      << config.num_threads << ' ' << config.use_xnnpack << ' ' << config.latency_ms << '\n';
+}
+
+} // namespace watcher
@@ -0,0 +1,54 @@
+#ifndef WATCHER_DETECTOR_MODEL_TUNER_H_
+#define WATCHER_DETECTOR_MODEL_TUNER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace watcher {
+
+// Picks the fastest interpreter configuration of a model on this device.
+// Results are persisted per model hash, so only the first load pays for tuning.
+class ModelTuner {
+ public:
+  struct Config {
+    int num_threads = 4;
+    bool use_xnnpack = true;
+    double latency_ms = -1;
+  };
+
+  ModelTuner();
+
+  // Maximum number of interpreter threads. Leave cores for capture, motion and upload
+  ModelTuner& cpu_budget(int threads) { cpu_budget_ = threads; return *this; }
+  ModelTuner& warmup(int n) { warmup_ = n; return *this; }
+  // Timed runs per configuration, at least one. Their median is the configuration's latency
+  ModelTuner& iterations(int n) { iterations_ = std::max(1, n); return *this; }
+  ModelTuner& cache_path(std::string path) { cache_path_ = std::move(path); return *this; }
+
+  int cpu_budget() const { return cpu_budget_; }
+
+  Config tune(const char* model, size_t model_size);
+
+  static uint64_t hash(const char* data, size_t size);
+
+ private:
+  std::vector<Config> candidates() const;
+  double measure(const char* model, size_t model_size, const Config& config) const;
+
+  std::optional<Config> load_cache(uint64_t key) const;
+  void save_cache(uint64_t key, const Config& config) const;
+
+  int cpu_budget_;
+  int warmup_ = 2;
+  int iterations_ = 5;
+  std::string cache_path_ = "model_tune.cache";
+};
+
+} // namespace watcher
+
+#endif // WATCHER_DETECTOR_MODEL_TUNER_H_
@@ -4,102 +4,242 @@
 
 #include "watcher/detector/movement_detector.h"
 
+#include <chrono>
 #include <cmath>
+#include <fstream>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "opencv2/opencv.hpp"
 
+#include "watcher/option_controller.h"
+#include "watcher/trace/trace.h"
+#include "watcher/utility/aligned_buffer.h"
 #include "watcher/utility/date_time.h"
 #include "watcher/utility/logger.h"
 
 namespace watcher {
 
+namespace {
+
+// Reports the time since `start` as a metric and a trace span
+void Observe(Histogram& histogram, const char* span, uint64_t frame_id, Tracer::clock::time_point start) {
+  const auto end = Tracer::clock::now();
+  histogram.observe(std::chrono::duration<double, std::milli>(end - start).count());
+  if (Tracer::enabled())
+    Tracer::instance().record(span, frame_id, start, end);
+}
+
+} // namespace
+
+MovementDetector::Metrics::Metrics()
+  : fed(MetricsRegistry::instance().counter(
+      "watcher_detector_frames_total", "Frames fed to and processed by the detector", {{"state", "fed"}})),
+    processed(MetricsRegistry::instance().counter(
+      "watcher_detector_frames_total", "Frames fed to and processed by the detector", {{"state", "processed"}})),
+    motion(MetricsRegistry::instance().counter(
+      "watcher_motion_frames_total", "Frames checked for motion", {{"result", "motion"}})),
+    still(MetricsRegistry::instance().counter(
+      "watcher_motion_frames_total", "Frames checked for motion", {{"result", "still"}})),
+    gate_passed(MetricsRegistry::instance().counter(
+      "watcher_gate_frames_total", "Frames classified by the gate model", {{"result", "passed"}})),
+    gate_rejected(MetricsRegistry::instance().counter(
+      "watcher_gate_frames_total", "Frames classified by the gate model", {{"result", "rejected"}})),
+    motion_time(MetricsRegistry::instance().histogram(
+      "watcher_motion_ms", "Time spent looking for motion in a frame")),
+    gate_time(MetricsRegistry::instance().histogram(
+      "watcher_gate_ms", "Gate model inference time")),
+    inference_time(MetricsRegistry::instance().histogram(
+      "watcher_inference_ms", "Object detection model inference time")),
+    model_threads(MetricsRegistry::instance().gauge(
+      "watcher_model_threads", "Interpreter threads of the object detection model")),
+    model_xnnpack(MetricsRegistry::instance().gauge(
+      "watcher_model_xnnpack", "Whether the object detection model runs on XNNPACK")),
+    model_latency(MetricsRegistry::instance().gauge(
+      "watcher_model_tuned_latency_ms", "Latency of the configuration picked by the tuner. -1 if not tuned")) {}
+
+namespace {
+
+bool ReadFile(const std::string& path, AlignedBuffer& buffer) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  char chunk[64 * 1024];
+  while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0)
+    buffer.append(chunk, static_cast<size_t>(file.gcount()));
+  return !buffer.empty();
+}
+
+} // namespace
+
 MovementDetector::MovementDetector() {
+  async_runner_.name("detector");
   async_runner_.AddWakeUpListener([this](){ OnWakeUp(); });
 }
 
+// Read into memory, so that the model is tuned and its configuration cached as with the buffer overloads
 MovementDetector& MovementDetector::LoadModelFromFile(const std::string& model_path, const std::string& labelmap_path) {
-  model_.load(model_path, labelmap_path);
-  return *this;
+  auto model = std::make_shared<AlignedBuffer>();
+  if (!ReadFile(model_path, *model)) {
+    Log.e("Failed to read ", model_path);
+    return *this;
+  }
+  AlignedBuffer labelmap;
+  if (!ReadFile(labelmap_path, labelmap)) {
+    Log.e("Failed to read ", labelmap_path);
+    return *this;
+  }
+  return LoadModelFromBuffer(std::move(model), labelmap.data(), labelmap.size());
 }
 
 MovementDetector& MovementDetector::LoadModelFromBuffer(const char* model, size_t model_size,
                                                         const char* labelmap, size_t labelmap_size) {
-  model_.loadFromBuffer(model, model_size, labelmap, labelmap_size);
+  configure_model(model, model_size);
+  model_.num_threads(model_config_.num_threads)
+        .use_xnnpack(model_config_.use_xnnpack)
+        .loadFromBuffer(model, model_size, labelmap, labelmap_size);
+  report_model_config();
+  OptionController::get().labels(*model_.labelmap());
+  return *this;
+}
+
+MovementDetector& MovementDetector::LoadModelFromBuffer(std::shared_ptr<const AlignedBuffer> model,
+                                                        const char* labelmap, size_t labelmap_size) {
+  configure_model(model->data(), model->size());
+  model_.num_threads(model_config_.num_threads)
+        .use_xnnpack(model_config_.use_xnnpack)
+        .loadFromBuffer(std::move(model), labelmap, labelmap_size);
+  report_model_config();
+  OptionController::get().labels(*model_.labelmap());
   return *this;
 }
 
+MovementDetector& MovementDetector::LoadGateModelFromBuffer(const char* model, size_t model_size) {
+  gate_.loadFromBuffer(model, model_size);
+  return *this;
+}
+
+MovementDetector& MovementDetector::gate_threshold(float threshold) {
+  OptionController::get().update([=](Options& o) { o.gate_threshold = threshold; });
+  return *this;
+}
+
+float MovementDetector::gate_threshold() const {
+  return OptionController::get().options()->gate_threshold;
+}
+
 MovementDetector& MovementDetector::score_threshold(float threshold) {
-  score_threshold_ = threshold;
+  OptionController::get().update([=](Options& o) { o.score_threshold = threshold; });
   return *this;
 }
 
+float MovementDetector::score_threshold() const {
+  return OptionController::get().options()->score_threshold;
+}
+
 MovementDetector& MovementDetector::add_detection(std::string name) {
-  std::lock_guard lck(m_);
-  desired_object_.emplace(std::move(name));
+  OptionController::get().update([&](Options& o) { o.objects.emplace(std::move(name)); });
   return *this;
 }
 MovementDetector& MovementDetector::remove_detection(const std::string& name) {
-  std::lock_guard lck(m_);
-  desired_object_.erase(name);
+  OptionController::get().update([&](Options& o) { o.objects.erase(name); });
   return *this;
 }
 
-void MovementDetector::feed(cv::Mat image, milliseconds timestamp) {
-  input_.store(Frame{timestamp, image});
+void MovementDetector::feed(cv::Mat image, milliseconds timestamp, uint64_t frame_id) {
+  input_.store(Frame{timestamp, image, frame_id});
+  metrics_.fed.inc();
   async_runner_.run();
 }
 
 void MovementDetector::OnWakeUp() {
   if(const auto data = input_.load(); data) {
-    const auto invoke_result = invoke(data->image, data->timestamp);
+    const auto invoke_result = invoke(data->image, data->timestamp, data->id);
+    std::atomic_store(&result_, invoke_result);
     listener_(invoke_result);
+    metrics_.processed.inc();
   }
 }
 
-MovementDetector::result_or_not MovementDetector::invoke(const cv::Mat& image, milliseconds timestamp) {
+MovementDetector::result_ptr MovementDetector::invoke(const cv::Mat& image, milliseconds timestamp,
+                                                      uint64_t frame_id) {
   const auto t0 = DateTime<>::now().milliseconds();
-  const auto mvd = movement_detected(image, timestamp);
+  // One snapshot for the whole frame, so an update never takes effect halfway through it
+  const auto options = OptionController::get().options();
+
+  result_ptr result;
+  if (screen(image, timestamp, frame_id, *options)) {
+    const auto inference_t0 = Tracer::clock::now();
+    const auto detections = model_.invoke(image);
+    Observe(metrics_.inference_time, "inference", frame_id, inference_t0);
+    result = commit(image, timestamp, frame_id, detections, model_.labelmap(), *options);
+  }
+
+  inference_time_ = static_cast<int>(DateTime<>::now().milliseconds() - t0);
+  return result;
+}
+
+bool MovementDetector::screen(const cv::Mat& image, milliseconds timestamp, uint64_t frame_id,
+                              const Options& options) {
+  const auto tracking = object_detected_;
+  const auto motion_t0 = Tracer::clock::now();
+  const auto mvd = movement_detected(image, timestamp, options);
+  Observe(metrics_.motion_time, "motion", frame_id, motion_t0);
+  (mvd ? metrics_.motion : metrics_.still).inc();
   object_detected_ = false;
 
   if (!mvd) {
-    inference_time_ = static_cast<int>(DateTime<>::now().milliseconds() - t0);
-    return std::nullopt;
-  }
-
-  const auto detection_result = model_.invoke(image);
-  ObjectDetectionModel::result_type out_result;
-
-  {
-    std::lock_guard lck(m_);
-    for (const auto& detection : detection_result) {
-//      if (auto it = desired_object_.find(detection.label);
-//        it != desired_object_.end() && detection.score >= score_threshold_) {
-      //   out_result.emplace_back(detection);
-      if (detection.score >= score_threshold_) {
-        out_result.emplace_back(detection);
-      }
-//      }
-    }
+    return false;
   }
-  last_detection_ = timestamp;
 
-  if (criteria_.timestamp + run_model_override_t_ < timestamp) {
-    preprocess(image, criteria_.image);
-    criteria_.timestamp = timestamp;
+  // Keep running the detector while something is being tracked
+  if (!tracking && !run_gate(image, frame_id, options)) {
+    last_detection_ = timestamp;
+    update_criteria(image, timestamp, options);
+    return false;
   }
-  inference_time_ = static_cast<int>(DateTime<>::now().milliseconds() - t0);
+  return true;
+}
+
+MovementDetector::result_ptr MovementDetector::commit(const cv::Mat& image, milliseconds timestamp,
+                                                      uint64_t frame_id,
+                                                      const ObjectDetectionModel::result_type& detections,
+                                                      std::shared_ptr<const ObjectDetectionModel::label_table> labelmap,
+                                                      const Options& options) {
+  auto out_result = std::make_shared<Result>();
+  out_result->timestamp = timestamp;
+  out_result->frame_id = frame_id;
+  out_result->labelmap = std::move(labelmap);
 
-  if (out_result.empty()) {
-    return std::nullopt;
+  for (const auto& detection : detections) {
+    if (detection.score < options.score_threshold)
+      continue;
+    if (!options.objects.empty() && options.objects.count(std::string(detection.label)) == 0)
+      continue;
+    out_result->detections.emplace_back(detection);
+  }
+  last_detection_ = timestamp;
+  update_criteria(image, timestamp, options);
+
+  if (out_result->detections.empty()) {
+    return nullptr;
   }
 
   object_detected_ = true;
   return out_result;
 }
 
-bool MovementDetector::movement_detected(const cv::Mat& image, milliseconds timestamp) {
+// The background motion is measured against, refreshed at most once per motion_hold
+void MovementDetector::update_criteria(const cv::Mat& image, milliseconds timestamp, const Options& options) {
+  if (criteria_.timestamp + options.motion_hold.count() < timestamp) {
+    preprocess(image, criteria_.image);
+    criteria_.timestamp = timestamp;
+  }
+}
+
+bool MovementDetector::movement_detected(const cv::Mat& image, milliseconds timestamp, const Options& options) {
 
   if (criteria_.image.empty()) {
     preprocess(image, criteria_.image);
@@ -122,21 +262,60 @@ bool MovementDetector::movement_detected(const cv::Mat& image, milliseconds time
 
   std::vector<cv::Rect> movement_area;
   movement_area.reserve(contours.size());
+  movement_roi_ = {};
   for (const auto& contour : contours) {
     if (cv::contourArea(contour) < 50) {
       continue;
     }
 
     movement_area.emplace_back(cv::boundingRect(contour));
+    movement_roi_ |= movement_area.back();
   }
   bbox_(movement_area);
 //  diffs_.store(std::move(movement_area));
 //  diffs_.store(temp_);
-  if (object_detected_ || timestamp > last_detection_ + run_model_override_t_) {
+  if (object_detected_ || timestamp > last_detection_ + options.motion_hold.count()) {
+    return true;
+  }
+
+  return find_exceed(criteria_.image, current_.image, options.motion_threshold);
+}
+
+bool MovementDetector::run_gate(const cv::Mat& image, uint64_t frame_id, const Options& options) {
+  if (!gate_.is_loaded()) {
     return true;
   }
 
-  return find_exceed(criteria_.image, current_.image, diff_threshold_);
+  const auto roi = movement_roi_.empty() ? cv::Rect({}, image.size()) : (movement_roi_ & cv::Rect({}, image.size()));
+  const auto t0 = Tracer::clock::now();
+  const auto score = gate_.invoke(image(roi));
+  Observe(metrics_.gate_time, "gate", frame_id, t0);
+
+  if (score < options.gate_threshold) {
+    ++gate_rejected_;
+    metrics_.gate_rejected.inc();
+    return false;
+  }
+  ++gate_passed_;
+  metrics_.gate_passed.inc();
+  return true;
+}
+
+void MovementDetector::configure_model(const char* model, size_t model_size) {
+  const auto threads = OptionController::get().options()->model_threads;
+  if (auto_tune_ && model) {
+    if (threads > 0)
+      tuner_.cpu_budget(threads);
+    model_config_ = tuner_.tune(model, model_size);
+  } else if (threads > 0) {
+    model_config_.num_threads = threads;
+  }
+}
+
+void MovementDetector::report_model_config() {
+  metrics_.model_threads.set(model_config_.num_threads);
+  metrics_.model_xnnpack.set(model_config_.use_xnnpack ? 1 : 0);
+  metrics_.model_latency.set(model_config_.latency_ms);
 }
 
 void MovementDetector::preprocess(const cv::Mat& src, cv::Mat& dst) {
@@ -6,15 +6,19 @@
 #define WATCHER_DETECTOR_MOVEMENT_DETECTOR_H_
 
 #include <atomic>
-#include <mutex>
-#include <optional>
-#include <unordered_set>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "boost/signals2.hpp"
 #include "opencv2/opencv.hpp"
 
+#include "watcher/detector/gate_classifier.h"
+#include "watcher/detector/model_tuner.h"
 #include "watcher/detector/object_detection_model.h"
+#include "watcher/metrics/metrics.h"
+#include "watcher/option_controller.h"
 #include "watcher/utility/async_runner.h"
 #include "watcher/utility/ring_buffer.h"
 
@@ -26,10 +30,18 @@ class MovementDetector {
   struct Frame {
     milliseconds timestamp = -1;
     cv::Mat image;
+    uint64_t id = 0;
   };
 
  public:
-  using result_or_not = std::optional<ObjectDetectionModel::result_type>;
+  // Published once per inference and never modified afterwards, so readers can share it without locking
+  struct Result {
+    milliseconds timestamp = -1;
+    uint64_t frame_id = 0; // The frame the detections were made on, as passed to feed()
+    ObjectDetectionModel::result_type detections;
+    std::shared_ptr<const ObjectDetectionModel::label_table> labelmap; // owns the storage of detections[i].label
+  };
+  using result_ptr = std::shared_ptr<const Result>;
 
   MovementDetector();
 
@@ -38,52 +50,120 @@ class MovementDetector {
   MovementDetector& LoadModelFromBuffer(const char* model, size_t model_size,
                                         const char* labelmap, size_t labelmap_size);
 
+  MovementDetector& LoadModelFromBuffer(std::shared_ptr<const AlignedBuffer> model,
+                                        const char* labelmap, size_t labelmap_size);
+
+  // Optional first stage. When loaded, the detector only runs on motion the gate accepts
+  MovementDetector& LoadGateModelFromBuffer(const char* model, size_t model_size);
+
+  // Thresholds and labels are kept in OptionController, and setting them here updates its options
+  MovementDetector& gate_threshold(float threshold);
+  float gate_threshold() const;
+
+  size_t gate_passed() const { return gate_passed_; }
+  size_t gate_rejected() const { return gate_rejected_; }
+
+  // Time a few configurations on the first load of a model, from a file or a buffer, and use the fastest one
+  MovementDetector& auto_tune(bool enable) { auto_tune_ = enable; return *this; }
+  MovementDetector& tuner(ModelTuner tuner) { tuner_ = std::move(tuner); return *this; }
+  const ModelTuner::Config& model_config() const { return model_config_; }
+
   MovementDetector& score_threshold(float threshold);
-  float score_threshold() const { return score_threshold_; }
+  float score_threshold() const;
 
   MovementDetector& add_detection(std::string name);
   MovementDetector& remove_detection(const std::string& name);
 
   milliseconds inference_time() const { return inference_time_; }
 
-  void feed(cv::Mat image, milliseconds timestamp);
+  // Latest published result. nullptr if nothing was detected
+  result_ptr result() const { return std::atomic_load(&result_); }
+
+  // `frame_id` tags the trace spans of the frame. 0 if untracked
+  void feed(cv::Mat image, milliseconds timestamp, uint64_t frame_id = 0);
 
   template<typename F>
   boost::signals2::connection add_listener(F func) {
     return listener_.connect(std::move(func));
   }
 
+  // The two halves of what feed() does around the model, for callers that run the model themselves,
+  // e.g. on several interpreters at once (see OfflineRunner). Not thread-safe, and unrelated to feed().
+  //
+  // screen() looks for motion and runs the gate, and returns whether the model should run on the frame.
+  // commit() filters the model's output, updates the motion state and returns the result like result().
+  // Every frame goes through screen(), in order; commit() follows for the frames it passed, in the same order
+  bool screen(const cv::Mat& image, milliseconds timestamp, uint64_t frame_id, const Options& options);
+
+  result_ptr commit(const cv::Mat& image, milliseconds timestamp, uint64_t frame_id,
+                    const ObjectDetectionModel::result_type& detections,
+                    std::shared_ptr<const ObjectDetectionModel::label_table> labelmap,
+                    const Options& options);
+
+  // Whether any byte of `a` and `b`, of the same size and type, differs by more than `threshold`
+  static bool find_exceed(const cv::Mat& a, const cv::Mat& b, int threshold);
+
 
  private:
+  // Frames fed but never processed were replaced by a newer one while the detector was busy
+  struct Metrics {
+    Metrics();
+
+    Counter& fed;
+    Counter& processed;
+    Counter& motion;
+    Counter& still;
+    Counter& gate_passed;
+    Counter& gate_rejected;
+    Histogram& motion_time;
+    Histogram& gate_time;
+    Histogram& inference_time;
+    Gauge& model_threads;
+    Gauge& model_xnnpack;
+    Gauge& model_latency;
+  };
+
   void OnWakeUp();
 
-  result_or_not invoke(const cv::Mat& image, milliseconds timestamp);
+  result_ptr invoke(const cv::Mat& image, milliseconds timestamp, uint64_t frame_id);
+
+  bool movement_detected(const cv::Mat& image, milliseconds timestamp, const Options& options);
+
+  bool run_gate(const cv::Mat& image, uint64_t frame_id, const Options& options);
 
-  bool movement_detected(const cv::Mat& image, milliseconds timestamp);
+  void update_criteria(const cv::Mat& image, milliseconds timestamp, const Options& options);
+
+  // Thread budget and tuning of the object detection model, from the options
+  void configure_model(const char* model, size_t model_size);
 
   void preprocess(const cv::Mat& src, cv::Mat& dst);
 
-  static bool find_exceed(const cv::Mat& a, const cv::Mat& b, int threshold);
+  void report_model_config();
 
   RingBuffer<Frame> input_{2};
 
-  mutable std::mutex m_;
-
   bool object_detected_ = false;
   milliseconds last_detection_ = -100000;
-  milliseconds run_model_override_t_ = 3000;
 
   Frame criteria_;
   Frame current_;
   cv::Size blur_size_{5, 5};
-  int diff_threshold_ = 40;
 
   ObjectDetectionModel model_;
+
+  GateClassifier gate_;
+  std::atomic<size_t> gate_passed_{0};
+  std::atomic<size_t> gate_rejected_{0};
+  cv::Rect movement_roi_;
+  bool auto_tune_ = true;
+  ModelTuner tuner_;
+  ModelTuner::Config model_config_;
   std::atomic<int> inference_time_{-1};
-  float score_threshold_ = 0.5;
-  std::unordered_set<std::string> desired_object_{"person", "dog", "cat"};
 
-  boost::signals2::signal<void(const result_or_not&)> listener_;
+  result_ptr result_;
+  boost::signals2::signal<void(const result_ptr&)> listener_;
+
+  Metrics metrics_;
 
   AsyncRunner async_runner_;
 
@@ -0,0 +1,71 @@
+#include "watcher/detector/nms.h"
+
+#include <cassert>
+#include <iterator>
+#include <map>
+
+namespace watcher {
+
+std::vector<size_t> nms2(const std::vector<cv::Rect>& srcRects,
+                         const std::vector<float>& scores,
+                         float thresh,
+                         int neighbors,
+                         float minScoresSum)
+{
+  std::vector<size_t> result_idx;
+
+  const size_t size = srcRects.size();
+  if (!size)
+    return {};
+
+  assert(srcRects.size() == scores.size());
+
+  // Sort the bounding boxes by the detection score
+  std::multimap<float, size_t> idxs;
+  for (size_t i = 0; i < size; ++i)
+  {
+    idxs.emplace(scores[i], i);
+  }
+
+  // keep looping while some indexes still remain in the indexes list
+  while (idxs.size() > 0)
+  {
+    // grab the last rectangle
+    auto lastElem = --std::end(idxs);
+    const cv::Rect& rect1 = srcRects[lastElem->second];
+    const auto index = lastElem->second;
+
+    int neigborsCount = 0;
+    float scoresSum = lastElem->first;
+
+    idxs.erase(lastElem);
+
+    for (auto pos = std::begin(idxs); pos != std::end(idxs); )
+    {
+      // grab the current rectangle
+      const cv::Rect& rect2 = srcRects[pos->second];
+
+      float intArea = static_cast<float>((rect1 & rect2).area());
+      float unionArea = rect1.area() + rect2.area() - intArea;
+      float overlap = intArea / unionArea;
+
+      // if there is sufficient overlap, suppress the current bounding box
+      if (overlap > thresh)
+      {
+        scoresSum += pos->first;
+        pos = idxs.erase(pos);
+        ++neigborsCount;
+      }
+      else
+      {
+        ++pos;
+      }
+    }
+    if (neigborsCount >= neighbors && scoresSum >= minScoresSum)
+      result_idx.push_back(index);
+  }
+
+  return result_idx;
+}
+
+} // namespace watcher
@@ -0,0 +1,29 @@
+#ifndef WATCHER_DETECTOR_NMS_H_
+#define WATCHER_DETECTOR_NMS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+namespace watcher {
+
+/**
+ * @brief nms2
+ * Non maximum suppression with detection scores
+ * @param srcRects
+ * @param scores
+ * @param thresh IoU above which the lower scored box is suppressed
+ * @param neighbors
+ * @param minScoresSum
+ * @return indices of the kept boxes, highest score first
+ */
+std::vector<size_t> nms2(const std::vector<cv::Rect>& srcRects,
+                         const std::vector<float>& scores,
+                         float thresh,
+                         int neighbors = 0,
+                         float minScoresSum = 0.f);
+
+} // namespace watcher
+
+#endif // WATCHER_DETECTOR_NMS_H_
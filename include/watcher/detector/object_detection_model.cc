@@ -4,10 +4,13 @@
 
 #include "watcher/detector/object_detection_model.h"
 
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <fstream>
-#include <map>
+#include <istream>
 #include <memory>
+#include <sstream>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -15,6 +18,7 @@
 #include "tensorflow/lite/c/c_api_types.h"
 #include "tensorflow/lite/c/c_api.h"
 
+#include "watcher/detector/nms.h"
 #include "watcher/utility/logger.h"
 
 namespace watcher {
@@ -47,77 +51,6 @@ static std::vector<T, Allocator> reserved_vector(size_t n) {
 }
 
 
-/**
- * @brief nms2
- * Non maximum suppression with detection scores
- * @param srcRects
- * @param scores
- * @param result_idx
- * @param thresh
- * @param neighbors
- */
-static std::vector<size_t> nms2(const std::vector<cv::Rect>& srcRects,
-                                const std::vector<float>& scores,
-                                float thresh,
-                                int neighbors = 0,
-                                float minScoresSum = 0.f)
-{
-  std::vector<size_t> result_idx;
-
-  const size_t size = srcRects.size();
-  if (!size)
-    return {};
-
-  assert(srcRects.size() == scores.size());
-
-  // Sort the bounding boxes by the detection score
-  std::multimap<float, size_t> idxs;
-  for (size_t i = 0; i < size; ++i)
-  {
-    idxs.emplace(scores[i], i);
-  }
-
-  // keep looping while some indexes still remain in the indexes list
-  while (idxs.size() > 0)
-  {
-    // grab the last rectangle
-    auto lastElem = --std::end(idxs);
-    const cv::Rect& rect1 = srcRects[lastElem->second];
-    const auto index = lastElem->second;
-
-    int neigborsCount = 0;
-    float scoresSum = lastElem->first;
-
-    idxs.erase(lastElem);
-
-    for (auto pos = std::begin(idxs); pos != std::end(idxs); )
-    {
-      // grab the current rectangle
-      const cv::Rect& rect2 = srcRects[pos->second];
-
-      float intArea = static_cast<float>((rect1 & rect2).area());
-      float unionArea = rect1.area() + rect2.area() - intArea;
-      float overlap = intArea / unionArea;
-
-      // if there is sufficient overlap, suppress the current bounding box
-      if (overlap > thresh)
-      {
-        scoresSum += pos->first;
-        pos = idxs.erase(pos);
-        ++neigborsCount;
-      }
-      else
-      {
-        ++pos;
-      }
-    }
-    if (neigborsCount >= neighbors && scoresSum >= minScoresSum)
-      result_idx.push_back(index);
-  }
-
-  return result_idx;
-}
-
 ObjectDetectionModel::ObjectDetectionModel(std::string_view model_path, std::string_view labelmap_path) {
   load(model_path, labelmap_path);
 }
@@ -135,13 +68,20 @@ void ObjectDetectionModel::loadFromBuffer(
   build();
 
   // Load labelmap
-  labelmap_.clear();
   std::istringstream oss(std::string(labelmap_buffer, labelmap_size));
+  set_labelmap(oss);
+}
 
-  std::string line;
-  while (std::getline(oss, line)) {
-    labelmap_.emplace_back(std::move(line));
+void ObjectDetectionModel::loadFromBuffer(
+  std::shared_ptr<const AlignedBuffer> model_buffer,
+  const char *labelmap_buffer, size_t labelmap_size)
+{
+  if (model_.isBuilt()) {
+    return;
   }
+
+  model_buffer_ = std::move(model_buffer);
+  loadFromBuffer(model_buffer_->data(), model_buffer_->size(), labelmap_buffer, labelmap_size);
 }
 
 void ObjectDetectionModel::load(std::string_view model_path, std::string_view labelmap_path) {
@@ -166,16 +106,32 @@ void ObjectDetectionModel::load_labelmap(std::string_view path) {
     std::terminate();
   }
 
-  labelmap_.clear();
+  set_labelmap(ifs);
+}
+
+void ObjectDetectionModel::set_labelmap(std::istream& is) {
+  auto table = std::make_shared<label_table>();
   std::string line;
-  while (std::getline(ifs, line)) {
-    labelmap_.emplace_back(std::move(line));
+  while (std::getline(is, line)) {
+    table->emplace_back(std::move(line));
   }
+  labelmap_ = std::move(table);
+}
+
+std::string_view ObjectDetectionModel::label(size_t class_id) const {
+  if (class_id >= labelmap_->size())
+    return {};
+  return (*labelmap_)[class_id];
 }
 
 void ObjectDetectionModel::build() {
-  model_.setNumThreads(4);
-  model_.build();
+  model_.setNumThreads(num_threads_)
+        .setUseXNNPack(use_xnnpack_)
+        .build();
+  if (!model_.isBuilt()) {
+    Log.e("Failed to build the interpreter");
+    return;
+  }
 
   if (const auto dim = model_.inputTensorDims(0); dim.size() >= 2) {
     input_size_ = cv::Size(dim[1], dim[2]);
@@ -185,6 +141,27 @@ void ObjectDetectionModel::build() {
 }
 
 ObjectDetectionModel::result_type ObjectDetectionModel::invoke(const cv::Mat& image) {
+  using clock = std::chrono::steady_clock;
+  const auto elapsed_ms = [](clock::time_point from, clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+  };
+
+  const auto t0 = clock::now();
+  preprocess(image);
+  const auto t1 = clock::now();
+  model_.invoke();
+  const auto t2 = clock::now();
+  auto result = postprocess();
+  const auto t3 = clock::now();
+
+  profile_.preprocess_ms = elapsed_ms(t0, t1);
+  profile_.invoke_ms = elapsed_ms(t1, t2);
+  profile_.postprocess_ms = elapsed_ms(t2, t3);
+
+  return result;
+}
+
+void ObjectDetectionModel::preprocess(const cv::Mat& image) {
   if (input_size_.empty()) {
     cv::resize(image, buffer_, {300, 300});
   } else {
@@ -197,8 +174,9 @@ ObjectDetectionModel::result_type ObjectDetectionModel::invoke(const cv::Mat& im
   }
 
   model_.setInput(buffer_.data);
-  model_.invoke();
+}
 
+ObjectDetectionModel::result_type ObjectDetectionModel::postprocess() {
   result_type result;
 
   if (model_.outputTensorCount() == 4) {
@@ -207,15 +185,14 @@ ObjectDetectionModel::result_type ObjectDetectionModel::invoke(const cv::Mat& im
     std::vector<float> score_raw = model_.getOutput<float>(2);
     std::vector<float> num_detect_raw = model_.getOutput<float>(3);
 
-    auto rect = make_reserved<std::vector<std::vector<float>>>(10);
-    auto label = make_reserved<std::vector<std::string>>(10);
     const auto num_detect = static_cast<int>(num_detect_raw[0]);
 
     result.resize(num_detect);
 
     for (int i = 0; i < num_detect; ++i) {
       std::copy(rect_raw.data() + i * 4, rect_raw.data() + i * 4 + 4, result[i].rect);
-      result[i].label = labelmap_[std::floor(class_raw[i] + 1.5)];
+      result[i].class_id = static_cast<int>(std::floor(class_raw[i] + 1.5));
+      result[i].label = label(result[i].class_id);
       result[i].score = score_raw[i];
     }
   } else {
@@ -257,12 +234,13 @@ ObjectDetectionModel::result_type ObjectDetectionModel::invoke(const cv::Mat& im
     for (const auto i : idx) {
       decltype(result)::value_type res;
       res.score = scores[i];
-      res.label = labelmap_[classes[i]];
+      res.class_id = static_cast<int>(classes[i]);
+      res.label = label(classes[i]);
       res.rect[0] = static_cast<float>(rects[i].tl().y) / input_size_.height;
       res.rect[1] = static_cast<float>(rects[i].tl().x) / input_size_.width;
       res.rect[2] = static_cast<float>(rects[i].br().y) / input_size_.height;
       res.rect[3] = static_cast<float>(rects[i].br().x) / input_size_.width;
-      result.emplace_back(std::move(res));
+      result.emplace_back(res);
     }
   }
 
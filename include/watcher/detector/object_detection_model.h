@@ -5,35 +5,75 @@
 #ifndef WATCHER_MODEL_OBJECT_DETECTION_MODEL_H_
 #define WATCHER_MODEL_OBJECT_DETECTION_MODEL_H_
 
+#include <istream>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "opencv2/opencv.hpp"
 #include "cutemodel/cute_model.h"
+#include "tensorflow/lite/c/c_api.h"
+
+#include "watcher/utility/aligned_buffer.h"
 
 namespace watcher {
 
 class ObjectDetectionModel {
  public:
+  using label_table = std::vector<std::string>;
+
   struct Detection {
     float rect[4];
-    std::string label;
+    int class_id;
+    std::string_view label; // view into labelmap(). Keep the table alive while using it
     float score;
   };
   using result_type = std::vector<Detection>;
 
+  // Wall time of each stage of the last invoke()
+  struct Profile {
+    double preprocess_ms = 0;
+    double invoke_ms = 0;
+    double postprocess_ms = 0;
+  };
+
   ObjectDetectionModel() = default;
   ObjectDetectionModel(std::string_view model_path, std::string_view labelmap_path);
 
   void load(std::string_view model_path, std::string_view labelmap_path);
 
+  // The interpreter reads `model_buffer` in place, so it must outlive this object
   void loadFromBuffer(const char* model_buffer, size_t model_size,
                       const char* labelmap_buffer, size_t labelmap_size);
 
+  // Shares ownership of the model buffer instead of copying it
+  void loadFromBuffer(std::shared_ptr<const AlignedBuffer> model_buffer,
+                      const char* labelmap_buffer, size_t labelmap_size);
+
+  // False if the model could not be loaded, e.g. it is not a valid .tflite file
+  bool is_loaded() const { return model_.isBuilt(); }
+
+  // Must be set before loading the model
+  ObjectDetectionModel& num_threads(int n) { num_threads_ = n; return *this; }
+  ObjectDetectionModel& use_xnnpack(bool use) { use_xnnpack_ = use; return *this; }
+  int num_threads() const { return num_threads_; }
+  bool use_xnnpack() const { return use_xnnpack_; }
+
   result_type invoke(const cv::Mat& image);
 
-  const cv::Size& input_size() const;
+  // The stages of invoke() around the interpreter, to measure them on their own.
+  // postprocess() decodes the outputs of the last run of the interpreter
+  void preprocess(const cv::Mat& image);
+  result_type postprocess();
+
+  const Profile& last_profile() const { return profile_; }
+
+  const cv::Size& input_size() const { return input_size_; }
+  TfLiteType input_type() const { return TfLiteTensorType(model_.inputTensor(0)); }
+
+  // Immutable once loaded. Reloading publishes a new table instead of mutating this one
+  const std::shared_ptr<const label_table>& labelmap() const { return labelmap_; }
 
  private:
   void load_model(std::string_view path);
@@ -41,10 +81,18 @@ class ObjectDetectionModel {
 
   void build();
 
+  void set_labelmap(std::istream& is);
+  std::string_view label(size_t class_id) const;
+
+  std::shared_ptr<const AlignedBuffer> model_buffer_;
   cute::CuteModel model_;
-  std::vector<std::string> labelmap_;
+  std::shared_ptr<const label_table> labelmap_ = std::make_shared<const label_table>();
   cv::Mat buffer_;
   cv::Size input_size_;
+
+  int num_threads_ = 4;
+  bool use_xnnpack_ = true;
+  Profile profile_;
 };
 
 } // namespace watcher
@@ -10,13 +10,19 @@
 #include "opencv2/opencv.hpp"
 
 #include "watcher/drawable/macro.h"
+#include "watcher/drawable/text_cache.h"
 
 namespace watcher {
 
+// Drawn through TextCache, so an unchanged string is not rasterized again, unless `cached` is off
 class Text {
  public:
   void draw(cv::Mat& image) const {
-    cv::putText(image, text(), org(), font_face(), font_scale(), color(), thickness(), line_type(), bottom_left_origin());
+    if (!cached()) {
+      cv::putText(image, text(), org(), font_face(), font_scale(), color(), thickness(), line_type(), bottom_left_origin());
+      return;
+    }
+    TextCache::instance().draw(image, text(), org(), font_face(), font_scale(), color(), thickness(), line_type(), bottom_left_origin());
   }
 
   WATCHER_DRAWABLE_PROP(std::string, text);
@@ -27,19 +33,22 @@ class Text {
   WATCHER_DRAWABLE_PROP(int, thickness, 1);
   WATCHER_DRAWABLE_PROP(int, line_type, cv::LINE_8);
   WATCHER_DRAWABLE_PROP(int, bottom_left_origin, false);
+  WATCHER_DRAWABLE_PROP(bool, cached, true);
 };
 
+// The border is the same text drawn thicker underneath
 class BorderedText {
  public:
   void draw(cv::Mat& image) const {
-    cv::putText(image, text(), org(), font_face(), font_scale(), color(), thickness(), line_type(), bottom_left_origin());
-    cv::putText(image, text(), org(), font_face(), font_scale(), color_out(), thickness_out(), line_type(), bottom_left_origin());
+    auto& cache = TextCache::instance();
+    cache.draw(image, text(), org(), font_face(), font_scale(), color_out(), thickness_out(), line_type(), bottom_left_origin());
+    cache.draw(image, text(), org(), font_face(), font_scale(), color(), thickness(), line_type(), bottom_left_origin());
   }
 
   WATCHER_DRAWABLE_PROP(std::string, text);
   WATCHER_DRAWABLE_PROP(cv::Point, org);
   WATCHER_DRAWABLE_PROP(int, font_face, cv::FONT_HERSHEY_DUPLEX);
-  WATCHER_DRAWABLE_PROP(int, font_scale, 1);
+  WATCHER_DRAWABLE_PROP(double, font_scale, 1);
   WATCHER_DRAWABLE_PROP(cv::Scalar, color);
   WATCHER_DRAWABLE_PROP(int, thickness, 1);
   WATCHER_DRAWABLE_PROP(int, line_type, cv::LINE_8);
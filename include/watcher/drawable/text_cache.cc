@@ -0,0 +1,113 @@
+#include "watcher/drawable/text_cache.h"
+
+#include <functional>
+#include <utility>
+
+namespace watcher {
+
+namespace {
+
+void HashCombine(size_t& seed, size_t value) {
+  seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+// out = out + (color - out) * alpha / 255, clipped to the image
+void Blend(cv::Mat& image, const cv::Mat& alpha, cv::Point tl, const cv::Scalar& color) {
+  const cv::Rect target = cv::Rect(tl, alpha.size()) & cv::Rect(0, 0, image.cols, image.rows);
+  if (target.empty())
+    return;
+
+  const cv::Vec3b solid(cv::saturate_cast<uchar>(color[0]),
+                        cv::saturate_cast<uchar>(color[1]),
+                        cv::saturate_cast<uchar>(color[2]));
+  const int c[3] = {solid[0], solid[1], solid[2]};
+
+  for (int y = 0; y < target.height; ++y) {
+    const auto* a = alpha.ptr<uchar>(target.y - tl.y + y) + (target.x - tl.x);
+    auto* p = image.ptr<cv::Vec3b>(target.y + y) + target.x;
+    for (int x = 0; x < target.width; ++x) {
+      const int w = a[x];
+      if (w == 0)
+        continue;
+      if (w == 255) {
+        p[x] = solid;
+        continue;
+      }
+      for (int ch = 0; ch < 3; ++ch)
+        p[x][ch] = static_cast<uchar>(p[x][ch] + ((c[ch] - p[x][ch]) * w + (c[ch] >= p[x][ch] ? 127 : -127)) / 255);
+    }
+  }
+}
+
+} // namespace
+
+TextCache& TextCache::instance() {
+  static TextCache cache;
+  return cache;
+}
+
+size_t TextCache::KeyHash::operator()(const Key& key) const noexcept {
+  size_t seed = std::hash<std::string>()(key.text);
+  HashCombine(seed, std::hash<int>()(key.font_face));
+  HashCombine(seed, std::hash<double>()(key.font_scale));
+  HashCombine(seed, std::hash<int>()(key.thickness));
+  HashCombine(seed, std::hash<int>()(key.line_type));
+  HashCombine(seed, key.bottom_left_origin);
+  return seed;
+}
+
+void TextCache::draw(cv::Mat& image, const std::string& text, cv::Point org, int font_face, double font_scale,
+                     const cv::Scalar& color, int thickness, int line_type, bool bottom_left_origin)
+{
+  if (image.type() != CV_8UC3 || thickness < 0) {
+    cv::putText(image, text, org, font_face, font_scale, color, thickness, line_type, bottom_left_origin);
+    return;
+  }
+  if (text.empty())
+    return;
+
+  std::lock_guard lck(m_);
+  const auto& mask = find_or_render({text, font_face, font_scale, thickness, line_type, bottom_left_origin});
+  Blend(image, mask.alpha, org + mask.offset, color);
+}
+
+size_t TextCache::size() const {
+  std::lock_guard lck(m_);
+  return masks_.size();
+}
+
+void TextCache::clear() {
+  std::lock_guard lck(m_);
+  masks_.clear();
+  entries_.clear();
+}
+
+const TextCache::Mask& TextCache::find_or_render(Key key) {
+  if (const auto it = masks_.find(key); it != masks_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+
+  if (masks_.size() >= capacity_ && !masks_.empty()) {
+    masks_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+
+  // Leave room for the stroke width and the anti-aliased fringe around the glyph box
+  int baseline = 0;
+  const auto size = cv::getTextSize(key.text, key.font_face, key.font_scale, key.thickness, &baseline);
+  const int pad = key.thickness + 2;
+  const int above = key.bottom_left_origin ? baseline : size.height;
+
+  Mask mask;
+  mask.alpha = cv::Mat::zeros(size.height + baseline + 2 * pad, size.width + 2 * pad, CV_8UC1);
+  mask.offset = cv::Point(-pad, -above - pad);
+  cv::putText(mask.alpha, key.text, cv::Point(pad, pad + above), key.font_face, key.font_scale, cv::Scalar(255),
+              key.thickness, key.line_type, key.bottom_left_origin);
+
+  entries_.emplace_front(key, std::move(mask));
+  masks_.emplace(std::move(key), entries_.begin());
+  return entries_.front().second;
+}
+
+} // namespace watcher
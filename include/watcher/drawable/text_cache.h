@@ -0,0 +1,75 @@
+#ifndef WATCHER_DRAWABLE_TEXT_CACHE_H_
+#define WATCHER_DRAWABLE_TEXT_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "opencv2/opencv.hpp"
+
+namespace watcher {
+
+// Rasterizes each string once into an 8-bit alpha mask and alpha-blends the mask onto the image afterwards.
+//
+// cv::putText walks the Hershey strokes of every glyph on each call, while most overlay text (labels, the
+// criteria, the FPS within a second) is the same from frame to frame. Masks are keyed by everything that
+// shapes the glyphs, but not by the color, so a string drawn in two colors shares one mask.
+// The least recently drawn mask is dropped once `capacity` masks are cached. Text that changes on every frame,
+// like a clock, gains nothing from the cache and should be drawn with cv::putText instead.
+//
+// Blending is done for 8-bit 3-channel images; others fall back to cv::putText.
+class TextCache {
+ public:
+  static TextCache& instance();
+
+  explicit TextCache(size_t capacity = 128) : capacity_(capacity) {}
+
+  // Same arguments and result as cv::putText
+  void draw(cv::Mat& image, const std::string& text, cv::Point org, int font_face, double font_scale,
+            const cv::Scalar& color, int thickness = 1, int line_type = cv::LINE_8, bool bottom_left_origin = false);
+
+  [[nodiscard]] size_t size() const;
+  void clear();
+
+ private:
+  struct Key {
+    std::string text;
+    int font_face;
+    double font_scale;
+    int thickness;
+    int line_type;
+    bool bottom_left_origin;
+
+    bool operator==(const Key& other) const {
+      return text == other.text && font_face == other.font_face && font_scale == other.font_scale &&
+             thickness == other.thickness && line_type == other.line_type &&
+             bottom_left_origin == other.bottom_left_origin;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const noexcept;
+  };
+
+  struct Mask {
+    cv::Mat alpha;     // CV_8UC1
+    cv::Point offset;  // Top-left corner of the mask relative to the text origin
+  };
+
+  // Most recently drawn first
+  using Entries = std::list<std::pair<Key, Mask>>;
+
+  const Mask& find_or_render(Key key);
+
+  size_t capacity_;
+  Entries entries_;
+  std::unordered_map<Key, Entries::iterator, KeyHash> masks_;
+  mutable std::mutex m_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_DRAWABLE_TEXT_CACHE_H_
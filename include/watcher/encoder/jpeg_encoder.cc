@@ -0,0 +1,220 @@
+#include "watcher/encoder/jpeg_encoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+enum : uchar {
+  kMarkerSOF0 = 0xC0,
+  kMarkerSOF1 = 0xC1,
+  kMarkerSOF2 = 0xC2,
+  kMarkerRST0 = 0xD0,
+  kMarkerSOI = 0xD8,
+  kMarkerEOI = 0xD9,
+  kMarkerSOS = 0xDA,
+  kMarkerDRI = 0xDD,
+};
+
+// Offsets of the segments needed to splice strips
+struct JpegLayout {
+  size_t sof = 0;  // Start of the SOF marker
+  size_t sos = 0;  // Start of the SOS marker
+  size_t scan = 0; // First byte of entropy-coded data
+  int mcu_width = 0;
+  int mcu_height = 0;
+};
+
+bool ParseLayout(const std::vector<uchar>& jpeg, JpegLayout& layout) {
+  if (jpeg.size() < 4 || jpeg[0] != 0xFF || jpeg[1] != kMarkerSOI ||
+      jpeg[jpeg.size() - 2] != 0xFF || jpeg[jpeg.size() - 1] != kMarkerEOI)
+    return false;
+
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size()) {
+    if (jpeg[pos] != 0xFF)
+      return false;
+
+    const auto marker = jpeg[pos + 1];
+    if (marker == 0xFF) { // Fill byte
+      ++pos;
+      continue;
+    }
+
+    const size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+    switch (marker) {
+      case kMarkerSOF0:
+      case kMarkerSOF1: {
+        if (pos + 10 > jpeg.size() || pos + 10 + jpeg[pos + 9] * 3 > jpeg.size())
+          return false;
+        const int components = jpeg[pos + 9];
+        int h = 1, v = 1;
+        for (int i = 0; i < components; ++i) {
+          const auto sampling = jpeg[pos + 11 + i * 3];
+          h = std::max(h, sampling >> 4);
+          v = std::max(v, sampling & 0x0F);
+        }
+        layout.sof = pos;
+        layout.mcu_width = components == 1 ? 8 : 8 * h;
+        layout.mcu_height = components == 1 ? 8 : 8 * v;
+        break;
+      }
+
+      case kMarkerSOF2: // Progressive scans cannot be joined
+      case kMarkerDRI:  // Neither can strips that already use restart markers
+        return false;
+
+      case kMarkerSOS:
+        layout.sos = pos;
+        layout.scan = pos + 2 + length;
+        return layout.sof != 0 && layout.scan <= jpeg.size() - 2;
+
+      default:
+        break;
+    }
+
+    pos += 2 + length;
+  }
+
+  return false;
+}
+
+// MCU size libjpeg uses for the given sampling
+cv::Size McuSize(JpegEncoder::Subsampling subsampling) {
+  switch (subsampling) {
+    case JpegEncoder::Subsampling::k444:
+    case JpegEncoder::Subsampling::kGray:
+      return {8, 8};
+    case JpegEncoder::Subsampling::k422:
+      return {16, 8};
+    case JpegEncoder::Subsampling::k420:
+    default:
+      return {16, 16};
+  }
+}
+
+} // namespace
+
+bool JpegEncoder::encode(const cv::Mat& image, std::vector<uchar>& dst) {
+  const auto t0 = std::chrono::steady_clock::now();
+  const auto subsampling = subsampling_.load();
+  const cv::Size size(width_, height_);
+
+  const cv::Mat* src = &image;
+  if (!size.empty() && size != image.size()) {
+    cv::resize(*src, converted_, size, 0, 0, cv::INTER_AREA);
+    src = &converted_;
+  }
+  if (subsampling == Subsampling::kGray && src->channels() == 3) {
+    cv::cvtColor(*src, converted_, cv::COLOR_BGR2GRAY);
+    src = &converted_;
+  }
+
+  params_.clear();
+  params_.insert(params_.end(), {cv::IMWRITE_JPEG_QUALITY, quality_.load()});
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 7)
+  switch (subsampling) {
+    case Subsampling::k444:
+      params_.insert(params_.end(), {cv::IMWRITE_JPEG_SAMPLING_FACTOR, cv::IMWRITE_JPEG_SAMPLING_FACTOR_444});
+      break;
+    case Subsampling::k422:
+      params_.insert(params_.end(), {cv::IMWRITE_JPEG_SAMPLING_FACTOR, cv::IMWRITE_JPEG_SAMPLING_FACTOR_422});
+      break;
+    default:
+      break;
+  }
+#endif
+
+  try {
+    const bool encoded = encode_strips(*src, dst) || encode_whole(*src, dst);
+    encode_time_.observe(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    return encoded;
+  } catch (const cv::Exception& e) {
+    Log.e("Failed to encode JPEG: ", e.what());
+    return false;
+  }
+}
+
+bool JpegEncoder::encode_whole(const cv::Mat& image, std::vector<uchar>& dst) {
+  return cv::imencode(".jpg", image, dst, params_);
+}
+
+bool JpegEncoder::encode_strips(const cv::Mat& image, std::vector<uchar>& dst) {
+  auto mcu = McuSize(image.channels() == 1 ? Subsampling::kGray : subsampling_.load());
+#if !(CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 7))
+  if (image.channels() != 1)
+    mcu = McuSize(Subsampling::k420);
+#endif
+
+  const int max_strips = strips_ == 0 ? cv::getNumThreads() : strips_.load();
+  const int mcu_rows = (image.rows + mcu.height - 1) / mcu.height;
+  const int mcu_cols = (image.cols + mcu.width - 1) / mcu.width;
+
+  const int mcu_rows_per_strip = (mcu_rows + std::max(1, max_strips) - 1) / std::max(1, max_strips);
+  const int num_strips = (mcu_rows + mcu_rows_per_strip - 1) / mcu_rows_per_strip;
+  const int restart_interval = mcu_rows_per_strip * mcu_cols;
+
+  // The restart interval is a 16-bit field
+  if (num_strips <= 1 || restart_interval > 0xFFFF)
+    return false;
+
+  const int strip_height = mcu_rows_per_strip * mcu.height;
+  strip_buffers_.resize(num_strips);
+
+  std::atomic<bool> ok{true};
+  cv::parallel_for_(cv::Range(0, num_strips), [&](const cv::Range& range) {
+    for (int i = range.start; i < range.end; ++i) {
+      const auto rows = cv::Range(i * strip_height, std::min(image.rows, (i + 1) * strip_height));
+      if (!cv::imencode(".jpg", image.rowRange(rows), strip_buffers_[i], params_))
+        ok = false;
+    }
+  });
+  if (!ok)
+    return false;
+
+  std::vector<JpegLayout> layouts(num_strips);
+  for (int i = 0; i < num_strips; ++i) {
+    if (!ParseLayout(strip_buffers_[i], layouts[i]))
+      return false;
+  }
+
+  // The encoder picked a different MCU size than assumed. The strips would not line up
+  if (layouts[0].mcu_width != mcu.width || layouts[0].mcu_height != mcu.height) {
+    Log.d("Unexpected JPEG MCU size ", layouts[0].mcu_width, 'x', layouts[0].mcu_height, ". Encoding in one piece");
+    return false;
+  }
+
+  // Headers of the first strip, with the full image height and a restart interval
+  const auto& first = strip_buffers_[0];
+  dst.assign(first.begin(), first.begin() + layouts[0].sos);
+  dst[layouts[0].sof + 5] = static_cast<uchar>(image.rows >> 8);
+  dst[layouts[0].sof + 6] = static_cast<uchar>(image.rows & 0xFF);
+  dst.insert(dst.end(), {
+    0xFF, kMarkerDRI, 0x00, 0x04,
+    static_cast<uchar>(restart_interval >> 8), static_cast<uchar>(restart_interval & 0xFF)
+  });
+  dst.insert(dst.end(), first.begin() + layouts[0].sos, first.begin() + layouts[0].scan);
+
+  // Entropy-coded data of every strip, separated by RST0..RST7
+  for (int i = 0; i < num_strips; ++i) {
+    const auto& strip = strip_buffers_[i];
+    dst.insert(dst.end(), strip.begin() + layouts[i].scan, strip.end() - 2);
+    if (i + 1 < num_strips)
+      dst.insert(dst.end(), {0xFF, static_cast<uchar>(kMarkerRST0 + i % 8)});
+  }
+  dst.insert(dst.end(), {0xFF, kMarkerEOI});
+
+  return true;
+}
+
+} // namespace watcher
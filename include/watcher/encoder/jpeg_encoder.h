@@ -0,0 +1,71 @@
+#ifndef WATCHER_ENCODER_JPEG_ENCODER_H_
+#define WATCHER_ENCODER_JPEG_ENCODER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/metrics/metrics.h"
+
+namespace watcher {
+
+// Baseline JPEG encoder that keeps its scratch buffers between frames.
+//
+// Large frames are cut into horizontal strips that are encoded in parallel with cv::parallel_for_.
+// Every strip but the last is a whole number of MCU rows, so the strips can be joined into one image
+// with a restart marker between them. The result decodes like any other baseline JPEG.
+//
+// Setters may be called from any thread and take effect from the next frame.
+// encode() itself must not be called concurrently.
+class JpegEncoder {
+ public:
+  enum class Subsampling {
+    k444,
+    k422,
+    k420,
+    kGray,
+  };
+
+  JpegEncoder() = default;
+
+  JpegEncoder& quality(int value) { quality_ = std::clamp(value, 1, 100); return *this; }
+  [[nodiscard]] int quality() const { return quality_; }
+
+  // Needs OpenCV 4.7 or later. Older versions always use 4:2:0 for color images
+  JpegEncoder& subsampling(Subsampling value) { subsampling_ = value; return *this; }
+  [[nodiscard]] Subsampling subsampling() const { return subsampling_; }
+
+  // Frames are resized to `size` before encoding. An empty size keeps the input size
+  JpegEncoder& resolution(cv::Size size) { width_ = size.width; height_ = size.height; return *this; }
+  [[nodiscard]] cv::Size resolution() const { return {width_, height_}; }
+
+  // Upper bound on the number of strips. 0 uses one per OpenCV thread, 1 disables splitting
+  JpegEncoder& strips(int value) { strips_ = std::max(0, value); return *this; }
+  [[nodiscard]] int strips() const { return strips_; }
+
+  // Encodes `image` into `dst`, reusing its capacity. Returns false if encoding failed
+  bool encode(const cv::Mat& image, std::vector<uchar>& dst);
+
+ private:
+  bool encode_whole(const cv::Mat& image, std::vector<uchar>& dst);
+  bool encode_strips(const cv::Mat& image, std::vector<uchar>& dst);
+
+  std::atomic<int> quality_{95};
+  std::atomic<Subsampling> subsampling_{Subsampling::k420};
+  std::atomic<int> width_{0};
+  std::atomic<int> height_{0};
+  std::atomic<int> strips_{0};
+
+  cv::Mat converted_;
+  std::vector<int> params_;
+  std::vector<std::vector<uchar>> strip_buffers_;
+
+  Histogram& encode_time_ = MetricsRegistry::instance().histogram(
+    "watcher_encode_ms", "Time spent encoding a frame, resizing included");
+};
+
+} // namespace watcher
+
+#endif // WATCHER_ENCODER_JPEG_ENCODER_H_
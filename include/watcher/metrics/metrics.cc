@@ -0,0 +1,221 @@
+#include "watcher/metrics/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace watcher {
+
+namespace {
+
+void AppendEscaped(std::string& out, std::string_view value) {
+  for (const auto c : value) {
+    switch (c) {
+      case '\\': out += "\\\\"; break;
+      case '"': out += "\\\""; break;
+      case '\n': out += "\\n"; break;
+      default: out += c;
+    }
+  }
+}
+
+void AppendValue(std::string& out, double value) {
+  if (std::isnan(value)) {
+    out += "NaN";
+  } else if (std::isinf(value)) {
+    out += value > 0 ? "+Inf" : "-Inf";
+  } else {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.10g", value);
+    out += buf;
+  }
+}
+
+const char* TypeName(int type) {
+  static const char* names[] = {"counter", "gauge", "summary"};
+  return names[type];
+}
+
+} // namespace
+
+void MetricsRegistry::Writer::family(std::string_view name, std::string_view help, std::string_view type) {
+  out_.append("# HELP ").append(name).append(" ");
+  for (const auto c : help)
+    out_ += (c == '\n' ? ' ' : c);
+  out_.append("\n# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void MetricsRegistry::Writer::sample(std::string_view name, double value, const MetricLabels& labels) {
+  out_.append(name);
+  if (!labels.empty() || !const_labels_.empty()) {
+    out_ += '{';
+    bool first = true;
+    for (const auto* set : {&const_labels_, &labels}) {
+      for (const auto& [key, label] : *set) {
+        if (!first)
+          out_ += ',';
+        first = false;
+        out_.append(key).append("=\"");
+        AppendEscaped(out_, label);
+        out_ += '"';
+      }
+    }
+    out_ += '}';
+  }
+  out_ += ' ';
+  AppendValue(out_, value);
+  out_ += '\n';
+}
+
+void MetricsRegistry::Registration::reset() {
+  if (registry_)
+    registry_->remove_collector(id_);
+  registry_ = nullptr;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const MetricLabels& labels) {
+  std::lock_guard lck(m_);
+  auto& e = entry(name, help, labels, Type::kCounter);
+  if (!e.counter)
+    e.counter = std::make_unique<Counter>();
+  return *e.counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const MetricLabels& labels) {
+  std::lock_guard lck(m_);
+  auto& e = entry(name, help, labels, Type::kGauge);
+  if (!e.gauge)
+    e.gauge = std::make_unique<Gauge>();
+  return *e.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const MetricLabels& labels,
+                                      std::chrono::seconds window) {
+  std::lock_guard lck(m_);
+  auto& e = entry(name, help, labels, Type::kHistogram);
+  if (!e.histogram)
+    e.histogram = std::make_unique<Histogram>(window);
+  return *e.histogram;
+}
+
+MetricsRegistry::Registration MetricsRegistry::gauge(const std::string& name, const std::string& help,
+                                                     std::function<double()> func, const MetricLabels& labels) {
+  {
+    std::lock_guard lck(m_);
+    if (families_.count(name) != 0)
+      throw std::invalid_argument("Metric " + name + " is already registered");
+  }
+
+  std::lock_guard lck(collectors_m_);
+  const auto id = next_id_++;
+  auto& family = callback_gauges_.try_emplace(name, CallbackFamily{help, {}}).first->second;
+  family.entries.push_back({id, labels, std::move(func)});
+  return Registration(this, id);
+}
+
+MetricsRegistry::Registration MetricsRegistry::add_collector(collector func) {
+  std::lock_guard lck(collectors_m_);
+  const auto id = next_id_++;
+  collectors_.emplace(id, std::move(func));
+  return Registration(this, id);
+}
+
+MetricsRegistry& MetricsRegistry::const_labels(MetricLabels labels) {
+  std::lock_guard lck(m_);
+  const_labels_ = std::move(labels);
+  return *this;
+}
+
+std::string MetricsRegistry::render() const {
+  std::string out;
+  MetricLabels const_labels;
+  {
+    std::lock_guard lck(m_);
+    const_labels = const_labels_;
+    Writer writer(out, const_labels);
+
+    for (const auto& [name, family] : families_) {
+      writer.family(name, family.help, TypeName(static_cast<int>(family.type)));
+      for (const auto& e : family.entries) {
+        switch (family.type) {
+          case Type::kCounter:
+            writer.sample(name, static_cast<double>(e.counter->value()), e.labels);
+            break;
+          case Type::kGauge:
+            writer.sample(name, e.gauge->value(), e.labels);
+            break;
+          case Type::kHistogram: {
+            const auto s = e.histogram->snapshot();
+            const bool empty = s.samples == 0;
+            const std::pair<const char*, double> quantiles[] = {{"0.5", s.p50}, {"0.95", s.p95}, {"0.99", s.p99}};
+            for (const auto& [q, value] : quantiles) {
+              auto labels = e.labels;
+              labels.emplace_back("quantile", q);
+              writer.sample(name, empty ? NAN : value, labels);
+            }
+            writer.sample(name + "_sum", e.histogram->sum(), e.labels);
+            writer.sample(name + "_count", static_cast<double>(e.histogram->count()), e.labels);
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  Writer writer(out, const_labels);
+  std::lock_guard lck(collectors_m_);
+  for (const auto& [name, family] : callback_gauges_) {
+    writer.family(name, family.help, "gauge");
+    for (const auto& e : family.entries)
+      writer.sample(name, e.func(), e.labels);
+  }
+  for (const auto& [id, func] : collectors_)
+    func(writer);
+  return out;
+}
+
+MetricsRegistry::Entry& MetricsRegistry::entry(const std::string& name, const std::string& help,
+                                               const MetricLabels& labels, Type type) {
+  auto [it, inserted] = families_.try_emplace(name, Family{type, help, {}});
+  auto& family = it->second;
+  if (family.type != type)
+    throw std::invalid_argument("Metric " + name + " is already registered with another type");
+
+  const auto found = std::find_if(family.entries.begin(), family.entries.end(), [&](const Entry& e) {
+    return e.labels == labels;
+  });
+  if (found != family.entries.end())
+    return *found;
+
+  family.entries.push_back({labels, nullptr, nullptr, nullptr});
+  return family.entries.back();
+}
+
+void MetricsRegistry::remove_collector(uint64_t id) {
+  std::lock_guard lck(collectors_m_);
+  if (collectors_.erase(id) != 0)
+    return;
+  for (auto it = callback_gauges_.begin(); it != callback_gauges_.end(); ++it) {
+    auto& entries = it->second.entries;
+    const auto found = std::find_if(entries.begin(), entries.end(), [&](const CallbackEntry& e) { return e.id == id; });
+    if (found == entries.end())
+      continue;
+    entries.erase(found);
+    if (entries.empty())
+      callback_gauges_.erase(it);
+    return;
+  }
+}
+
+} // namespace watcher
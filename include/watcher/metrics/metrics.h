@@ -0,0 +1,181 @@
+#ifndef WATCHER_METRICS_METRICS_H_
+#define WATCHER_METRICS_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "watcher/utility/window_stats.h"
+
+namespace watcher {
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Monotonic count, e.g. frames or bytes
+class Counter {
+ public:
+  void inc(uint64_t n = 1) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+  [[nodiscard]] uint64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+ public:
+  void set(double value) noexcept { value_.store(value, std::memory_order_relaxed); }
+  [[nodiscard]] double value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+// Distribution of a value, e.g. a latency in milliseconds. Exported as a summary: p50/p95/p99 over
+// the recent window, and the sum and count since the start
+class Histogram {
+ public:
+  explicit Histogram(std::chrono::seconds window) : window_(window) {}
+
+  void observe(double value) {
+    window_.add(value);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    auto sum = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+  }
+
+  [[nodiscard]] WindowStats<>::Snapshot snapshot() const { return window_.snapshot(); }
+  [[nodiscard]] uint64_t count() const noexcept { return count_.load(std::memory_order_relaxed); }
+  [[nodiscard]] double sum() const noexcept { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  WindowStats<> window_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<double> sum_{0};
+};
+
+// Named counters, gauges and histograms, rendered in the Prometheus text format.
+//
+// Metrics are created on first use and live as long as the registry, so a component can look them up
+// once and keep the reference; recording is lock-free (histograms take a short lock).
+// Values that are cheaper to read on demand, like a queue length, are registered as callbacks instead.
+// Callbacks run on the thread that renders and stay registered while their Registration is alive.
+class MetricsRegistry {
+ public:
+  // Appends samples in the exposition format
+  class Writer {
+   public:
+    // Starts a metric family. `type` is counter, gauge, summary or untyped
+    void family(std::string_view name, std::string_view help, std::string_view type);
+    void sample(std::string_view name, double value, const MetricLabels& labels = {});
+
+   private:
+    friend class MetricsRegistry;
+    Writer(std::string& out, const MetricLabels& const_labels) : out_(out), const_labels_(const_labels) {}
+
+    std::string& out_;
+    const MetricLabels& const_labels_;
+  };
+
+  using collector = std::function<void(Writer&)>;
+
+  class Registration {
+   public:
+    Registration() = default;
+    Registration(Registration&& other) noexcept { swap(other); }
+    Registration& operator=(Registration&& other) noexcept { Registration(std::move(other)).swap(*this); return *this; }
+    ~Registration() { reset(); }
+
+    // Returns once the callback has finished running, if it was
+    void reset();
+
+   private:
+    friend class MetricsRegistry;
+    Registration(MetricsRegistry* registry, uint64_t id) : registry_(registry), id_(id) {}
+    void swap(Registration& other) noexcept { std::swap(registry_, other.registry_); std::swap(id_, other.id_); }
+
+    MetricsRegistry* registry_ = nullptr;
+    uint64_t id_ = 0;
+  };
+
+  // The registry every component reports to
+  static MetricsRegistry& instance();
+
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // Throw std::invalid_argument if `name` is already used by a metric of another type
+  Counter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+  Gauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+  Histogram& histogram(const std::string& name, const std::string& help, const MetricLabels& labels = {},
+                       std::chrono::seconds window = std::chrono::seconds(60));
+
+  // Gauge read from `func` at render time. Gauges registered under the same name are rendered as one family.
+  // Throws std::invalid_argument if `name` is already used by a metric created above
+  [[nodiscard]] Registration gauge(const std::string& name, const std::string& help, std::function<double()> func,
+                                   const MetricLabels& labels = {});
+
+  // Writes any number of families at render time
+  [[nodiscard]] Registration add_collector(collector func);
+
+  // Labels added to every sample, e.g. to tell units apart
+  MetricsRegistry& const_labels(MetricLabels labels);
+
+  [[nodiscard]] std::string render() const;
+
+ private:
+  enum class Type {
+    kCounter,
+    kGauge,
+    kHistogram,
+  };
+
+  struct Entry {
+    MetricLabels labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  struct Family {
+    Type type;
+    std::string help;
+    std::vector<Entry> entries;
+  };
+
+  struct CallbackEntry {
+    uint64_t id;
+    MetricLabels labels;
+    std::function<double()> func;
+  };
+
+  struct CallbackFamily {
+    std::string help;
+    std::vector<CallbackEntry> entries;
+  };
+
+  Entry& entry(const std::string& name, const std::string& help, const MetricLabels& labels, Type type);
+  void remove_collector(uint64_t id);
+
+  mutable std::mutex m_;
+  std::map<std::string, Family> families_;
+  MetricLabels const_labels_;
+
+  // Held while collectors run, so that a Registration can wait for its callback to return
+  mutable std::mutex collectors_m_;
+  std::map<uint64_t, collector> collectors_;
+  std::map<std::string, CallbackFamily> callback_gauges_;
+  uint64_t next_id_ = 1;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_METRICS_METRICS_H_
@@ -0,0 +1,150 @@
+#include "watcher/metrics/metrics_exporter.h"
+
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "boost/asio.hpp"
+
+#include "watcher/trace/trace.h"
+#include "watcher/utility/logger.h"
+#include "watcher/utility/thread_name.h"
+
+namespace watcher {
+
+namespace {
+
+constexpr size_t kMaxRequestSize = 8 * 1024;
+
+} // namespace
+
+// Answers one request and closes the connection
+class MetricsExporter::Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(boost::asio::ip::tcp::socket socket, MetricsRegistry& registry)
+    : socket_(std::move(socket)), request_(kMaxRequestSize), registry_(registry) {}
+
+  void start() {
+    boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+      [self = shared_from_this()](const boost::system::error_code& error, size_t) {
+        if (!error)
+          self->respond();
+      });
+  }
+
+ private:
+  void respond() {
+    std::istream is(&request_);
+    std::string method, target;
+    is >> method >> target;
+
+    const auto query = target.find('?');
+    const auto path = target.substr(0, query);
+
+    std::string status = "200 OK";
+    std::string content_type = "text/plain; version=0.0.4; charset=utf-8";
+    std::string body;
+    if (method != "GET") {
+      status = "405 Method Not Allowed";
+    } else if (path == "/metrics" || path == "/") {
+      body = registry_.render();
+    } else if (path == "/trace") {
+      content_type = "application/json";
+      body = Tracer::instance().dump();
+    } else {
+      status = "404 Not Found";
+    }
+
+    response_ = "HTTP/1.1 " + status + "\r\n"
+                "Content-Type: " + content_type + "\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+
+    boost::asio::async_write(socket_, boost::asio::buffer(response_),
+      [self = shared_from_this()](const boost::system::error_code&, size_t) {
+        boost::system::error_code ec;
+        self->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+      });
+  }
+
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::streambuf request_;
+  std::string response_;
+  MetricsRegistry& registry_;
+};
+
+MetricsExporter::MetricsExporter(MetricsRegistry& registry)
+  : registry_(registry),
+    work_(boost::asio::make_work_guard(io_context_)),
+    acceptor_(io_context_),
+    snapshot_timer_(io_context_),
+    thread_([this]() { io_context_.run(); })
+{
+  SetThreadName(thread_, "metrics");
+}
+
+MetricsExporter::~MetricsExporter() {
+  work_.reset();
+  io_context_.stop();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+MetricsExporter& MetricsExporter::listen(uint16_t port, const std::string& address) {
+  using boost::asio::ip::tcp;
+
+  // The acceptor is not used by the io thread until accept() is posted
+  const tcp::endpoint endpoint(boost::asio::ip::make_address(address), port);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  port_ = acceptor_.local_endpoint().port();
+
+  Log.i("Serving metrics on ", address, ":", port_, "/metrics");
+  boost::asio::post(io_context_, [this]() { accept(); });
+  return *this;
+}
+
+MetricsExporter& MetricsExporter::snapshot(std::string path, std::chrono::seconds interval) {
+  boost::asio::post(io_context_, [this, path = std::move(path), interval]() mutable {
+    snapshot_path_ = std::move(path);
+    snapshot_interval_ = interval;
+    write_snapshot();
+  });
+  return *this;
+}
+
+void MetricsExporter::accept() {
+  acceptor_.async_accept([this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
+    if (error == boost::asio::error::operation_aborted)
+      return;
+    if (!error)
+      std::make_shared<Session>(std::move(socket), registry_)->start();
+    accept();
+  });
+}
+
+void MetricsExporter::write_snapshot() {
+  const auto tmp = snapshot_path_ + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file << registry_.render();
+    if (!file) {
+      Log.e("Failed to write ", tmp);
+    }
+  }
+  if (std::rename(tmp.c_str(), snapshot_path_.c_str()) != 0)
+    Log.e("Failed to replace ", snapshot_path_);
+
+  snapshot_timer_.expires_after(snapshot_interval_);
+  snapshot_timer_.async_wait([this](const boost::system::error_code& error) {
+    if (!error)
+      write_snapshot();
+  });
+}
+
+} // namespace watcher
@@ -0,0 +1,59 @@
+#ifndef WATCHER_METRICS_METRICS_EXPORTER_H_
+#define WATCHER_METRICS_METRICS_EXPORTER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "boost/asio.hpp"
+
+#include "watcher/metrics/metrics.h"
+
+namespace watcher {
+
+// Publishes a MetricsRegistry on its own thread, so rendering never stalls the pipeline:
+// over HTTP at `/metrics` for a Prometheus scraper, and/or as a file rewritten periodically
+// (written to a temporary file and renamed, so readers never see a partial snapshot).
+// `/trace` answers the spans recorded so far in the Chrome trace-event format (see Tracer).
+class MetricsExporter {
+ public:
+  explicit MetricsExporter(MetricsRegistry& registry = MetricsRegistry::instance());
+
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  ~MetricsExporter();
+
+  // Throws boost::system::system_error if the port cannot be bound. Port 0 picks a free one.
+  // There is no authentication, so only the local host can connect unless another address is given
+  MetricsExporter& listen(uint16_t port, const std::string& address = "127.0.0.1");
+
+  MetricsExporter& snapshot(std::string path, std::chrono::seconds interval = std::chrono::seconds(10));
+
+  // Bound port. 0 if not listening
+  [[nodiscard]] uint16_t port() const { return port_; }
+
+ private:
+  class Session;
+
+  void accept();
+  void write_snapshot();
+
+  MetricsRegistry& registry_;
+
+  boost::asio::io_context io_context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::steady_timer snapshot_timer_;
+  std::string snapshot_path_;
+  std::chrono::seconds snapshot_interval_{10};
+  uint16_t port_ = 0;
+
+  std::thread thread_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_METRICS_METRICS_EXPORTER_H_
@@ -0,0 +1,101 @@
+#include "watcher/metrics/process_metrics.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if __linux__
+#include <unistd.h>
+#endif
+
+namespace watcher {
+
+namespace {
+
+struct CpuTime {
+  std::string name;
+  double seconds = 0;
+};
+
+// `/proc/.../stat` is `pid (comm) state ...`, with utime and stime as the 14th and 15th fields.
+// comm may contain spaces and parentheses, so fields are counted from the last ')'
+bool ReadCpuTime(const std::string& path, CpuTime& out) {
+#if __linux__
+  std::ifstream file(path);
+  std::string line;
+  if (!std::getline(file, line))
+    return false;
+
+  const auto open = line.find('(');
+  const auto close = line.rfind(')');
+  if (open == std::string::npos || close == std::string::npos || close < open)
+    return false;
+
+  out.name = line.substr(open + 1, close - open - 1);
+
+  std::istringstream fields(line.substr(close + 1));
+  std::string field;
+  unsigned long long utime = 0, stime = 0;
+  for (int i = 3; i <= 15 && fields >> field; ++i) {
+    if (i == 14)
+      utime = std::stoull(field);
+    else if (i == 15)
+      stime = std::stoull(field);
+  }
+
+  static const double ticks = static_cast<double>(::sysconf(_SC_CLK_TCK));
+  out.seconds = static_cast<double>(utime + stime) / ticks;
+  return true;
+#else
+  (void)path;
+  (void)out;
+  return false;
+#endif
+}
+
+double ResidentBytes() {
+#if __linux__
+  std::ifstream file("/proc/self/statm");
+  unsigned long long size = 0, resident = 0;
+  if (!(file >> size >> resident))
+    return 0;
+  return static_cast<double>(resident) * static_cast<double>(::sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+void Collect(MetricsRegistry::Writer& writer) {
+#if __linux__
+  writer.family("watcher_process_resident_memory_bytes", "Resident set size", "gauge");
+  writer.sample("watcher_process_resident_memory_bytes", ResidentBytes());
+
+  if (CpuTime process; ReadCpuTime("/proc/self/stat", process)) {
+    writer.family("watcher_process_cpu_seconds_total", "User and system CPU time of the process", "counter");
+    writer.sample("watcher_process_cpu_seconds_total", process.seconds);
+  }
+
+  writer.family("watcher_thread_cpu_seconds_total", "User and system CPU time per thread", "counter");
+  std::error_code ec;
+  for (const auto& task : std::filesystem::directory_iterator("/proc/self/task", ec)) {
+    CpuTime thread;
+    // The thread may have exited since the directory was listed
+    if (!ReadCpuTime((task.path() / "stat").string(), thread))
+      continue;
+    writer.sample("watcher_thread_cpu_seconds_total", thread.seconds, {
+      {"thread", thread.name},
+      {"tid", task.path().filename().string()},
+    });
+  }
+#else
+  (void)writer;
+#endif
+}
+
+} // namespace
+
+ProcessMetrics::ProcessMetrics(MetricsRegistry& registry)
+  : registration_(registry.add_collector(Collect)) {}
+
+} // namespace watcher
@@ -0,0 +1,21 @@
+#ifndef WATCHER_METRICS_PROCESS_METRICS_H_
+#define WATCHER_METRICS_PROCESS_METRICS_H_
+
+#include "watcher/metrics/metrics.h"
+
+namespace watcher {
+
+// Resident memory, and CPU time of the process and of each of its threads, read from /proc when rendered.
+// Threads are labelled with their name (see SetThreadName), so a saturated stage shows up as the one
+// whose CPU time grows by a second per second. Reports nothing outside Linux
+class ProcessMetrics {
+ public:
+  explicit ProcessMetrics(MetricsRegistry& registry = MetricsRegistry::instance());
+
+ private:
+  MetricsRegistry::Registration registration_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_METRICS_PROCESS_METRICS_H_
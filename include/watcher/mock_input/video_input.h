@@ -19,6 +19,9 @@ class VideoInput : public IImageGenerator {
 
   IImageGenerator& operator>>(cv::Mat& input) override;
 
+  bool is_open() const { return video_.isOpened(); }
+  double fps() const { return fps_; }
+
  private:
   cv::VideoCapture video_;
   int skip_frame_ = 1;
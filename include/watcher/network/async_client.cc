@@ -0,0 +1,345 @@
+#include "watcher/network/async_client.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+// Collects the packets Protocol writes instead of sending them. Headers are copied into `headers`;
+// payloads are only referenced, since the request that owns them outlives the write.
+struct PacketWriter {
+  struct Part {
+    size_t header_offset; // `headers` may still grow, so remember the offset rather than a pointer
+    size_t header_size;
+    boost::asio::const_buffer data;
+  };
+
+  std::vector<char>& headers;
+  std::vector<Part>& parts;
+
+  size_t send(const char* header, size_t header_size, const char* data, size_t data_size) {
+    parts.push_back({headers.size(), header_size, boost::asio::buffer(data, data_size)});
+    headers.insert(headers.end(), header, header + header_size);
+    return header_size + data_size;
+  }
+};
+
+} // namespace
+
+void AsyncClient::Handle::cancel() const {
+  if (auto client = client_.lock()) {
+    boost::asio::post(client->io_context_, [client, id = id_]() { client->cancel(id); });
+  }
+}
+
+std::shared_ptr<AsyncClient> AsyncClient::create(NetworkEngine& engine, std::string url, std::string port,
+                                                 size_t max_queue) {
+  return std::shared_ptr<AsyncClient>(new AsyncClient(engine, std::move(url), std::move(port), max_queue));
+}
+
+AsyncClient::AsyncClient(NetworkEngine& engine, std::string url, std::string port, size_t max_queue)
+  : io_context_(engine.context()),
+    resolver_(io_context_),
+    socket_(io_context_),
+    deadline_(io_context_),
+    url_(std::move(url)),
+    port_(std::move(port)),
+    max_queue_(max_queue) {}
+
+AsyncClient::Handle AsyncClient::Get(std::string request, duration timeout, callback cb) {
+  Request r;
+  r.expects_response = true;
+  r.request = std::move(request);
+  r.timeout = timeout;
+  r.cb = std::move(cb);
+  return enqueue(std::move(r));
+}
+
+std::future<AsyncClient::response> AsyncClient::Get(std::string request, duration timeout) {
+  auto promise = std::make_shared<std::promise<response>>();
+  auto future = promise->get_future();
+
+  Get(std::move(request), timeout, [promise](const boost::system::error_code& error, response result) {
+    if (error)
+      promise->set_exception(std::make_exception_ptr(boost::system::system_error(error)));
+    else
+      promise->set_value(std::move(result));
+  });
+
+  return future;
+}
+
+AsyncClient::Handle AsyncClient::Post(std::vector<unsigned char> data, Protocol::optional_header header,
+                                      duration timeout, callback cb) {
+  return Post(std::make_shared<const std::vector<unsigned char>>(std::move(data)), std::move(header),
+              timeout, std::move(cb));
+}
+
+AsyncClient::Handle AsyncClient::Post(std::shared_ptr<const std::vector<unsigned char>> data,
+                                      Protocol::optional_header header, duration timeout, callback cb) {
+  Request r;
+  r.data = std::move(data);
+  r.header = std::move(header);
+  r.timeout = timeout;
+  r.cb = std::move(cb);
+  return enqueue(std::move(r));
+}
+
+void AsyncClient::cancel_all() {
+  boost::asio::post(io_context_, [self = shared_from_this()]() {
+    while (!self->queue_.empty())
+      self->cancel(self->queue_.front().id);
+    if (self->current_)
+      self->cancel(self->current_->id);
+  });
+}
+
+void AsyncClient::header_format(HeaderFormat format) {
+  boost::asio::post(io_context_, [self = shared_from_this(), format]() {
+    self->protocol_.header_format(format);
+  });
+}
+
+AsyncClient::Stats AsyncClient::stats() const {
+  Stats s;
+  s.connects = connects_;
+  s.completed = completed_;
+  s.failed = failed_;
+  s.dropped = dropped_;
+  s.bytes_sent = bytes_sent_;
+  s.bytes_received = bytes_received_;
+  return s;
+}
+
+AsyncClient::Handle AsyncClient::enqueue(Request request) {
+  request.id = next_id_++;
+  const auto id = request.id;
+  ++pending_;
+
+  boost::asio::post(io_context_, [self = shared_from_this(), r = std::move(request)]() mutable {
+    if (self->queue_.size() >= self->max_queue_) {
+      auto dropped = std::move(self->queue_.front());
+      self->queue_.pop_front();
+      --self->pending_;
+      ++self->dropped_;
+      if (dropped.cb)
+        dropped.cb(boost::asio::error::operation_aborted, {});
+    }
+
+    self->queue_.emplace_back(std::move(r));
+    if (!self->current_)
+      self->start_next();
+  });
+
+  return Handle(weak_from_this(), id);
+}
+
+void AsyncClient::cancel(uint64_t id) {
+  if (current_ && current_->id == id) {
+    aborted_ = true;
+    abort_reason_ = boost::asio::error::operation_aborted;
+    close();
+    return;
+  }
+
+  const auto it = std::find_if(queue_.begin(), queue_.end(), [id](const Request& r) { return r.id == id; });
+  if (it == queue_.end())
+    return;
+
+  auto cb = std::move(it->cb);
+  queue_.erase(it);
+  --pending_;
+  if (cb)
+    cb(boost::asio::error::operation_aborted, {});
+}
+
+void AsyncClient::start_next() {
+  if (queue_.empty())
+    return;
+
+  current_ = std::move(queue_.front());
+  queue_.pop_front();
+  aborted_ = false;
+
+  // Encode the whole request up front. Packets go out in one gathered write
+  headers_.clear();
+  std::vector<PacketWriter::Part> parts;
+  PacketWriter writer{headers_, parts};
+  try {
+    if (current_->expects_response) {
+      protocol_.SendRequest(writer, current_->request.data(), current_->request.size());
+    } else {
+      protocol_.WritePost(writer, reinterpret_cast<const char*>(current_->data->data()), current_->data->size(),
+                          std::move(current_->header));
+    }
+  } catch (const std::exception& e) {
+    // A header over kPacketMaxHeaderSize. Only this request fails; an exception here would stop the io thread
+    Log.e("Cannot encode the request: ", e.what());
+    finish(boost::asio::error::message_size);
+    return;
+  }
+
+  out_.clear();
+  for (const auto& part : parts) {
+    out_.emplace_back(headers_.data() + part.header_offset, part.header_size);
+    out_.emplace_back(part.data);
+  }
+
+  deadline_.expires_after(current_->timeout);
+  deadline_.async_wait([self = shared_from_this(), id = current_->id](const boost::system::error_code& error) {
+    if (error || !self->current_ || self->current_->id != id)
+      return;
+    self->aborted_ = true;
+    self->abort_reason_ = boost::asio::error::timed_out;
+    self->close();
+  });
+
+  if (socket_.is_open()) {
+    write();
+  } else {
+    connect();
+  }
+}
+
+void AsyncClient::connect() {
+  if (std::chrono::steady_clock::now() < next_connect_) {
+    // Still backing off from the last failure. Fail fast instead of piling up connects
+    boost::asio::post(io_context_, [self = shared_from_this()]() {
+      self->finish(boost::asio::error::try_again);
+    });
+    return;
+  }
+
+  const auto on_connect = [self = shared_from_this()](const boost::system::error_code& error, const auto&) {
+    if (error) {
+      self->next_connect_ = std::chrono::steady_clock::now() + self->backoff_;
+      self->backoff_ = std::min(self->backoff_ * 2, kMaxBackoff);
+      self->close();
+      self->finish(error);
+      return;
+    }
+
+    boost::system::error_code ignored_error;
+    self->socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored_error);
+    self->socket_.set_option(boost::asio::socket_base::keep_alive(true), ignored_error);
+    self->backoff_ = std::chrono::milliseconds(100);
+    ++self->connects_;
+    self->write();
+  };
+
+  if (!endpoints_.empty()) {
+    boost::asio::async_connect(socket_, endpoints_, on_connect);
+    return;
+  }
+
+  resolver_.async_resolve(url_, port_, [self = shared_from_this(), on_connect](
+    const boost::system::error_code& error, boost::asio::ip::tcp::resolver::results_type endpoints) {
+    if (error) {
+      self->finish(error);
+      return;
+    }
+    self->endpoints_ = std::move(endpoints);
+    boost::asio::async_connect(self->socket_, self->endpoints_, on_connect);
+  });
+}
+
+void AsyncClient::write() {
+  boost::asio::async_write(socket_, out_, [self = shared_from_this()](
+    const boost::system::error_code& error, size_t len) {
+    self->bytes_sent_ += len;
+    if (error) {
+      self->close();
+      self->finish(error);
+      return;
+    }
+
+    if (!self->current_->expects_response) {
+      self->finish({});
+      return;
+    }
+
+    self->receive_state_ = {};
+    self->result_.clear();
+    self->data_.clear();
+    self->read();
+  });
+}
+
+void AsyncClient::read() {
+  // Upload-only clients never read, so the packet buffer is allocated on first use
+  if (!packet_)
+    packet_ = std::make_unique<Packet>();
+
+  packet_->clear();
+  boost::asio::async_read(socket_, boost::asio::buffer(packet_->buffer(), packet_->capacity()), [self = shared_from_this()](
+    const boost::system::error_code& error, size_t len) {
+    self->bytes_received_ += len;
+    self->packet_->setSize(len);
+
+    const auto status = Protocol::ConsumePacket(*self->packet_, self->receive_state_, self->result_,
+                                                [&](const auto&, const char* chunk, size_t chunk_size) {
+      self->data_.append(chunk, chunk_size);
+    });
+
+    if (status == Protocol::PacketStatus::kDone) {
+      // The server may close the connection after the last packet
+      if (error)
+        self->close();
+      self->result_["data"] = std::move(self->data_);
+      self->finish({}, std::move(self->result_));
+      return;
+    }
+
+    if (error || status == Protocol::PacketStatus::kInvalid) {
+      self->close();
+      self->finish(error ? error : boost::asio::error::make_error_code(boost::asio::error::eof));
+      return;
+    }
+
+    self->read();
+  });
+}
+
+void AsyncClient::finish(boost::system::error_code error, response result) {
+  if (!current_)
+    return;
+
+  deadline_.cancel();
+  if (aborted_)
+    error = abort_reason_;
+
+  auto cb = std::move(current_->cb);
+  current_.reset();
+  --pending_;
+
+  if (error) {
+    ++failed_;
+    Log.e("Request failed: ", error.message());
+  } else {
+    ++completed_;
+  }
+
+  if (cb)
+    cb(error, std::move(result));
+
+  start_next();
+}
+
+void AsyncClient::close() {
+  boost::system::error_code ignored_error;
+  resolver_.cancel();
+  if (socket_.is_open()) {
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_error);
+    socket_.close(ignored_error);
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,152 @@
+#ifndef WATCHER_NETWORK_ASYNC_CLIENT_H_
+#define WATCHER_NETWORK_ASYNC_CLIENT_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "boost/asio.hpp"
+
+#include "watcher/network/network_engine.h"
+#include "watcher/network/packet.h"
+#include "watcher/network/packet_header.h"
+#include "watcher/network/protocol.h"
+
+namespace watcher {
+
+// Non-blocking Protocol client over one persistent connection.
+//
+// The protocol has no request ids, so requests on one client are sent one at a time in FIFO order.
+// Use one client per traffic class (e.g. uploads and settings) to let them overlap; clients created on
+// the same NetworkEngine share its thread.
+//
+// Callbacks run on the engine thread and must not block.
+class AsyncClient : public std::enable_shared_from_this<AsyncClient> {
+ public:
+  using response = Protocol::response;
+  using duration = std::chrono::steady_clock::duration;
+  using callback = std::function<void(const boost::system::error_code&, response)>;
+
+  struct Stats {
+    size_t connects = 0;
+    size_t completed = 0;
+    size_t failed = 0;
+    size_t dropped = 0;
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+  };
+
+  class Handle {
+   public:
+    Handle() = default;
+
+    // The callback is invoked with operation_aborted unless the request already completed
+    void cancel() const;
+
+   private:
+    friend class AsyncClient;
+    Handle(std::weak_ptr<AsyncClient> client, uint64_t id) : client_(std::move(client)), id_(id) {}
+
+    std::weak_ptr<AsyncClient> client_;
+    uint64_t id_ = 0;
+  };
+
+  // `max_queue` bounds the requests waiting behind the one in flight. The oldest is dropped first
+  static std::shared_ptr<AsyncClient> create(NetworkEngine& engine, std::string url, std::string port,
+                                             size_t max_queue = 8);
+
+  AsyncClient(const AsyncClient&) = delete;
+  AsyncClient& operator=(const AsyncClient&) = delete;
+
+  Handle Get(std::string request, duration timeout, callback cb);
+  std::future<response> Get(std::string request, duration timeout);
+
+  Handle Post(std::vector<unsigned char> data, Protocol::optional_header header, duration timeout, callback cb);
+
+  // `data` is released once the request completes, so the caller can tell when to reuse it
+  Handle Post(std::shared_ptr<const std::vector<unsigned char>> data, Protocol::optional_header header,
+              duration timeout, callback cb);
+
+  void cancel_all();
+
+  // Takes effect from the next request
+  void header_format(HeaderFormat format);
+
+  // Requests queued or in flight
+  [[nodiscard]] size_t pending() const { return pending_; }
+
+  [[nodiscard]] Stats stats() const;
+
+ private:
+  struct Request {
+    uint64_t id = 0;
+    bool expects_response = false;
+    std::string request;
+    std::shared_ptr<const std::vector<unsigned char>> data;
+    Protocol::optional_header header;
+    duration timeout{};
+    callback cb;
+  };
+
+  AsyncClient(NetworkEngine& engine, std::string url, std::string port, size_t max_queue);
+
+  Handle enqueue(Request request);
+  void cancel(uint64_t id);
+
+  void start_next();
+  void connect();
+  void write();
+  void read();
+  void finish(boost::system::error_code error, response result = {});
+  void close();
+
+  boost::asio::io_context& io_context_;
+  boost::asio::ip::tcp::resolver resolver_;
+  boost::asio::ip::tcp::resolver::results_type endpoints_;
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::steady_timer deadline_;
+
+  std::string url_;
+  std::string port_;
+  size_t max_queue_;
+
+  std::deque<Request> queue_;
+  std::optional<Request> current_;
+  std::vector<char> headers_;
+  std::vector<boost::asio::const_buffer> out_;
+  bool aborted_ = false;
+  boost::system::error_code abort_reason_;
+
+  // Connect failures are retried no sooner than this, doubling up to kMaxBackoff
+  std::chrono::steady_clock::time_point next_connect_{};
+  std::chrono::milliseconds backoff_{100};
+  static constexpr std::chrono::milliseconds kMaxBackoff{5000};
+
+  Protocol protocol_;
+  std::unique_ptr<Packet> packet_;
+  Protocol::ReceiveState receive_state_;
+  response result_;
+  std::string data_;
+
+  std::atomic<uint64_t> next_id_{1};
+  std::atomic<size_t> pending_{0};
+
+  std::atomic<size_t> connects_{0};
+  std::atomic<size_t> completed_{0};
+  std::atomic<size_t> failed_{0};
+  std::atomic<size_t> dropped_{0};
+  std::atomic<size_t> bytes_sent_{0};
+  std::atomic<size_t> bytes_received_{0};
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_ASYNC_CLIENT_H_
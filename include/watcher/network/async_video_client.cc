@@ -4,53 +4,402 @@
 
 #include "watcher/network/async_video_client.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "opencv2/opencv.hpp"
 
+#include "watcher/network/packet.h"
+#include "watcher/trace/trace.h"
 #include "watcher/utility/logger.h"
 
 namespace watcher {
 
-void AsyncVideoClient::feed(cv::Mat image, std::string timestamp,
-                            std::vector<std::string> detected_object) {
-  input_.store(std::move(image), std::move(timestamp), std::move(detected_object));
+namespace {
+
+// Room left in kPacketMaxHeaderSize for the keys the protocol adds to every packet
+constexpr size_t kProtocolHeaderReserve = 256;
+// The labels of a frame, in the Objects header. Further labels are left out
+constexpr size_t kMaxObjectsSize = 1024;
+
+std::string JoinObjects(const std::vector<std::string>& objects) {
+  std::string s;
+  for (const auto& obj : objects) {
+    if (s.size() + obj.size() + 1 > kMaxObjectsSize)
+      break;
+    s += obj + ",";
+  }
+  return s;
+}
+
+// Drops the overlay from a header that would not fit in a packet, before it is posted or spooled.
+// Otherwise it would fail on every attempt, and a spooled one on every retry
+bool FitHeader(Protocol::key_value_pair& header) {
+  constexpr auto limit = kPacketMaxHeaderSize - kProtocolHeaderReserve;
+  if (Packet::CalcHeaderSize(header) <= limit)
+    return true;
+  if (header.erase("Overlay") != 0) {
+    Log.w("Upload header too large. Sending the frame without its overlay");
+    if (Packet::CalcHeaderSize(header) <= limit)
+      return true;
+  }
+  Log.e("Upload header too large (", Packet::CalcHeaderSize(header), " bytes). Dropping the frame");
+  return false;
+}
+
+} // namespace
+
+AsyncVideoClient::Metrics::Metrics()
+  : fed(MetricsRegistry::instance().counter(
+      "watcher_upload_frames_total", "Frames fed to, processed and uploaded by the uploader", {{"state", "fed"}})),
+    processed(MetricsRegistry::instance().counter(
+      "watcher_upload_frames_total", "Frames fed to, processed and uploaded by the uploader", {{"state", "processed"}})),
+    skipped(MetricsRegistry::instance().counter(
+      "watcher_upload_frames_total", "Frames fed to, processed and uploaded by the uploader", {{"state", "skipped"}})),
+    sent(MetricsRegistry::instance().counter(
+      "watcher_upload_frames_total", "Frames fed to, processed and uploaded by the uploader", {{"state", "sent"}})),
+    failed(MetricsRegistry::instance().counter(
+      "watcher_upload_frames_total", "Frames fed to, processed and uploaded by the uploader", {{"state", "failed"}})),
+    bytes(MetricsRegistry::instance().counter("watcher_upload_bytes_total", "Bytes of frames uploaded")),
+    latency(MetricsRegistry::instance().histogram(
+      "watcher_upload_latency_ms", "Time from capture, or from entering the spool, to the end of the upload")) {}
+
+void AsyncVideoClient::feed(cv::Mat image, std::string_view timestamp,
+                            std::vector<std::string> detected_object, bool motion, uint64_t frame_id,
+                            std::optional<Overlay> overlay) {
+  Frame frame{std::move(image), {}, std::min(timestamp.size(), TimestampFormatter::kLength),
+              std::move(detected_object), motion, clock::now(), frame_id, std::move(overlay)};
+  std::copy_n(timestamp.data(), frame.timestamp_size, frame.timestamp_data.data());
+  input_.store(std::move(frame));
+  metrics_.fed.inc();
   async_runner_.run();
 }
 
 void AsyncVideoClient::OnWakeUp() {
-  const auto input = input_.load();
-  if (input) {
-    const auto image = std::get<0>(*input);
-    auto timestamp = std::get<1>(*input);
-    const auto& objs = std::get<2>(*input);
-
-    std::string s;
-    for (const auto& obj : objs)
-      s += obj + ",";
-
-    try {
-      // TODO: Write to packet directly
-      std::vector<uchar> buf;
-      cv::imencode(".jpg", image, buf);
-
-      protocol_.Post(
-        client_,
-        buf,
+  if (const auto input = input_.load(); input) {
+    metrics_.processed.inc();
+    if (upload_mode_ == UploadMode::kEvent) {
+      OnEventFrame(*input);
+    } else if (admit(!input->objects.empty())) {
+      upload(*input);
+    }
+  }
+}
+
+void AsyncVideoClient::OnEventFrame(const Frame& frame) {
+  const auto now = frame.fed_at;
+
+  if (frame.motion || !frame.objects.empty()) {
+    if (!in_event_) {
+      in_event_ = true;
+      ++event_id_;
+      Log.d("Event ", event_id_, " started. Sending ", pre_roll_buffer_.size(), " pre-roll frames");
+      flush_pre_roll();
+    }
+    last_event_ = now;
+  } else if (in_event_ && now - last_event_ > post_roll_.load()) {
+    Log.d("Event ", event_id_, " ended");
+    in_event_ = false;
+  }
+
+  if (in_event_) {
+    if (admit(!frame.objects.empty()))
+      upload(frame, {{"Event", std::to_string(event_id_)}});
+    return;
+  }
+
+  if (now - last_pre_roll_ >= std::chrono::duration<double>(1.0 / pre_roll_fps_)) {
+    const auto settings = rate_.settings();
+    auto jpeg = std::make_shared<std::vector<uchar>>();
+    if (encode(frame.image, settings.quality, settings.scale, *jpeg))
+      pre_roll_buffer_.push({now, std::string(frame.timestamp()), std::move(jpeg), frame.id,
+                             frame.overlay ? frame.overlay->to_string() : std::string()}, pre_roll_.load());
+    last_pre_roll_ = now;
+  }
+
+  if (now - last_heartbeat_ >= heartbeat_interval_.load() && upload_->pending() == 0) {
+    auto buf = acquire_buffer();
+    if (encode(frame.image, 50, heartbeat_scale_, *buf)) {
+      upload_->Post(
+        std::move(buf),
         Protocol::key_value_pair({
-          {"Timestamp", std::move(timestamp)},
+          {"Timestamp", std::string(frame.timestamp())},
           {"FileFormat", ".jpg"},
-          {"Objects", "\'" + s + "\'"}
-        }));
-    } catch (const std::exception& e) {
-      Log.e(e.what());
+          {"Heartbeat", "1"}
+        }),
+        upload_timeout_,
+        [](const boost::system::error_code&, AsyncClient::response) {});
     }
+    last_heartbeat_ = now;
   }
+}
+
+AsyncVideoClient& AsyncVideoClient::spool(const std::string& directory, size_t segment_size, size_t max_segments) {
+  spool_ = std::make_unique<UploadSpool>(directory, segment_size, max_segments);
+  spool_metrics_registration_ = MetricsRegistry::instance().add_collector([this](MetricsRegistry::Writer& writer) {
+    const auto s = spool_->stats();
+    writer.family("watcher_spool_frames", "Frames in the upload spool waiting to be sent", "gauge");
+    writer.sample("watcher_spool_frames", static_cast<double>(s.records));
+    writer.family("watcher_spool_bytes", "Bytes used by the upload spool", "gauge");
+    writer.sample("watcher_spool_bytes", static_cast<double>(s.bytes));
+    writer.family("watcher_spool_lost_frames_total", "Frames the upload spool evicted or could not store", "counter");
+    writer.sample("watcher_spool_lost_frames_total", static_cast<double>(s.evicted), {{"reason", "evicted"}});
+    writer.sample("watcher_spool_lost_frames_total", static_cast<double>(s.dropped), {{"reason", "dropped"}});
+  });
+  drain_spool();
+  return *this;
+}
+
+bool AsyncVideoClient::backed_up() const {
+  return upload_->pending() != 0 || (spool_ && !spool_->empty());
+}
+
+bool AsyncVideoClient::admit(bool has_detection) {
+  // A frame without detections waits for the previous upload instead of queueing behind it,
+  // so the only frame that can be waiting in the queue or the spool is one worth keeping
+  const bool admitted = (has_detection || !backed_up()) && rate_.admit(has_detection);
+  if (!admitted)
+    metrics_.skipped.inc();
+  return admitted;
+}
+
+std::shared_ptr<std::vector<uchar>> AsyncVideoClient::acquire_buffer() {
+  // A buffer is free once the upload that held it has completed or been dropped
+  for (auto& buffer : buffers_) {
+    if (!buffer)
+      buffer = std::make_shared<std::vector<uchar>>();
+    if (buffer.use_count() == 1)
+      return buffer;
+  }
+  return std::make_shared<std::vector<uchar>>();
+}
+
+bool AsyncVideoClient::encode(const cv::Mat& image, int quality, double scale, std::vector<uchar>& dst) {
+  encoder_.quality(quality);
+  if (scale < 1) {
+    encoder_.resolution({cvRound(image.cols * scale) & ~1, cvRound(image.rows * scale) & ~1});
+  } else {
+    encoder_.resolution({});
+  }
+  return encoder_.encode(image, dst);
+}
+
+void AsyncVideoClient::upload(const Frame& frame, Protocol::key_value_pair header) {
+  const auto settings = rate_.settings();
+  auto buf = acquire_buffer();
+  const auto encode_t0 = clock::now();
+  if (!encode(frame.image, settings.quality, settings.scale, *buf))
+    return;
+  if (Tracer::enabled())
+    Tracer::instance().record("encode", frame.id, encode_t0, clock::now());
+
+  header.emplace("Timestamp", frame.timestamp());
+  header.emplace("FileFormat", ".jpg");
+  header.emplace("Objects", "\'" + JoinObjects(frame.objects) + "\'");
+  if (frame.id != 0)
+    header.emplace("Frame", std::to_string(frame.id));
+  if (frame.overlay)
+    header.emplace("Overlay", frame.overlay->to_string());
+  if (!FitHeader(header))
+    return;
+
+  const bool event = header.count("Event") || !frame.objects.empty();
+
+  // The disk is written only while the link is behind, and then for every frame, to keep them in order
+  if (spool_ && backed_up()) {
+    TraceSpan span("spool", frame.id);
+    spool_->push(header, buf->data(), buf->size(), event);
+    drain_spool();
+    return;
+  }
+
+  // Kept for the spool, in case the upload fails
+  std::optional<Protocol::key_value_pair> retry_header;
+  std::shared_ptr<std::vector<uchar>> retry_data;
+  if (spool_) {
+    retry_header = header;
+    retry_data = buf;
+  }
+
+  const auto size = buf->size();
+  const auto t0 = clock::now();
+  upload_->Post(
+    std::move(buf),
+    std::move(header),
+    upload_timeout_,
+    [this, size, t0, fed_at = frame.fed_at, id = frame.id, event, retry_header = std::move(retry_header),
+     retry_data = std::move(retry_data)](const boost::system::error_code& error, AsyncClient::response) {
+      const auto now = clock::now();
+      if (Tracer::enabled())
+        Tracer::instance().record("upload", id, t0, now);
+      if (error) {
+        on_failed();
+        if (retry_data && error != boost::asio::error::operation_aborted) {
+          spool_->push(*retry_header, retry_data->data(), retry_data->size(), event);
+          drain_spool();
+        }
+        return;
+      }
+      on_sent(size, now - t0, now - fed_at);
+    });
+}
+
+void AsyncVideoClient::flush_pre_roll() {
+  for (auto& entry : pre_roll_buffer_.take()) {
+    Protocol::key_value_pair header({
+      {"Timestamp", std::move(entry.timestamp)},
+      {"FileFormat", ".jpg"},
+      {"Event", std::to_string(event_id_)},
+      {"PreRoll", "1"}
+    });
+    if (entry.frame != 0)
+      header.emplace("Frame", std::to_string(entry.frame));
+    if (!entry.overlay.empty())
+      header.emplace("Overlay", std::move(entry.overlay));
+    if (!FitHeader(header))
+      continue;
+
+    if (spool_ && backed_up()) {
+      spool_->push(header, entry.jpeg->data(), entry.jpeg->size(), true);
+      continue;
+    }
+
+    // Not reported to the rate controller. These are already late, and their latency says nothing about the link
+    pre_roll_upload_->Post(
+      std::move(entry.jpeg),
+      std::move(header),
+      upload_timeout_,
+      [](const boost::system::error_code&, AsyncClient::response) {});
+  }
+
+  if (spool_ && !spool_->empty())
+    drain_spool();
+}
+
+void AsyncVideoClient::drain_spool() {
+  boost::asio::post(engine_.context(), [this]() { send_spooled(); });
+}
+
+// Sends the oldest spooled frame, one at a time, and the next one when it is through.
+// A failed frame stays in the spool and is retried with a growing delay, reconnecting on the way
+void AsyncVideoClient::send_spooled() {
+  if (spool_sending_ || spool_stopped_)
+    return;
+
+  auto record = spool_->front();
+  if (!record)
+    return;
+
+  spool_sending_ = true;
+  const auto size = record->data->size();
+  const auto t0 = clock::now();
+  const auto pushed_at = std::chrono::system_clock::time_point(std::chrono::milliseconds(record->time_ms));
+  uint64_t frame_id = 0;
+  if (const auto it = record->header.find("Frame"); it != record->header.end())
+    frame_id = std::strtoull(it->second.c_str(), nullptr, 10);
+
+  upload_->Post(
+    std::move(record->data),
+    std::move(record->header),
+    upload_timeout_,
+    [this, seq = record->seq, size, t0, pushed_at, frame_id](const boost::system::error_code& error,
+                                                             AsyncClient::response) {
+      spool_sending_ = false;
+      if (spool_stopped_ || error == boost::asio::error::operation_aborted)
+        return;
+      if (Tracer::enabled())
+        Tracer::instance().record("upload", frame_id, t0, clock::now());
+
+      // Spooled before headers were checked, and would fail the same way on every retry
+      if (error == boost::asio::error::message_size) {
+        on_failed();
+        spool_->pop(seq);
+        send_spooled();
+        return;
+      }
+      if (error) {
+        on_failed();
+        spool_backoff_ = std::min<std::chrono::milliseconds>(
+          std::max<std::chrono::milliseconds>(spool_backoff_ * 2, std::chrono::seconds(1)), std::chrono::seconds(30));
+        Log.e("Upload failed: ", error.message(), ". ", spool_->stats().records, " frames spooled. Retrying in ",
+              spool_backoff_.count(), "ms");
+
+        spool_retry_.expires_after(spool_backoff_);
+        spool_retry_.async_wait([this](const boost::system::error_code& error) {
+          if (!error)
+            send_spooled();
+        });
+        return;
+      }
+
+      spool_backoff_ = {};
+      spool_->pop(seq);
+
+      // Latency counts the time spent in the spool, so a backlog makes the rate controller back off
+      on_sent(size, clock::now() - t0, std::chrono::system_clock::now() - pushed_at);
+      send_spooled();
+    });
+}
+
+void AsyncVideoClient::collect(MetricsRegistry::Writer& writer) const {
+  const auto settings = rate_.settings();
+  writer.family("watcher_upload_throughput_bytes_per_second", "Estimated upload link throughput", "gauge");
+  writer.sample("watcher_upload_throughput_bytes_per_second", rate_.throughput());
+  writer.family("watcher_upload_quality", "JPEG quality picked by the rate controller", "gauge");
+  writer.sample("watcher_upload_quality", settings.quality);
+  writer.family("watcher_upload_scale", "Resolution scale picked by the rate controller", "gauge");
+  writer.sample("watcher_upload_scale", settings.scale);
+  writer.family("watcher_upload_fps_limit", "Frame rate picked by the rate controller", "gauge");
+  writer.sample("watcher_upload_fps_limit", settings.fps);
+
+  const std::pair<const char*, const AsyncClient*> clients[] = {
+    {"upload", upload_.get()},
+    {"pre_roll", pre_roll_upload_.get()},
+    {"settings", settings_.get()},
+  };
+  writer.family("watcher_client_requests_total", "Requests by connection and outcome", "counter");
+  for (const auto& [name, client] : clients) {
+    const auto s = client->stats();
+    writer.sample("watcher_client_requests_total", static_cast<double>(s.completed),
+                  {{"client", name}, {"result", "completed"}});
+    writer.sample("watcher_client_requests_total", static_cast<double>(s.failed),
+                  {{"client", name}, {"result", "failed"}});
+    writer.sample("watcher_client_requests_total", static_cast<double>(s.dropped),
+                  {{"client", name}, {"result", "dropped"}});
+  }
+  writer.family("watcher_client_bytes_total", "Bytes by connection and direction", "counter");
+  for (const auto& [name, client] : clients) {
+    const auto s = client->stats();
+    writer.sample("watcher_client_bytes_total", static_cast<double>(s.bytes_sent),
+                  {{"client", name}, {"direction", "sent"}});
+    writer.sample("watcher_client_bytes_total", static_cast<double>(s.bytes_received),
+                  {{"client", name}, {"direction", "received"}});
+  }
+  writer.family("watcher_client_connects_total", "Connections established", "counter");
+  for (const auto& [name, client] : clients)
+    writer.sample("watcher_client_connects_total", static_cast<double>(client->stats().connects), {{"client", name}});
+  writer.family("watcher_client_pending", "Requests queued or in flight", "gauge");
+  for (const auto& [name, client] : clients)
+    writer.sample("watcher_client_pending", static_cast<double>(client->pending()), {{"client", name}});
+}
+
+void AsyncVideoClient::on_sent(size_t size, clock::duration send_time, clock::duration latency) {
+  rate_.on_sent(size, send_time, latency);
+  metrics_.sent.inc();
+  metrics_.bytes.inc(size);
+  metrics_.latency.observe(std::chrono::duration<double, std::milli>(latency).count());
+}
 
-  get_listener_();
+void AsyncVideoClient::on_failed() {
+  rate_.on_failed();
+  metrics_.failed.inc();
 }
 
 } // namespace watcher
@@ -5,62 +5,215 @@
 #ifndef WATCHER_NETWORK_ASYNC_VIDEO_CLIENT_H_
 #define WATCHER_NETWORK_ASYNC_VIDEO_CLIENT_H_
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
 #include <string>
-#include <tuple>
-#include <type_traits>
+#include <string_view>
 #include <utility>
-#include <unordered_map>
 #include <vector>
 
 #include "boost/signals2.hpp"
 #include "opencv2/opencv.hpp"
 
+#include "watcher/encoder/jpeg_encoder.h"
+#include "watcher/metrics/metrics.h"
+#include "watcher/network/async_client.h"
+#include "watcher/network/network_engine.h"
+#include "watcher/network/overlay.h"
+#include "watcher/network/pre_roll_buffer.h"
 #include "watcher/network/protocol.h"
-#include "watcher/network/tcp_client.h"
+#include "watcher/network/settings_cache.h"
+#include "watcher/network/upload_rate_controller.h"
+#include "watcher/network/upload_spool.h"
 #include "watcher/utility/async_runner.h"
+#include "watcher/utility/logger.h"
 #include "watcher/utility/ring_buffer.h"
+#include "watcher/utility/timestamp_formatter.h"
 
 namespace watcher {
 
 class AsyncVideoClient {
  public:
+  enum class UploadMode {
+    kContinuous, // Every frame the rate controller admits
+    kEvent,      // Only around motion or detections, plus a periodic heartbeat thumbnail
+  };
+
   AsyncVideoClient(const std::string& url, const std::string& port)
-    : client_(url, port)
+    : upload_(AsyncClient::create(engine_, url, port, 1)),
+      pre_roll_upload_(AsyncClient::create(engine_, url, port, 256)),
+      settings_(AsyncClient::create(engine_, url, port, 32)),
+      settings_cache_(SettingsCache::create(engine_, settings_)),
+      spool_retry_(engine_.context())
   {
+    async_runner_.name("upload");
     conn_ = async_runner_.AddWakeUpListener([this](){ OnWakeUp(); });
+    settings_cache_->start();
+    metrics_registration_ = MetricsRegistry::instance().add_collector([this](auto& writer) { collect(writer); });
   }
 
-  void feed(cv::Mat image, std::string timestamp,
-            std::vector<std::string> detected_object);
-
-  template<typename F, typename ...Args,
-    std::enable_if_t<
-      std::is_invocable_v<F, std::unordered_map<std::string, std::string>>
-    , int> = 0>
-  boost::signals2::connection AddGetListener(F func, std::string request) {
-    return get_listener_.connect(
-      [f = std::move(func), r = std::move(request), this] () {
-        try {
-          auto response = protocol_.Get(client_, r);
-          f(std::move(response));
-        } catch (const std::exception& e) {
-          Log.e(e.what());
-        }
+  ~AsyncVideoClient() {
+    metrics_registration_.reset();
+    spool_metrics_registration_.reset();
+    conn_.disconnect();
+    settings_cache_->stop();
+    upload_->cancel_all();
+    pre_roll_upload_->cancel_all();
+    settings_->cancel_all();
+
+    // Handlers run in order, so nothing re-arms the retry timer after this
+    std::promise<void> stopped;
+    boost::asio::post(engine_.context(), [&]() {
+      spool_stopped_ = true;
+      spool_retry_.cancel();
+      stopped.set_value();
     });
+    stopped.get_future().wait();
+  }
+
+  // Frames with a non-empty `detected_object` are preferred when uploads have to be dropped.
+  // In event mode, `motion` or a detection starts or extends an event.
+  // A non-zero `frame_id` is sent in the Frame header and tags the frame's trace spans.
+  // `overlay` is sent in the Overlay header, for a viewer that draws the annotations itself.
+  // `timestamp` is copied into the frame without allocating, up to TimestampFormatter::kLength characters
+  void feed(cv::Mat image, std::string_view timestamp,
+            std::vector<std::string> detected_object, bool motion = false, uint64_t frame_id = 0,
+            std::optional<Overlay> overlay = std::nullopt);
+
+  // `func` is called on the network thread with the value of `settings/<key>` whenever it changes.
+  // Settings are polled in the background, not per frame
+  boost::signals2::connection subscribe(const std::string& key, SettingsCache::listener func) {
+    return settings_cache_->subscribe(key, std::move(func));
+  }
+
+  AsyncVideoClient& upload_timeout(std::chrono::milliseconds timeout) { upload_timeout_ = timeout; return *this; }
+
+  // While uploads are backed up, or after one failed, frames go through a disk spool in `directory` instead
+  // of straight to the network, so they survive an outage and are replayed after reconnecting. With a healthy
+  // link nothing is written to disk. Frames left by a previous run are sent first.
+  // Disk use is bounded by `segment_size * max_segments`. Call before the first feed()
+  AsyncVideoClient& spool(const std::string& directory, size_t segment_size = 8 * 1024 * 1024,
+                          size_t max_segments = 16);
+
+  // Subsampling of uploaded frames. Quality and resolution are set by rate_controller()
+  JpegEncoder& encoder() { return encoder_; }
+
+  UploadRateController& rate_controller() { return rate_; }
+
+  AsyncVideoClient& upload_mode(UploadMode mode) { upload_mode_ = mode; return *this; }
+  [[nodiscard]] UploadMode upload_mode() const { return upload_mode_; }
+
+  // Event mode. Frames from `pre_roll` before an event start are kept, at `pre_roll_fps`, and sent when it starts.
+  // Uploading continues until `post_roll` after the last motion or detection
+  AsyncVideoClient& pre_roll(std::chrono::milliseconds length) { pre_roll_ = length; return *this; }
+  AsyncVideoClient& pre_roll_fps(double fps) { pre_roll_fps_ = fps; return *this; }
+  AsyncVideoClient& post_roll(std::chrono::milliseconds length) { post_roll_ = length; return *this; }
+
+  // Event mode. Outside events a thumbnail of `heartbeat_scale` is sent every `interval`
+  AsyncVideoClient& heartbeat(std::chrono::milliseconds interval, double scale = 0.25) {
+    heartbeat_interval_ = interval;
+    heartbeat_scale_ = scale;
+    return *this;
   }
 
  private:
+  using clock = std::chrono::steady_clock;
+
+  struct Frame {
+    cv::Mat image;
+    std::array<char, TimestampFormatter::kLength> timestamp_data;
+    size_t timestamp_size;
+    std::vector<std::string> objects;
+    bool motion;
+    clock::time_point fed_at;
+    uint64_t id;
+    std::optional<Overlay> overlay;
+
+    [[nodiscard]] std::string_view timestamp() const { return {timestamp_data.data(), timestamp_size}; }
+  };
+
+  // Frames fed but never processed were replaced by a newer one while the previous was being encoded
+  struct Metrics {
+    Metrics();
+
+    Counter& fed;
+    Counter& processed;
+    Counter& skipped;
+    Counter& sent;
+    Counter& failed;
+    Counter& bytes;
+    Histogram& latency;
+  };
+
   void OnWakeUp();
+  void OnEventFrame(const Frame& frame);
+  // Uploads are queued, or frames are waiting in the spool
+  bool backed_up() const;
+  bool admit(bool has_detection);
+  bool encode(const cv::Mat& image, int quality, double scale, std::vector<uchar>& dst);
+  void upload(const Frame& frame, Protocol::key_value_pair header = {});
+  void flush_pre_roll();
+  void drain_spool();
+  void send_spooled();
+  std::shared_ptr<std::vector<uchar>> acquire_buffer();
+  void collect(MetricsRegistry::Writer& writer) const;
+  void on_sent(size_t size, clock::duration send_time, clock::duration latency);
+  void on_failed();
+
+  RingBuffer<Frame> input_{2};
+
+  Metrics metrics_;
+
+  JpegEncoder encoder_;
+  // Declared before engine_ so that upload callbacks never outlive it
+  UploadRateController rate_;
+  // One being encoded, one queued and one in flight
+  std::array<std::shared_ptr<std::vector<uchar>>, 3> buffers_;
+  // Also declared before engine_. Null unless spool() was called
+  std::unique_ptr<UploadSpool> spool_;
+
+  std::atomic<UploadMode> upload_mode_{UploadMode::kContinuous};
+  std::atomic<std::chrono::milliseconds> pre_roll_{std::chrono::seconds(5)};
+  std::atomic<double> pre_roll_fps_{5};
+  std::atomic<std::chrono::milliseconds> post_roll_{std::chrono::seconds(5)};
+  std::atomic<std::chrono::milliseconds> heartbeat_interval_{std::chrono::seconds(30)};
+  std::atomic<double> heartbeat_scale_{0.25};
+
+  // Event state. Only touched on the upload thread
+  PreRollBuffer pre_roll_buffer_;
+  bool in_event_ = false;
+  uint64_t event_id_ = 0;
+  clock::time_point last_event_{};
+  clock::time_point last_pre_roll_{};
+  clock::time_point last_heartbeat_{};
+
+  // Uploads and settings polls use separate connections so that neither waits behind the other.
+  // A flushed pre-roll gets its own too, so live frames are not queued behind it
+  NetworkEngine engine_;
+  std::shared_ptr<AsyncClient> upload_;
+  std::shared_ptr<AsyncClient> pre_roll_upload_;
+  std::shared_ptr<AsyncClient> settings_;
+  std::shared_ptr<SettingsCache> settings_cache_;
+
+  // Network thread only
+  boost::asio::steady_timer spool_retry_;
+  std::chrono::milliseconds spool_backoff_{0};
+  bool spool_sending_ = false;
+  bool spool_stopped_ = false;
 
-  RingBuffer<std::tuple<cv::Mat/*image*/, std::string/*timestamp*/, std::vector<std::string>>> input_{2};
-  TcpClient client_;
-  Protocol protocol_;
+  std::chrono::milliseconds upload_timeout_{5000};
 
   AsyncRunner async_runner_;
   boost::signals2::scoped_connection conn_;
 
-  boost::signals2::signal<void()> get_listener_;
+  MetricsRegistry::Registration metrics_registration_;
+  MetricsRegistry::Registration spool_metrics_registration_;
 };
 
 } // namespace watcher
@@ -0,0 +1,45 @@
+#ifndef WATCHER_NETWORK_NETWORK_ENGINE_H_
+#define WATCHER_NETWORK_NETWORK_ENGINE_H_
+
+#include <thread>
+
+#include "boost/asio.hpp"
+
+#include "watcher/utility/thread_name.h"
+
+namespace watcher {
+
+// Owns the io_context that every AsyncClient runs on, and the single thread that drives it.
+// Handlers never run concurrently, so clients need no locking of their own.
+class NetworkEngine {
+ public:
+  NetworkEngine()
+    : work_(boost::asio::make_work_guard(io_context_)),
+      thread_([this]() { io_context_.run(); })
+  {
+    SetThreadName(thread_, "network");
+  }
+
+  NetworkEngine(const NetworkEngine&) = delete;
+  NetworkEngine& operator=(const NetworkEngine&) = delete;
+
+  ~NetworkEngine() {
+    work_.reset();
+    io_context_.stop();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  boost::asio::io_context& context() { return io_context_; }
+
+  bool running_in_this_thread() const { return std::this_thread::get_id() == thread_.get_id(); }
+
+ private:
+  boost::asio::io_context io_context_;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+  std::thread thread_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_NETWORK_ENGINE_H_
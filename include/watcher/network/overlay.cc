@@ -0,0 +1,78 @@
+#include "watcher/network/overlay.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace watcher {
+
+namespace {
+
+void AppendNumber(std::string& out, double value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.3f", value);
+  out += buf;
+}
+
+void AppendBox(std::string& out, const std::array<float, 4>& box) {
+  out += '[';
+  for (size_t i = 0; i < box.size(); ++i) {
+    if (i != 0)
+      out += ',';
+    AppendNumber(out, std::clamp(box[i], 0.f, 1.f));
+  }
+  out += ']';
+}
+
+// Labels come from the labelmap file. Anything that would break the JSON or the header is replaced, and
+// labels are cut at kMaxLabelSize bytes
+void AppendLabel(std::string& out, const std::string& label) {
+  out += '"';
+  for (const auto c : std::string_view(label).substr(0, Overlay::kMaxLabelSize)) {
+    const bool unsafe = c == '"' || c == '\\' || c == ';' || c == '=' || static_cast<unsigned char>(c) < 0x20;
+    out += unsafe ? '_' : c;
+  }
+  out += '"';
+}
+
+} // namespace
+
+std::string Overlay::to_string() const {
+  std::string out;
+  out.reserve(128 + 72 * std::min(detections.size(), kMaxBoxes) + 32 * std::min(motion.size(), kMaxBoxes));
+
+  out += "{\"frame\":";
+  out += std::to_string(detected_frame);
+
+  out += ",\"detections\":[";
+  for (size_t i = 0; i < std::min(detections.size(), kMaxBoxes); ++i) {
+    if (i != 0)
+      out += ',';
+    out += "{\"label\":";
+    AppendLabel(out, detections[i].label);
+    out += ",\"score\":";
+    AppendNumber(out, detections[i].score);
+    out += ",\"box\":";
+    AppendBox(out, detections[i].box);
+    out += '}';
+  }
+
+  out += "],\"motion\":[";
+  for (size_t i = 0; i < std::min(motion.size(), kMaxBoxes); ++i) {
+    if (i != 0)
+      out += ',';
+    AppendBox(out, motion[i]);
+  }
+
+  out += "],\"hud\":{\"criteria\":";
+  AppendNumber(out, criteria);
+  out += ",\"inference_ms\":";
+  out += std::to_string(inference_ms);
+  out += ",\"fps\":";
+  out += std::to_string(fps);
+  out += "}}";
+  return out;
+}
+
+} // namespace watcher
@@ -0,0 +1,46 @@
+#ifndef WATCHER_NETWORK_OVERLAY_H_
+#define WATCHER_NETWORK_OVERLAY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace watcher {
+
+// What the annotation stage would draw on a frame, sent with it as data so that the viewer can draw it instead.
+//
+// Sent in the `Overlay` header of the frame's upload, next to its `Frame` header, as one line of JSON:
+//
+//   {"frame":1234,"detections":[{"label":"person","score":0.873,"box":[0.120,0.300,0.560,0.700]}],
+//    "motion":[[0.050,0.100,0.300,0.450]],"hud":{"criteria":0.500,"inference_ms":83,"fps":30}}
+//
+// Boxes are [x0, y0, x1, y1] in fractions of the frame size, so they fit the upload at any resolution.
+// `frame` is the frame the detections were made on, which trails the uploaded frame while the model is busy.
+// The text never contains ';' or '=', which separate text header fields.
+struct Overlay {
+  // Keeps the header well inside kPacketMaxHeaderSize
+  static constexpr size_t kMaxBoxes = 16;
+  static constexpr size_t kMaxLabelSize = 32;
+
+  struct Detection {
+    std::string label;
+    float score = 0;
+    std::array<float, 4> box{};
+  };
+
+  uint64_t detected_frame = 0;
+  std::vector<Detection> detections;
+  std::vector<std::array<float, 4>> motion;
+
+  float criteria = 0;
+  int inference_ms = 0;
+  int fps = 0;
+
+  [[nodiscard]] std::string to_string() const;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_OVERLAY_H_
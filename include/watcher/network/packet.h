@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <cstring>
 #include <climits>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -17,6 +18,7 @@
 enum : size_t {
   kPacketSize = 1'000'000, // 1MB
   kPacketHeaderSizeBit = 32,
+  kPacketMaxHeaderSize = 4096, // Headers written apart from the payload must fit in this
 };
 
 inline constexpr const char* kRequest = "REQUEST";
@@ -97,16 +99,14 @@ class Packet {
     return header_size;
   }
 
-  Packet& write_header(const std::unordered_map<std::string, std::string>& header) {
+  // Writes the size prefix and `header` to `dst`, which can hold `capacity` bytes. Returns the header size
+  static uint32_t WriteHeader(char* dst, size_t capacity, const std::unordered_map<std::string, std::string>& header) {
     const uint32_t header_size = CalcHeaderSize(header);
 
-    if (header_size > kPacketSize)
-      throw_length_error(header_size);
-
-//    if (buffer_.size() < header_size)
-//      buffer_.resize(header_size);
+    if (header_size > capacity)
+      throw_length_error(header_size, capacity);
 
-    char* pos = buffer() + to_byte(kPacketHeaderSizeBit);
+    char* pos = dst + to_byte(kPacketHeaderSizeBit);
     for (const auto& p : header) {
       const auto& key = p.first;
       const auto& value = p.second;
@@ -118,9 +118,12 @@ class Packet {
       pos += key.size() + value.size() + 2;
     }
 
-    (*reinterpret_cast<uint32_t*>(buffer())) = header_size;
-    content_size_ = header_size;
+    std::memcpy(dst, &header_size, sizeof(header_size));
+    return header_size;
+  }
 
+  Packet& write_header(const std::unordered_map<std::string, std::string>& header) {
+    content_size_ = WriteHeader(buffer(), kPacketSize, header);
     return *this;
   }
 
@@ -173,9 +176,9 @@ class Packet {
   }
 
  private:
-  void throw_length_error(size_t try_write_size) {
+  static void throw_length_error(size_t try_write_size, size_t capacity) {
     throw std::runtime_error(
-      std::string("Header size is too big (") + std::to_string(try_write_size) + "<=" + std::to_string(kPacketSize) + ")");
+      std::string("Header size is too big (") + std::to_string(try_write_size) + "<=" + std::to_string(capacity) + ")");
   }
 
   [[nodiscard]] uint32_t raw_header_size() const noexcept {
@@ -0,0 +1,243 @@
+#ifndef WATCHER_NETWORK_PACKET_HEADER_H_
+#define WATCHER_NETWORK_PACKET_HEADER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "watcher/network/packet.h"
+
+namespace watcher {
+
+enum class HeaderFormat {
+  kText,   // key=value; pairs. Understood by every server
+  kBinary, // PacketHeader
+};
+
+// Keys with a fixed-width field in the binary header. Anything else goes to the extension area
+enum class HeaderKey : uint8_t {
+  kRequest,
+  kTotalSize,
+  kDone,
+  kStreamIndex,
+  kTime,
+  kStatus,
+  kCount,
+};
+
+inline constexpr std::array<std::string_view, static_cast<size_t>(HeaderKey::kCount)> kHeaderKeyNames = {
+  kRequest,
+  kHeaderTotalSize,
+  kHeaderDone,
+  kHeaderStreamIndex,
+  kHeaderTime,
+  kHeaderStatus,
+};
+
+constexpr std::string_view HeaderKeyName(HeaderKey key) {
+  return kHeaderKeyNames[static_cast<size_t>(key)];
+}
+
+constexpr std::optional<HeaderKey> FindHeaderKey(std::string_view name) {
+  for (size_t i = 0; i < kHeaderKeyNames.size(); ++i) {
+    if (kHeaderKeyNames[i] == name)
+      return static_cast<HeaderKey>(i);
+  }
+  return std::nullopt;
+}
+
+static_assert(FindHeaderKey("TotalSize") == HeaderKey::kTotalSize);
+static_assert(!FindHeaderKey("FileName"));
+
+// Versioned binary packet header. Encoding and decoding never allocate: extensions are views into
+// the caller's strings when encoding, and into the packet when decoding.
+//
+// Layout after the 4-byte size prefix, in host byte order like the prefix itself:
+//   magic(1) version(1) present(1) request(1) done(1) reserved(1) status(2)
+//   stream_index(4) total_size(8) time(8) extension_count(1)
+//   { key_size(1) value_size(2) key value } * extension_count
+//
+// A text header starts with a printable key, so the magic byte tells the two formats apart.
+class PacketHeader {
+ public:
+  static constexpr uint8_t kMagic = 0xB7;
+  static constexpr uint8_t kVersion = 1;
+  static constexpr size_t kMaxExtensions = 16;
+  static constexpr size_t kFixedSize = to_byte(kPacketHeaderSizeBit) + 29;
+
+  enum class Request : uint8_t {
+    kNone,
+    kGet,
+    kPost,
+  };
+
+  struct Extension {
+    std::string_view key;
+    std::string_view value;
+  };
+
+  [[nodiscard]] bool has(HeaderKey key) const noexcept { return present_ & bit(key); }
+
+  [[nodiscard]] Request request() const noexcept { return request_; }
+  PacketHeader& request(Request value) noexcept { request_ = value; return mark(HeaderKey::kRequest); }
+
+  [[nodiscard]] uint64_t total_size() const noexcept { return total_size_; }
+  PacketHeader& total_size(uint64_t value) noexcept { total_size_ = value; return mark(HeaderKey::kTotalSize); }
+
+  [[nodiscard]] bool done() const noexcept { return done_; }
+  PacketHeader& done(bool value) noexcept { done_ = value; return mark(HeaderKey::kDone); }
+
+  [[nodiscard]] uint32_t stream_index() const noexcept { return stream_index_; }
+  PacketHeader& stream_index(uint32_t value) noexcept { stream_index_ = value; return mark(HeaderKey::kStreamIndex); }
+
+  [[nodiscard]] int64_t time() const noexcept { return time_; }
+  PacketHeader& time(int64_t value) noexcept { time_ = value; return mark(HeaderKey::kTime); }
+
+  [[nodiscard]] uint16_t status() const noexcept { return status_; }
+  PacketHeader& status(uint16_t value) noexcept { status_ = value; return mark(HeaderKey::kStatus); }
+
+  [[nodiscard]] size_t extension_count() const noexcept { return extension_count_; }
+  [[nodiscard]] const Extension& extension(size_t i) const noexcept { return extensions_[i]; }
+
+  // `key` and `value` must outlive encode(). Returns false if the header cannot hold them
+  bool add_extension(std::string_view key, std::string_view value) noexcept {
+    if (extension_count_ == kMaxExtensions || key.size() > UINT8_MAX || value.size() > UINT16_MAX)
+      return false;
+    extensions_[extension_count_++] = {key, value};
+    return true;
+  }
+
+  void clear_extensions() noexcept { extension_count_ = 0; }
+
+  // Encoded size, including the size prefix
+  [[nodiscard]] uint32_t size() const noexcept {
+    uint32_t s = kFixedSize;
+    for (size_t i = 0; i < extension_count_; ++i)
+      s += 3 + extensions_[i].key.size() + extensions_[i].value.size();
+    return s;
+  }
+
+  // Writes the header to `dst`, which can hold `capacity` bytes. Returns the encoded size
+  uint32_t encode(char* dst, size_t capacity) const {
+    const auto header_size = size();
+    if (header_size > capacity) {
+      throw std::runtime_error(
+        std::string("Header size is too big (") + std::to_string(header_size) + "<=" + std::to_string(capacity) + ")");
+    }
+
+    char* pos = dst;
+    pos = put(pos, header_size);
+    pos = put(pos, kMagic);
+    pos = put(pos, kVersion);
+    pos = put(pos, present_);
+    pos = put(pos, request_);
+    pos = put(pos, static_cast<uint8_t>(done_));
+    pos = put(pos, uint8_t{0});
+    pos = put(pos, status_);
+    pos = put(pos, stream_index_);
+    pos = put(pos, total_size_);
+    pos = put(pos, time_);
+    pos = put(pos, extension_count_);
+
+    for (size_t i = 0; i < extension_count_; ++i) {
+      const auto& e = extensions_[i];
+      pos = put(pos, static_cast<uint8_t>(e.key.size()));
+      pos = put(pos, static_cast<uint16_t>(e.value.size()));
+      std::memcpy(pos, e.key.data(), e.key.size());
+      std::memcpy(pos + e.key.size(), e.value.data(), e.value.size());
+      pos += e.key.size() + e.value.size();
+    }
+
+    return header_size;
+  }
+
+  // `header` points at the size prefix of a received packet
+  static bool is_binary(const char* header, size_t size) noexcept {
+    return size > to_byte(kPacketHeaderSizeBit) &&
+           static_cast<uint8_t>(header[to_byte(kPacketHeaderSizeBit)]) == kMagic;
+  }
+
+  // Parses a header written by encode(). Extensions refer to `header`.
+  // Returns false if the header is malformed or from a newer version
+  static bool decode(const char* header, size_t size, PacketHeader& out) noexcept {
+    if (size < kFixedSize || !is_binary(header, size))
+      return false;
+
+    uint32_t header_size;
+    uint8_t version, done, reserved;
+    const char* pos = header;
+    pos = get(pos, header_size);
+    pos += 1; // magic
+    pos = get(pos, version);
+    if (version > kVersion || header_size > size || header_size < kFixedSize)
+      return false;
+
+    pos = get(pos, out.present_);
+    pos = get(pos, out.request_);
+    pos = get(pos, done);
+    pos = get(pos, reserved);
+    pos = get(pos, out.status_);
+    pos = get(pos, out.stream_index_);
+    pos = get(pos, out.total_size_);
+    pos = get(pos, out.time_);
+    pos = get(pos, out.extension_count_);
+    out.done_ = done != 0;
+
+    const char* const end = header + header_size;
+    if (out.extension_count_ > kMaxExtensions)
+      return false;
+
+    for (size_t i = 0; i < out.extension_count_; ++i) {
+      uint8_t key_size;
+      uint16_t value_size;
+      if (end - pos < 3)
+        return false;
+      pos = get(pos, key_size);
+      pos = get(pos, value_size);
+      if (end - pos < key_size + value_size)
+        return false;
+      out.extensions_[i] = {{pos, key_size}, {pos + key_size, value_size}};
+      pos += key_size + value_size;
+    }
+
+    return true;
+  }
+
+ private:
+  static constexpr uint8_t bit(HeaderKey key) noexcept { return 1u << static_cast<uint8_t>(key); }
+
+  PacketHeader& mark(HeaderKey key) noexcept { present_ |= bit(key); return *this; }
+
+  template<typename T>
+  static char* put(char* dst, T value) noexcept {
+    std::memcpy(dst, &value, sizeof(T));
+    return dst + sizeof(T);
+  }
+
+  template<typename T>
+  static const char* get(const char* src, T& value) noexcept {
+    std::memcpy(&value, src, sizeof(T));
+    return src + sizeof(T);
+  }
+
+  uint8_t present_ = 0;
+  Request request_ = Request::kNone;
+  bool done_ = false;
+  uint16_t status_ = 0;
+  uint32_t stream_index_ = 0;
+  uint64_t total_size_ = 0;
+  int64_t time_ = 0;
+  uint8_t extension_count_ = 0;
+  std::array<Extension, kMaxExtensions> extensions_{};
+};
+
+static_assert(static_cast<size_t>(HeaderKey::kCount) <= 8, "present_ has one bit per known key");
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_PACKET_HEADER_H_
@@ -0,0 +1,55 @@
+#ifndef WATCHER_NETWORK_PRE_ROLL_BUFFER_H_
+#define WATCHER_NETWORK_PRE_ROLL_BUFFER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace watcher {
+
+// Encoded frames of the last few seconds, kept so that the moments before an event can be uploaded
+// once the event starts. Not thread-safe.
+class PreRollBuffer {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  struct Entry {
+    clock::time_point time;
+    std::string timestamp;
+    std::shared_ptr<const std::vector<unsigned char>> jpeg;
+    uint64_t frame = 0;
+    std::string overlay;
+  };
+
+  // Drops entries older than `length` before the new one
+  void push(Entry entry, clock::duration length) {
+    bytes_ += entry.jpeg->size();
+    entries_.emplace_back(std::move(entry));
+    while (!entries_.empty() && entries_.front().time + length < entries_.back().time) {
+      bytes_ -= entries_.front().jpeg->size();
+      entries_.pop_front();
+    }
+  }
+
+  // Removes and returns every entry, oldest first
+  std::deque<Entry> take() {
+    bytes_ = 0;
+    return std::exchange(entries_, {});
+  }
+
+  [[nodiscard]] size_t size() const { return entries_.size(); }
+  [[nodiscard]] size_t bytes() const { return bytes_; }
+
+ private:
+  std::deque<Entry> entries_;
+  size_t bytes_ = 0;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_PRE_ROLL_BUFFER_H_
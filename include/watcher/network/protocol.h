@@ -5,10 +5,17 @@
 #ifndef WATCHER_NETWORK_PROTOCOL_H_
 #define WATCHER_NETWORK_PROTOCOL_H_
 
+#include <algorithm>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <chrono>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
@@ -16,6 +23,8 @@
 #include "boost/asio.hpp"
 
 #include "watcher/network/packet.h"
+#include "watcher/network/packet_header.h"
+#include "watcher/utility/aligned_buffer.h"
 #include "watcher/utility/date_time.h"
 #include "watcher/utility/frequency.h"
 #include "watcher/utility/logger.h"
@@ -39,6 +48,10 @@ class Protocol {
 
   Protocol() = default;
 
+  // Format of the headers this side writes. Received headers are recognized either way
+  Protocol& header_format(HeaderFormat format) { header_format_ = format; return *this; }
+  [[nodiscard]] HeaderFormat header_format() const { return header_format_; }
+
   // TODO: Support file
   enum DataType {
     kBuffer,
@@ -56,58 +69,34 @@ class Protocol {
 
   template<typename Client>
   [[nodiscard]] response Get(Client& client, const char* request, size_t data_size) {
-    // TODO: Check size
-    packet_
-      .write_header({
-        {kRequest, kRequestGet},
-        {kHeaderDone, "1"}
-      })
-      .write_data(request, data_size);
-
-    client.send(packet_.buffer(), packet_.size());
-    Log.d("Sent ", packet_.size(), "bytes to the server.");
-
-    std::unordered_map<std::string, std::string> result;
-    boost::system::error_code error;
-
-    for (;;) {
-      packet_.clear();
-      const auto len = client.receive(packet_.buffer(), packet_.capacity(), error);
-      packet_.setSize(len);
-
-      const auto header = packet_.header();
-      const auto it = header.find(kHeaderDone);
-      const auto done = it != header.end() && it->second == "1";
-
-      Log.d("Got ", len, "bytes from the server.");
-
-      // TODO: Use status code check
-      if (len < to_byte(kPacketHeaderSizeBit))
-        break;
-
-      for (const auto& p : header) {
-        result.emplace(p.first, p.second);
-      }
+    SendRequest(client, request, data_size);
 
-      result["data"].insert(result["data"].end(), packet_.data().first, packet_.data().first + packet_.data().second);
-
-      if (done) {
-        break;
-      }
-      if (error == boost::asio::error::eof) {
-        if (auto d = result.find("data"); d != result.end())
-          result.erase(d);
-        break;
-      }
-    }
-
-    if (error == boost::asio::error::eof) {
-      watcher::Log.e("EOF: Connection closed cleanly by peer.");
-    }
+    response result;
+    std::string data;
+    const auto done = Receive(client, result, [&](const auto&, const char* chunk, size_t chunk_size) {
+      data.append(chunk, chunk_size);
+    });
 
+    if (done)
+      result["data"] = std::move(data);
     return result;
   }
 
+  // Streams the response body into `dst`. The buffer is reserved once from the TotalSize header,
+  // so a large file is never reallocated or held twice in memory.
+  template<typename Client>
+  [[nodiscard]] bool GetInto(Client& client, const char* request, AlignedBuffer& dst) {
+    SendRequest(client, request, std::strlen(request));
+
+    dst.clear();
+    response result;
+    return Receive(client, result, [&](const ReceiveState& state, const char* chunk, size_t chunk_size) {
+      if (dst.capacity() == 0 && state.total_size > 0)
+        dst.reserve(state.total_size);
+      dst.append(chunk, chunk_size);
+    });
+  }
+
   template<typename Client, typename T>
   response Get(Client& client, const T* data, size_t data_size) {
     return Get(client, reinterpret_cast<const char*>(data), sizeof(T) * data_size);
@@ -129,9 +118,28 @@ class Protocol {
             optional_header optional_header = std::nullopt) {
     const auto t1 = DateTime<>::now().milliseconds();
 
+    const auto sent_size_packet = WritePost(client, data, data_size, std::move(optional_header));
+
+    const auto t2 = DateTime<>::now().milliseconds();
+
+    const auto bit_per_sec = static_cast<double>(sent_size_packet) / (t2 - t1) * 1000;
+
+    Log.d(bit_per_sec * 0.000'001, "MB/s");
+  }
+
+  // Splits `data` into packets and passes each one to `client.send(header, header_size, data, data_size)`.
+  // Only the header is built here. The payload is sent straight from `data` without being copied.
+  // Returns the number of bytes sent
+  template<typename Client>
+  size_t WritePost(Client& client, const char* data, size_t data_size,
+                   optional_header optional_header = std::nullopt) {
+    if (header_format_ == HeaderFormat::kBinary)
+      return WritePostBinary(client, data, data_size, optional_header);
+
     size_t sent_size_data = 0;
     size_t remaining_size = data_size;
     size_t sent_size_packet = 0;
+    char header_buffer[kPacketMaxHeaderSize];
 
     while (remaining_size > 0) {
       // TODO: Send some header values only once at the beginning
@@ -145,28 +153,21 @@ class Protocol {
       }
 
       const auto header_size = Packet::CalcHeaderSize(header);
-      header[kHeaderDone] = std::to_string((header_size + remaining_size) <= packet_.capacity());
+      header[kHeaderDone] = std::to_string((header_size + remaining_size) <= kPacketSize);
 
-      packet_.clear();
-      packet_.write_header(header);
+      Packet::WriteHeader(header_buffer, sizeof(header_buffer), header);
 
-      const auto sending_size = packet_.remaining_size() > remaining_size ? remaining_size : packet_.remaining_size();
+      const auto sending_size = std::min<size_t>(remaining_size, kPacketSize - header_size);
 
-      packet_.write_data(data + sent_size_data, sending_size);
-
-      client.send(packet_.buffer(), packet_.size());
+      client.send(header_buffer, header_size, data + sent_size_data, sending_size);
 
       remaining_size -= sending_size;
       sent_size_data += sending_size;
-      sent_size_packet += packet_.size();
+      sent_size_packet += header_size + sending_size;
       Log.d("Sent ", sending_size, "bytes. (", sending_size, '/', data_size, ')');
     }
-    client.close();
-    const auto t2 = DateTime<>::now().milliseconds();
-
-    const auto bit_per_sec = static_cast<double>(sent_size_packet) / (t2 - t1) * 1000;
 
-    Log.d(bit_per_sec * 0.000'001, "MB/s");
+    return sent_size_packet;
   }
 
   template<typename Client, typename T>
@@ -188,8 +189,218 @@ class Protocol {
     Post(client, req, N, std::move(optional_header));
   }
 
+  template<typename Client>
+  void SendRequest(Client& client, const char* request, size_t data_size) {
+    // TODO: Split requests that do not fit in one packet
+    data_size = std::min<size_t>(data_size, kPacketSize - kPacketMaxHeaderSize);
+
+    // TotalSize lets the server read exactly the request instead of guessing where it ends
+    char header_buffer[kPacketMaxHeaderSize];
+    uint32_t header_size;
+    if (header_format_ == HeaderFormat::kBinary) {
+      header_size = PacketHeader()
+        .request(PacketHeader::Request::kGet)
+        .total_size(data_size)
+        .done(true)
+        .encode(header_buffer, sizeof(header_buffer));
+    } else {
+      header_size = Packet::WriteHeader(header_buffer, sizeof(header_buffer), {
+        {kRequest, kRequestGet},
+        {kHeaderTotalSize, std::to_string(data_size)},
+        {kHeaderDone, "1"}
+      });
+    }
+
+    client.send(header_buffer, header_size, request, data_size);
+    Log.d("Sent ", header_size + data_size, "bytes to the server.");
+  }
+
+  enum class PacketStatus {
+    kInvalid,
+    kMore,
+    kDone,
+  };
+
+  struct ReceiveState {
+    size_t total_size = 0;
+    size_t received_size = 0;
+    bool sized = false; // Whether TotalSize was received. An empty body has a TotalSize of 0
+  };
+
+  // Parses one received packet of a response. Headers are merged into `result`,
+  // and `sink(state, data, size)` is called with the body.
+  template<typename Sink>
+  static PacketStatus ConsumePacket(const Packet& packet, ReceiveState& state, response& result, Sink&& sink) {
+    // TODO: Use status code check
+    if (packet.size() < to_byte(kPacketHeaderSizeBit))
+      return PacketStatus::kInvalid;
+
+    bool done;
+    if (PacketHeader::is_binary(packet.buffer(), packet.size())) {
+      PacketHeader header;
+      if (!PacketHeader::decode(packet.buffer(), packet.size(), header))
+        return PacketStatus::kInvalid;
+
+      done = header.done();
+      if (header.has(HeaderKey::kTotalSize)) {
+        state.total_size = header.total_size();
+        state.sized = true;
+      }
+      MergeHeader(header, result);
+    } else {
+      const auto header = packet.header();
+      const auto it = header.find(kHeaderDone);
+      done = it != header.end() && it->second == "1";
+
+      for (const auto& p : header) {
+        result.emplace(p.first, p.second);
+      }
+
+      if (const auto ts = header.find(kHeaderTotalSize); ts != header.end()) {
+        state.total_size = std::strtoull(std::string(ts->second).c_str(), nullptr, 10);
+        state.sized = true;
+      }
+    }
+
+    // Packets may be padded up to the packet size. Never hand out more than TotalSize bytes
+    auto chunk_size = packet.data().second;
+    if (state.sized)
+      chunk_size = std::min(chunk_size, state.total_size - std::min(state.total_size, state.received_size));
+
+    sink(std::as_const(state), packet.data().first, chunk_size);
+    state.received_size += chunk_size;
+
+    return done ? PacketStatus::kDone : PacketStatus::kMore;
+  }
+
  private:
-  Packet packet_;
+  // Same packets as the text path, but the header is encoded once and only Done changes between packets.
+  // Custom headers go to the extension area of the first packet, except the ones with a fixed field
+  template<typename Client>
+  size_t WritePostBinary(Client& client, const char* data, size_t data_size, const optional_header& optional_header) {
+    PacketHeader header;
+    header
+      .request(PacketHeader::Request::kPost)
+      .total_size(data_size)
+      .done(false);
+
+    if (optional_header) {
+      for (const auto& p : *optional_header) {
+        if (const auto key = FindHeaderKey(p.first)) {
+          SetHeaderField(header, *key, p.second);
+        } else if (!header.add_extension(p.first, p.second)) {
+          Log.e("Dropped header ", p.first, ": too many or too long");
+        }
+      }
+    }
+
+    size_t sent_size_data = 0;
+    size_t remaining_size = data_size;
+    size_t sent_size_packet = 0;
+    char header_buffer[kPacketMaxHeaderSize];
+
+    while (remaining_size > 0) {
+      const auto header_size = header.size();
+      header.done(header_size + remaining_size <= kPacketSize);
+      header.encode(header_buffer, sizeof(header_buffer));
+
+      const auto sending_size = std::min<size_t>(remaining_size, kPacketSize - header_size);
+
+      client.send(header_buffer, header_size, data + sent_size_data, sending_size);
+
+      remaining_size -= sending_size;
+      sent_size_data += sending_size;
+      sent_size_packet += header_size + sending_size;
+      header.clear_extensions();
+      Log.d("Sent ", sending_size, "bytes. (", sending_size, '/', data_size, ')');
+    }
+
+    return sent_size_packet;
+  }
+
+  static void SetHeaderField(PacketHeader& header, HeaderKey key, std::string_view value) {
+    const auto number = [&]() {
+      int64_t v = 0;
+      std::from_chars(value.data(), value.data() + value.size(), v);
+      return v;
+    };
+
+    switch (key) {
+      case HeaderKey::kRequest:
+        header.request(value == kRequestGet ? PacketHeader::Request::kGet : PacketHeader::Request::kPost);
+        break;
+      case HeaderKey::kTotalSize: header.total_size(number()); break;
+      case HeaderKey::kDone: header.done(value == "1"); break;
+      case HeaderKey::kStreamIndex: header.stream_index(number()); break;
+      case HeaderKey::kTime: header.time(number()); break;
+      case HeaderKey::kStatus: header.status(number()); break;
+      case HeaderKey::kCount: break;
+    }
+  }
+
+  // Converts a binary header to the text form callers of Get() expect
+  static void MergeHeader(const PacketHeader& header, response& result) {
+    if (header.has(HeaderKey::kRequest))
+      result.emplace(kRequest, header.request() == PacketHeader::Request::kGet ? kRequestGet : kRequestPost);
+    if (header.has(HeaderKey::kTotalSize))
+      result.emplace(kHeaderTotalSize, std::to_string(header.total_size()));
+    if (header.has(HeaderKey::kDone))
+      result.emplace(kHeaderDone, header.done() ? "1" : "0");
+    if (header.has(HeaderKey::kStreamIndex))
+      result.emplace(kHeaderStreamIndex, std::to_string(header.stream_index()));
+    if (header.has(HeaderKey::kTime))
+      result.emplace(kHeaderTime, std::to_string(header.time()));
+    if (header.has(HeaderKey::kStatus))
+      result.emplace(kHeaderStatus, std::to_string(header.status()));
+
+    for (size_t i = 0; i < header.extension_count(); ++i)
+      result.emplace(header.extension(i).key, header.extension(i).value);
+  }
+
+  // Reads packets until Done. `sink(state, data, size)` is called with the body of every packet.
+  // Returns false if the connection was closed before the last packet.
+  template<typename Client, typename Sink>
+  bool Receive(Client& client, response& result, Sink&& sink) {
+    boost::system::error_code error;
+    bool received = false;
+    ReceiveState state;
+
+    // Sending needs no packet buffer, so a Protocol that only posts never allocates one
+    if (!packet_)
+      packet_ = std::make_unique<Packet>();
+    auto& packet = *packet_;
+
+    for (;;) {
+      packet.clear();
+      const auto len = client.receive(packet.buffer(), packet.capacity(), error);
+      packet.setSize(len);
+
+      Log.d("Got ", len, "bytes from the server.");
+
+      const auto status = ConsumePacket(packet, state, result, sink);
+      if (status == PacketStatus::kInvalid)
+        break;
+
+      received = true;
+      if (status == PacketStatus::kDone) {
+        return received;
+      }
+      if (error == boost::asio::error::eof) {
+        received = false;
+        break;
+      }
+    }
+
+    // A server that closes the connection after the last packet is fine. Closing before it is not
+    if (error == boost::asio::error::eof) {
+      watcher::Log.e("EOF: Connection closed cleanly by peer.");
+    }
+
+    return received;
+  }
+
+  HeaderFormat header_format_ = HeaderFormat::kText;
+  std::unique_ptr<Packet> packet_;
 };
 
 } // namespace watcher
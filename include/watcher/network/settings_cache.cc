@@ -0,0 +1,223 @@
+#include "watcher/network/settings_cache.h"
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+// Per-key polling runs kEachIntervalFactor times less often, and retries the batched request every
+// kBatchedRetryPolls polls: once a minute at the default interval
+constexpr int kEachIntervalFactor = 5;
+constexpr int kBatchedRetryPolls = 6;
+
+// Values may come with trailing newlines or NUL padding
+std::string_view Trim(std::string_view s) {
+  constexpr std::string_view kSpace(" \t\r\n\0", 5);
+  const auto begin = s.find_first_not_of(kSpace);
+  if (begin == std::string_view::npos)
+    return {};
+  const auto end = s.find_last_not_of(kSpace);
+  return s.substr(begin, end - begin + 1);
+}
+
+// Responses of servers that do not send a Status are taken as OK
+bool IsOk(const AsyncClient::response& response) {
+  const auto it = response.find(kHeaderStatus);
+  return it == response.end() || StatusCode(StatusCode::kOk) == it->second;
+}
+
+} // namespace
+
+std::shared_ptr<SettingsCache> SettingsCache::create(NetworkEngine& engine, std::shared_ptr<AsyncClient> client,
+                                                     std::chrono::milliseconds interval,
+                                                     std::chrono::milliseconds timeout) {
+  return std::shared_ptr<SettingsCache>(new SettingsCache(engine, std::move(client), interval, timeout));
+}
+
+SettingsCache::SettingsCache(NetworkEngine& engine, std::shared_ptr<AsyncClient> client,
+                             std::chrono::milliseconds interval, std::chrono::milliseconds timeout)
+  : io_context_(engine.context()),
+    timer_(io_context_),
+    client_(std::move(client)),
+    interval_(interval),
+    timeout_(timeout) {}
+
+boost::signals2::connection SettingsCache::subscribe(const std::string& key, listener func) {
+  std::lock_guard lck(m_);
+
+  auto& signal = signals_[key];
+  if (!signal)
+    signal = std::make_unique<signal_type>();
+  auto connection = signal->connect(func);
+
+  if (const auto it = values_.find(key); it != values_.end()) {
+    boost::asio::post(io_context_, [connection, func = std::move(func), value = it->second]() {
+      if (connection.connected())
+        func(value);
+    });
+  }
+
+  return connection;
+}
+
+std::optional<std::string> SettingsCache::get(const std::string& key) const {
+  std::lock_guard lck(m_);
+  if (const auto it = values_.find(key); it != values_.end())
+    return it->second;
+  return std::nullopt;
+}
+
+void SettingsCache::start() {
+  boost::asio::post(io_context_, [self = shared_from_this()]() {
+    self->stopped_ = false;
+    self->poll();
+  });
+}
+
+void SettingsCache::stop() {
+  boost::asio::post(io_context_, [self = shared_from_this()]() {
+    self->stopped_ = true;
+    self->timer_.cancel();
+  });
+}
+
+void SettingsCache::poll() {
+  if (stopped_)
+    return;
+
+  if (!batched_ && ++polls_since_batched_ >= kBatchedRetryPolls) {
+    batched_ = true;
+    polls_since_batched_ = 0;
+  }
+
+  if (batched_) {
+    poll_batched();
+  } else {
+    poll_each();
+  }
+}
+
+void SettingsCache::poll_batched() {
+  client_->Get("settings/*?version=" + version_, timeout_, [self = shared_from_this()](
+    const boost::system::error_code& error, AsyncClient::response response) {
+    if (!error && !self->handle_batched(response)) {
+      Log.d("Batched settings are not supported by the server. Polling each key");
+      self->batched_ = false;
+      self->poll_each();
+      return;
+    }
+    self->schedule();
+  });
+}
+
+void SettingsCache::poll_each() {
+  auto keys = std::make_shared<std::vector<std::string>>();
+  {
+    std::lock_guard lck(m_);
+    keys->reserve(signals_.size());
+    for (const auto& p : signals_)
+      keys->emplace_back(p.first);
+  }
+  poll_key(std::move(keys), 0);
+}
+
+// Each key is requested once the previous one has been answered, and the next poll is scheduled after the last
+void SettingsCache::poll_key(std::shared_ptr<std::vector<std::string>> keys, size_t index) {
+  if (stopped_)
+    return;
+  if (index == keys->size()) {
+    schedule();
+    return;
+  }
+
+  const auto& key = (*keys)[index];
+  client_->Get("settings/" + key, timeout_, [self = shared_from_this(), keys, index](
+    const boost::system::error_code& error, AsyncClient::response response) {
+    // A failed request keeps the previous value, rather than publishing the error body as the value
+    if (!error && IsOk(response)) {
+      if (const auto it = response.find("data"); it != response.end())
+        self->update((*keys)[index], std::string(Trim(it->second)));
+    }
+    self->poll_key(keys, index + 1);
+  });
+}
+
+void SettingsCache::schedule() {
+  if (stopped_)
+    return;
+
+  timer_.expires_after(batched_ ? interval_ : interval_ * kEachIntervalFactor);
+  timer_.async_wait([self = shared_from_this()](const boost::system::error_code& error) {
+    if (!error)
+      self->poll();
+  });
+}
+
+bool SettingsCache::handle_batched(const AsyncClient::response& response) {
+  if (!IsOk(response))
+    return false;
+
+  const auto version = response.find("Version");
+  if (version != response.end() && !version_.empty() && version->second == version_)
+    return true;
+
+  const auto data = response.find("data");
+  if (data == response.end() || data->second.empty())
+    return false;
+
+  size_t parsed = 0;
+  std::string_view lines = data->second;
+  while (!lines.empty()) {
+    const auto eol = lines.find('\n');
+    const auto line = Trim(lines.substr(0, eol));
+    lines = eol == std::string_view::npos ? std::string_view() : lines.substr(eol + 1);
+
+    const auto eq = line.find('=');
+    if (eq == std::string_view::npos)
+      continue;
+    update(std::string(Trim(line.substr(0, eq))), std::string(Trim(line.substr(eq + 1))));
+    ++parsed;
+  }
+
+  // Probably an error message from a server that treated the request as a file name
+  if (parsed == 0 && version == response.end())
+    return false;
+
+  if (version != response.end())
+    version_ = version->second;
+  return true;
+}
+
+void SettingsCache::update(const std::string& key, std::string value) {
+  signal_type* signal = nullptr;
+  {
+    std::lock_guard lck(m_);
+    if (const auto it = values_.find(key); it != values_.end() && it->second == value)
+      return;
+    values_[key] = value;
+
+    if (const auto it = signals_.find(key); it != signals_.end())
+      signal = it->second.get();
+  }
+
+  Log.d("Setting ", key, " = ", value);
+  if (!signal)
+    return;
+
+  try {
+    (*signal)(value);
+  } catch (const std::exception& e) {
+    Log.e(e.what());
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,85 @@
+#ifndef WATCHER_NETWORK_SETTINGS_CACHE_H_
+#define WATCHER_NETWORK_SETTINGS_CACHE_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/signals2.hpp"
+
+#include "watcher/network/async_client.h"
+#include "watcher/network/network_engine.h"
+
+namespace watcher {
+
+// Local copy of the server's settings, refreshed on a timer instead of once per frame.
+//
+// Every `interval`, all settings are fetched with one `settings/*?version=<v>` request. The server answers
+// with `key=value` lines and a `Version` header; if the version is unchanged nothing is parsed. A server that
+// does not know the batched request (no data, or a non-200 Status) is polled with one `settings/<key>`
+// request per subscribed key instead, one request at a time and five times less often, so that a dozen keys
+// do not crowd out the uploads sharing the client's queue. The batched request is retried now and then.
+//
+// Subscribers are called on the network thread, and only when a value changes.
+class SettingsCache : public std::enable_shared_from_this<SettingsCache> {
+ public:
+  using listener = std::function<void(const std::string& value)>;
+
+  static std::shared_ptr<SettingsCache> create(NetworkEngine& engine, std::shared_ptr<AsyncClient> client,
+                                               std::chrono::milliseconds interval = std::chrono::seconds(2),
+                                               std::chrono::milliseconds timeout = std::chrono::seconds(2));
+
+  SettingsCache(const SettingsCache&) = delete;
+  SettingsCache& operator=(const SettingsCache&) = delete;
+
+  // `key` is the name without the `settings/` prefix. If the value is already known,
+  // `func` is also called with it soon after subscribing
+  boost::signals2::connection subscribe(const std::string& key, listener func);
+
+  [[nodiscard]] std::optional<std::string> get(const std::string& key) const;
+
+  void start();
+  void stop();
+
+ private:
+  using signal_type = boost::signals2::signal<void(const std::string&)>;
+
+  SettingsCache(NetworkEngine& engine, std::shared_ptr<AsyncClient> client,
+                std::chrono::milliseconds interval, std::chrono::milliseconds timeout);
+
+  void poll();
+  void poll_batched();
+  void poll_each();
+  void poll_key(std::shared_ptr<std::vector<std::string>> keys, size_t index);
+  void schedule();
+
+  // Returns false if the response does not look like a batched settings response
+  bool handle_batched(const AsyncClient::response& response);
+  void update(const std::string& key, std::string value);
+
+  boost::asio::io_context& io_context_;
+  boost::asio::steady_timer timer_;
+  std::shared_ptr<AsyncClient> client_;
+  std::chrono::milliseconds interval_;
+  std::chrono::milliseconds timeout_;
+
+  // Network thread only
+  std::string version_;
+  bool batched_ = true;
+  int polls_since_batched_ = 0;
+  bool stopped_ = false;
+
+  mutable std::mutex m_;
+  std::unordered_map<std::string, std::string> values_;
+  std::unordered_map<std::string, std::unique_ptr<signal_type>> signals_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_SETTINGS_CACHE_H_
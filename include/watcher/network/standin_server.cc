@@ -0,0 +1,410 @@
+#include "watcher/network/standin_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "boost/asio.hpp"
+
+#include "watcher/network/packet.h"
+#include "watcher/network/packet_header.h"
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr size_t kReadChunk = 64 * 1024;
+
+struct RequestHeader {
+  bool get = false;
+  bool done = false;
+  std::optional<size_t> total_size;
+  std::unordered_map<std::string, std::string> fields;
+};
+
+bool ParseHeader(const char* header, size_t header_size, RequestHeader& out) {
+  out = {};
+
+  if (PacketHeader::is_binary(header, header_size)) {
+    PacketHeader h;
+    if (!PacketHeader::decode(header, header_size, h))
+      return false;
+    out.get = h.request() == PacketHeader::Request::kGet;
+    out.done = h.done();
+    if (h.has(HeaderKey::kTotalSize))
+      out.total_size = h.total_size();
+    for (size_t i = 0; i < h.extension_count(); ++i)
+      out.fields.emplace(h.extension(i).key, h.extension(i).value);
+    return true;
+  }
+
+  const auto tokens = tokenize(header + to_byte(kPacketHeaderSizeBit), header_size - to_byte(kPacketHeaderSizeBit));
+  for (const auto& p : tokens)
+    out.fields.emplace(p.first, p.second);
+
+  const auto request = out.fields.find(kRequest);
+  if (request == out.fields.end())
+    return false;
+  out.get = request->second == kRequestGet;
+
+  if (const auto it = out.fields.find(kHeaderDone); it != out.fields.end())
+    out.done = it->second == "1";
+  if (const auto it = out.fields.find(kHeaderTotalSize); it != out.fields.end())
+    out.total_size = std::strtoull(it->second.c_str(), nullptr, 10);
+  return true;
+}
+
+std::optional<std::string> ReadFile(const fs::path& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open())
+    return std::nullopt;
+  return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+// Only relative paths that stay under the root are served
+std::optional<fs::path> ResolvePath(const fs::path& root, std::string_view request) {
+  while (!request.empty() && request.front() == '/')
+    request.remove_prefix(1);
+
+  const fs::path relative = fs::path(std::string(request)).lexically_normal();
+  if (relative.empty() || relative.is_absolute() || *relative.begin() == "..")
+    return std::nullopt;
+  return root / relative;
+}
+
+std::string TrimValue(std::string value) {
+  while (!value.empty() && (value.back() == '\n' || value.back() == '\r' || value.back() == ' ' || value.back() == '\0'))
+    value.pop_back();
+  return value;
+}
+
+} // namespace
+
+// Serves one client until it disconnects or the server stops
+class StandinServer::Connection {
+ public:
+  Connection(StandinServer& server, tcp::socket& socket)
+    : server_(server), socket_(socket), buffer_(kPacketSize) {}
+
+  void run() {
+    try {
+      while (serve_one()) {}
+    } catch (const std::exception& e) {
+      if (server_.running_)
+        Log.d("Connection closed: ", e.what());
+    }
+  }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  bool serve_one() {
+    uint32_t header_size;
+    if (!read(reinterpret_cast<char*>(&header_size), sizeof(header_size)))
+      return false;
+    if (header_size < sizeof(header_size) || header_size > kPacketMaxHeaderSize) {
+      Log.e("Invalid header size: ", header_size);
+      return false;
+    }
+
+    std::memcpy(buffer_.data(), &header_size, sizeof(header_size));
+    if (!read(buffer_.data() + sizeof(header_size), header_size - sizeof(header_size)))
+      return false;
+
+    RequestHeader header;
+    if (!ParseHeader(buffer_.data(), header_size, header)) {
+      Log.e("Invalid header");
+      return false;
+    }
+
+    return header.get ? serve_get(header, header_size) : serve_post(header, header_size);
+  }
+
+  bool serve_get(const RequestHeader& header, uint32_t header_size) {
+    // Older clients send no TotalSize with a GET. The request is small enough to come in one segment
+    std::string request;
+    if (header.total_size) {
+      request.resize(std::min<size_t>(*header.total_size, kPacketSize - header_size));
+      if (!read(request.data(), request.size()))
+        return false;
+    } else {
+      request.resize(kPacketMaxHeaderSize);
+      request.resize(socket_.read_some(boost::asio::buffer(request)));
+      throttle(request.size());
+    }
+    while (!request.empty() && request.back() == '\0')
+      request.pop_back();
+
+    ++server_.requests_;
+    server_.bytes_received_ += header_size + request.size();
+
+    std::string body;
+    if (answer(request, body, extra_)) {
+      extra_[kHeaderStatus] = std::to_string(StatusCode::kOk);
+    } else {
+      extra_[kHeaderStatus] = std::to_string(StatusCode::kError);
+      Log.d("Not found: ", request);
+    }
+    respond(body);
+    extra_.clear();
+    return true;
+  }
+
+  bool serve_post(const RequestHeader& header, uint32_t header_size) {
+    // Custom headers only come with the first packet of a frame
+    if (post_.empty()) {
+      if (const auto it = header.fields.find(kHeaderFileFormat); it != header.fields.end())
+        format_ = it->second;
+    }
+
+    size_t body_size;
+    if (header.total_size) {
+      body_size = std::min<size_t>(*header.total_size - std::min(*header.total_size, post_.size()),
+                                   kPacketSize - header_size);
+    } else {
+      body_size = kPacketSize - header_size;
+    }
+
+    const auto offset = post_.size();
+    post_.resize(offset + body_size);
+    if (!read(post_.data() + offset, body_size))
+      return false;
+    server_.bytes_received_ += header_size + body_size;
+
+    if (header.done) {
+      const auto index = server_.frames_++;
+      if (!server_.options_.save_dir.empty()) {
+        const auto path = fs::path(server_.options_.save_dir) / (std::to_string(index) + format_);
+        std::ofstream(path, std::ios::binary).write(post_.data(), static_cast<std::streamsize>(post_.size()));
+      }
+      post_.clear();
+      format_.clear();
+    }
+    return true;
+  }
+
+  // Fills `body` for a GET. Returns false if there is nothing to answer with
+  bool answer(const std::string& request, std::string& body, std::unordered_map<std::string, std::string>& extra) {
+    if (request == "stats") {
+      const auto s = server_.stats();
+      std::stringstream ss;
+      ss << "connections=" << s.connections << '\n'
+         << "requests=" << s.requests << '\n'
+         << "frames=" << s.frames << '\n'
+         << "bytes_received=" << s.bytes_received << '\n'
+         << "bytes_sent=" << s.bytes_sent << '\n';
+      body = ss.str();
+      return true;
+    }
+
+    if (request.rfind("settings/*", 0) == 0)
+      return answer_settings(request, body, extra);
+
+    const auto path = ResolvePath(server_.options_.root, request);
+    if (!path || !fs::is_regular_file(*path))
+      return false;
+    if (auto content = ReadFile(*path)) {
+      body = std::move(*content);
+      return true;
+    }
+    return false;
+  }
+
+  // Every file in root/settings as `key=value` lines. The version is a hash of the lines,
+  // and an unchanged version is answered with no body
+  bool answer_settings(const std::string& request, std::string& body,
+                       std::unordered_map<std::string, std::string>& extra) {
+    const auto dir = fs::path(server_.options_.root) / "settings";
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec))
+      return false;
+
+    std::vector<std::pair<std::string, std::string>> settings;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+      if (!entry.is_regular_file())
+        continue;
+      if (auto content = ReadFile(entry.path()))
+        settings.emplace_back(entry.path().filename().string(), TrimValue(std::move(*content)));
+    }
+    std::sort(settings.begin(), settings.end());
+
+    std::string lines;
+    for (const auto& p : settings)
+      lines.append(p.first).append(1, '=').append(p.second).append(1, '\n');
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto c : lines)
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    const auto version = std::to_string(hash);
+
+    extra["Version"] = version;
+    const auto v = request.find("version=");
+    if (v == std::string::npos || request.compare(v + 8, std::string::npos, version) != 0)
+      body = std::move(lines);
+    return true;
+  }
+
+  // Always at least one packet, each padded to the packet size
+  void respond(const std::string& body) {
+    std::this_thread::sleep_for(server_.options_.delay);
+
+    Packet& packet = response_packet();
+    size_t sent = 0;
+    do {
+      auto header = extra_;
+      header[kHeaderTotalSize] = std::to_string(body.size());
+      header[kHeaderDone] = "0";
+      const auto header_size = Packet::CalcHeaderSize(header);
+      header[kHeaderDone] = std::to_string(header_size + body.size() - sent <= kPacketSize);
+
+      packet.clear();
+      packet.write_header(header);
+      sent += packet.write_data(body.data() + sent, body.size() - sent);
+
+      boost::asio::write(socket_, boost::asio::buffer(packet.buffer(), packet.capacity()));
+      server_.bytes_sent_ += packet.capacity();
+    } while (sent < body.size());
+  }
+
+  Packet& response_packet() {
+    if (!response_)
+      response_ = std::make_unique<Packet>();
+    return *response_;
+  }
+
+  bool read(char* dst, size_t size) {
+    while (size > 0) {
+      const auto chunk = std::min(size, kReadChunk);
+      boost::system::error_code error;
+      boost::asio::read(socket_, boost::asio::buffer(dst, chunk), error);
+      if (error)
+        return false;
+      throttle(chunk);
+      dst += chunk;
+      size -= chunk;
+    }
+    return true;
+  }
+
+  // Sleeps until `bytes` more fit in the bandwidth. Not reading lets the client's writes back up,
+  // as on a slow link
+  void throttle(size_t bytes) {
+    const auto bandwidth = server_.options_.bandwidth;
+    if (bandwidth <= 0)
+      return;
+
+    const auto now = clock::now();
+    next_ = std::max(next_, now) + std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(bytes / bandwidth));
+    if (next_ > now)
+      std::this_thread::sleep_until(next_);
+  }
+
+  StandinServer& server_;
+  tcp::socket& socket_;
+  std::vector<char> buffer_;
+  std::unique_ptr<Packet> response_;
+  std::unordered_map<std::string, std::string> extra_;
+  clock::time_point next_{};
+
+  std::vector<char> post_;
+  std::string format_;
+};
+
+StandinServer::StandinServer(Options options)
+  : options_(std::move(options)), acceptor_(io_context_) {}
+
+StandinServer::~StandinServer() {
+  stop();
+}
+
+void StandinServer::start() {
+  const tcp::endpoint endpoint(tcp::v4(), options_.port);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  port_ = acceptor_.local_endpoint().port();
+
+  running_ = true;
+  accept_thread_ = std::thread([this]() { accept(); });
+  Log.d("Stand-in server listening on port ", port_);
+}
+
+void StandinServer::stop() {
+  if (!running_.exchange(false))
+    return;
+
+  // A blocking accept() is not woken up by close(), so wake it with a connection of our own
+  boost::system::error_code ec;
+  {
+    tcp::socket wake(io_context_);
+    wake.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port_), ec);
+  }
+  if (accept_thread_.joinable())
+    accept_thread_.join();
+  acceptor_.close(ec);
+
+  std::unique_lock lck(m_);
+  for (auto& socket : sockets_) {
+    socket->shutdown(tcp::socket::shutdown_both, ec);
+    socket->close(ec);
+  }
+  closed_.wait(lck, [this]() { return sockets_.empty(); });
+}
+
+StandinServer::Stats StandinServer::stats() const {
+  Stats s;
+  s.connections = connections_;
+  s.requests = requests_;
+  s.frames = frames_;
+  s.bytes_received = bytes_received_;
+  s.bytes_sent = bytes_sent_;
+  return s;
+}
+
+void StandinServer::accept() {
+  while (running_) {
+    auto socket = std::make_shared<tcp::socket>(io_context_);
+    boost::system::error_code ec;
+    acceptor_.accept(*socket, ec);
+    if (ec || !running_)
+      break;
+
+    socket->set_option(tcp::no_delay(true), ec);
+    ++connections_;
+
+    std::lock_guard lck(m_);
+    const auto it = sockets_.emplace(sockets_.end(), socket);
+    std::thread([this, socket, it]() {
+      Connection(*this, *socket).run();
+
+      // Notified only after this thread is gone, so that stop() may destroy the server right away
+      std::unique_lock lck(m_);
+      sockets_.erase(it);
+      std::notify_all_at_thread_exit(closed_, std::move(lck));
+    }).detach();
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,89 @@
+#ifndef WATCHER_NETWORK_STANDIN_SERVER_H_
+#define WATCHER_NETWORK_STANDIN_SERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "boost/asio.hpp"
+
+namespace watcher {
+
+// Local stand-in for the remote server, speaking the same chunked Packet protocol.
+//
+// GET requests are answered from files under `root`: `model/<name>`, `settings/<key>` and so on map to
+// the path of the same name. `settings/*?version=<v>` answers every file in `root/settings` as
+// `key=value` lines with a Version header, and `stats` answers the counters below. Unknown paths are
+// answered with Status=404. POSTed frames are reassembled, counted and optionally written to `save_dir`.
+//
+// Every response is padded to the packet size like the real server. `delay` is added before each
+// response and `bandwidth` throttles how fast each connection is read, to emulate a slow link.
+class StandinServer {
+ public:
+  struct Options {
+    unsigned short port = 7000; // 0 picks a free port
+    std::string root = ".";
+    std::string save_dir;
+    std::chrono::milliseconds delay{0};
+    double bandwidth = 0; // Bytes per second per connection. 0 is unlimited
+  };
+
+  struct Stats {
+    size_t connections = 0;
+    size_t requests = 0;
+    size_t frames = 0;
+    size_t bytes_received = 0;
+    size_t bytes_sent = 0;
+  };
+
+  explicit StandinServer(Options options);
+  ~StandinServer();
+
+  StandinServer(const StandinServer&) = delete;
+  StandinServer& operator=(const StandinServer&) = delete;
+
+  // Binds and starts accepting in the background. Throws if the port cannot be bound
+  void start();
+  void stop();
+
+  // The bound port, which differs from Options::port if that was 0
+  [[nodiscard]] unsigned short port() const { return port_; }
+
+  [[nodiscard]] Stats stats() const;
+
+ private:
+  using tcp = boost::asio::ip::tcp;
+
+  class Connection;
+
+  void accept();
+
+  Options options_;
+  unsigned short port_ = 0;
+
+  boost::asio::io_context io_context_;
+  tcp::acceptor acceptor_;
+  std::thread accept_thread_;
+  std::atomic_bool running_ = false;
+
+  // Open connections only. Each connection thread is detached and removes its socket when it closes
+  std::mutex m_;
+  std::condition_variable closed_;
+  std::list<std::shared_ptr<tcp::socket>> sockets_;
+
+  std::atomic_size_t connections_ = 0;
+  std::atomic_size_t requests_ = 0;
+  std::atomic_size_t frames_ = 0;
+  std::atomic_size_t bytes_received_ = 0;
+  std::atomic_size_t bytes_sent_ = 0;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_STANDIN_SERVER_H_
@@ -4,35 +4,154 @@
 
 #include "watcher/network/tcp_client.h"
 
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <algorithm>
+#include <array>
 #include <string>
+#include <thread>
 
 #include "boost/asio.hpp"
 
+#include "watcher/utility/logger.h"
+
 namespace watcher {
 
 TcpClient::TcpClient(const std::string& url, const std::string& port)
-  : resolver_(io_service_),
-    query_(url, port),
-    endpoints_(resolver_.resolve(query_)),
+  : url_(url),
+    port_(port),
+    resolver_(io_service_),
+    endpoints_(resolver_.resolve(url, port)),
     socket_(io_service_)
 {}
 
 void TcpClient::close() {
-  if (socket_.is_open())
-    socket_.close();
+  if (socket_.is_open()) {
+    boost::system::error_code ignored_error;
+    socket_.shutdown(boost_tcp::socket::shutdown_both, ignored_error);
+    socket_.close(ignored_error);
+  }
 }
 
-size_t TcpClient::send(const char* data, size_t size) {
+bool TcpClient::peer_closed() {
+  // Nothing should be pending between requests. A readable socket here means EOF or a reset
+  char c;
+  boost::system::error_code error;
   boost::system::error_code ignored_error;
+  socket_.non_blocking(true, ignored_error);
+  socket_.receive(boost::asio::buffer(&c, 1), boost_tcp::socket::message_peek, error);
+  socket_.non_blocking(false, ignored_error);
+  return error != boost::asio::error::would_block;
+}
+
+void TcpClient::connect() {
+  if (socket_.is_open()) {
+    if (!peer_closed())
+      return;
+    close();
+  }
+
+  boost::system::error_code error;
+  for (int attempt = 0; attempt < max_connect_attempts_; ++attempt) {
+    if (attempt > 0) {
+      Log.e("Failed to connect to ", url_, ':', port_, " (", error.message(), "). Retrying in ", backoff_.count(), "ms");
+      std::this_thread::sleep_for(backoff_);
+      backoff_ = std::min(backoff_ * 2, kMaxBackoff);
+
+      // The address may have changed while we were offline
+      endpoints_ = resolver_.resolve(url_, port_, error);
+      if (error)
+        continue;
+    }
 
-  boost::asio::connect(socket_, endpoints_);
-  return boost::asio::write(socket_, boost::asio::buffer(data, size), ignored_error);
+    const auto t0 = clock::now();
+    boost::asio::connect(socket_, endpoints_, error);
+    if (error) {
+      socket_.close();
+      continue;
+    }
+
+    rtt_ms_ = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    socket_.set_option(boost_tcp::no_delay(true));
+    socket_.set_option(boost::asio::socket_base::keep_alive(true));
+    backoff_ = std::chrono::milliseconds(100);
+    ++connects_;
+    return;
+  }
+
+  throw boost::system::system_error(error);
 }
 
-size_t TcpClient::receive(char* dst, size_t max_size, boost::system::error_code error) {
-  boost::asio::connect(socket_, endpoints_);
+template<typename ConstBufferSequence>
+size_t TcpClient::write(const ConstBufferSequence& buffers) {
+  boost::system::error_code error;
+
+  connect();
+  auto len = boost::asio::write(socket_, buffers, error);
+
+  // The server may have dropped an idle connection. Retry once on a fresh one if nothing went out
+  if (error && len == 0) {
+    close();
+    connect();
+    len = boost::asio::write(socket_, buffers, error);
+  }
+
+  bytes_sent_ += len;
+  if (error) {
+    close();
+    throw boost::system::system_error(error);
+  }
+  return len;
+}
+
+size_t TcpClient::send(const char* data, size_t size) {
+  return write(boost::asio::buffer(data, size));
+}
+
+size_t TcpClient::send(const char* header, size_t header_size, const char* data, size_t data_size) {
+  const std::array<boost::asio::const_buffer, 2> buffers = {
+    boost::asio::buffer(header, header_size),
+    boost::asio::buffer(data, data_size),
+  };
+  return write(buffers);
+}
+
+size_t TcpClient::receive(char* dst, size_t max_size, boost::system::error_code& error) {
+  if (!socket_.is_open()) {
+    // A response can only arrive on the connection the request was sent on
+    error = boost::asio::error::not_connected;
+    return 0;
+  }
   size_t len = boost::asio::read(socket_, boost::asio::buffer(dst, max_size), error);
+  bytes_received_ += len;
+
+  if (error) {
+    close();
+  } else {
+    update_rtt();
+  }
   return len;
 }
 
+void TcpClient::update_rtt() {
+#ifdef __linux__
+  tcp_info info{};
+  socklen_t info_size = sizeof(info);
+  if (getsockopt(socket_.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &info_size) == 0)
+    rtt_ms_ = info.tcpi_rtt / 1000.0;
+#endif
+}
+
+TcpClient::Stats TcpClient::stats() const {
+  Stats s;
+  s.connects = connects_;
+  s.bytes_sent = bytes_sent_;
+  s.bytes_received = bytes_received_;
+  s.rtt_ms = rtt_ms_;
+  return s;
+}
+
 } // namespace watcher
@@ -5,6 +5,8 @@
 #ifndef WATCHER_NETWORK_ASYNC_TCP_CLIENT_H_
 #define WATCHER_NETWORK_ASYNC_TCP_CLIENT_H_
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <string>
 
@@ -12,27 +14,65 @@
 
 namespace watcher {
 
+// Keeps a single connection open across requests. The connection is (re)established lazily,
+// with exponential backoff, only when there is none or the previous one failed.
 class TcpClient {
  public:
+  struct Stats {
+    size_t connects = 0;
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+    double rtt_ms = 0; // Smoothed RTT reported by the kernel, or the last handshake time
+  };
+
   TcpClient(const std::string& url, int port) : TcpClient(url, std::to_string(port)) {}
   TcpClient(const std::string& url, const std::string& port);
 
   ~TcpClient() { close(); }
 
+  // Throws boost::system::system_error if the data could not be sent
   size_t send(const char* data, size_t size);
 
-  size_t receive(char* dst, size_t max_size, boost::system::error_code error);
+  // Sends `header` followed by `data` with a single vectored write, without joining them first
+  size_t send(const char* header, size_t header_size, const char* data, size_t data_size);
+
+  size_t receive(char* dst, size_t max_size, boost::system::error_code& error);
 
   void close();
 
+  [[nodiscard]] bool is_connected() const { return socket_.is_open(); }
+
+  [[nodiscard]] Stats stats() const;
+
+  TcpClient& max_connect_attempts(int n) { max_connect_attempts_ = n; return *this; }
+
  private:
   using boost_tcp = boost::asio::ip::tcp;
+  using clock = std::chrono::steady_clock;
+
+  void connect();
+  bool peer_closed();
+  void update_rtt();
+
+  template<typename ConstBufferSequence>
+  size_t write(const ConstBufferSequence& buffers);
+
+  std::string url_;
+  std::string port_;
 
   boost::asio::io_service io_service_;
   boost_tcp::resolver resolver_;
-  boost_tcp::resolver::query query_;
   boost_tcp::resolver::results_type endpoints_;
   boost_tcp::socket socket_;
+
+  int max_connect_attempts_ = 5;
+  std::chrono::milliseconds backoff_{100};
+  static constexpr std::chrono::milliseconds kMaxBackoff{5000};
+
+  std::atomic<size_t> connects_{0};
+  std::atomic<size_t> bytes_sent_{0};
+  std::atomic<size_t> bytes_received_{0};
+  std::atomic<double> rtt_ms_{0};
 };
 
 } // namespace watcher
@@ -0,0 +1,144 @@
+#include "watcher/network/upload_rate_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+constexpr double kSmoothing = 0.2;
+
+double Ewma(double average, double sample) {
+  return average == 0 ? sample : average + kSmoothing * (sample - average);
+}
+
+} // namespace
+
+UploadRateController& UploadRateController::bandwidth_cap(double bytes_per_sec) {
+  std::lock_guard lck(m_);
+  bandwidth_cap_ = std::max(0.0, bytes_per_sec);
+  return *this;
+}
+
+UploadRateController& UploadRateController::latency_target(std::chrono::milliseconds target) {
+  std::lock_guard lck(m_);
+  latency_target_ms_ = static_cast<double>(target.count());
+  return *this;
+}
+
+UploadRateController& UploadRateController::quality_range(int min, int max) {
+  std::lock_guard lck(m_);
+  min_quality_ = std::clamp(min, 1, 100);
+  max_quality_ = std::clamp(max, min_quality_, 100);
+  quality_ = std::clamp<double>(quality_, min_quality_, max_quality_);
+  return *this;
+}
+
+UploadRateController& UploadRateController::scale_range(double min, double max) {
+  std::lock_guard lck(m_);
+  min_scale_ = std::clamp(min, 0.05, 1.0);
+  max_scale_ = std::clamp(max, min_scale_, 1.0);
+  scale_ = std::clamp(scale_, min_scale_, max_scale_);
+  return *this;
+}
+
+UploadRateController& UploadRateController::fps_range(double min, double max) {
+  std::lock_guard lck(m_);
+  min_fps_ = std::max(0.1, min);
+  max_fps_ = std::max(min_fps_, max);
+  fps_ = std::clamp(fps_, min_fps_, max_fps_);
+  return *this;
+}
+
+bool UploadRateController::admit(bool has_detection, clock::time_point now) {
+  std::lock_guard lck(m_);
+
+  const auto interval = std::chrono::duration<double>(1.0 / fps_);
+  const auto elapsed = std::chrono::duration<double>(now - last_admit_);
+  if (elapsed < interval && !(has_detection && elapsed >= interval / 2))
+    return false;
+
+  last_admit_ = now;
+  return true;
+}
+
+void UploadRateController::on_sent(size_t bytes, clock::duration send_time, clock::duration latency,
+                                   clock::time_point now) {
+  std::lock_guard lck(m_);
+
+  if (const auto seconds = std::chrono::duration<double>(send_time).count(); seconds > 0)
+    throughput_ = Ewma(throughput_, bytes / seconds);
+  latency_ms_ = Ewma(latency_ms_, std::chrono::duration<double, std::milli>(latency).count());
+  period_bytes_ += bytes;
+
+  update(now);
+}
+
+void UploadRateController::on_failed(clock::time_point now) {
+  std::lock_guard lck(m_);
+  failed_ = true;
+  update(now);
+}
+
+UploadRateController::Settings UploadRateController::settings() const {
+  std::lock_guard lck(m_);
+  return {static_cast<int>(quality_), scale_, fps_};
+}
+
+double UploadRateController::throughput() const {
+  std::lock_guard lck(m_);
+  return throughput_;
+}
+
+void UploadRateController::update(clock::time_point now) {
+  const auto elapsed = std::chrono::duration<double>(now - period_start_).count();
+  if (elapsed < std::chrono::duration<double>(kPeriod).count())
+    return;
+
+  const auto rate = period_bytes_ / elapsed;
+  auto budget = throughput_ * 0.9;
+  if (bandwidth_cap_ > 0)
+    budget = budget > 0 ? std::min(budget, bandwidth_cap_) : bandwidth_cap_;
+
+  const bool over_budget = budget > 0 && rate > budget * 1.05;
+  const bool over_latency = latency_ms_ > latency_target_ms_;
+
+  if (failed_ || over_budget || over_latency) {
+    decrease();
+  } else if ((budget == 0 || rate < budget * 0.8) && latency_ms_ < latency_target_ms_ * 0.5) {
+    increase();
+  }
+
+  Log.d("Upload ", rate * 0.000'001, "MB/s (budget ", budget * 0.000'001, "MB/s, latency ", latency_ms_,
+        "ms): quality ", static_cast<int>(quality_), ", scale ", scale_, ", ", fps_, "fps");
+
+  period_start_ = now;
+  period_bytes_ = 0;
+  failed_ = false;
+}
+
+void UploadRateController::decrease() {
+  if (quality_ > min_quality_) {
+    quality_ = std::max<double>(min_quality_, quality_ * 0.8);
+  } else if (scale_ > min_scale_) {
+    scale_ = std::max(min_scale_, scale_ * 0.8);
+  } else {
+    fps_ = std::max(min_fps_, fps_ * 0.7);
+  }
+}
+
+void UploadRateController::increase() {
+  if (fps_ < max_fps_) {
+    fps_ = std::min(max_fps_, fps_ + 1);
+  } else if (scale_ < max_scale_) {
+    scale_ = std::min(max_scale_, scale_ + 0.05);
+  } else {
+    quality_ = std::min<double>(max_quality_, quality_ + 2);
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,87 @@
+#ifndef WATCHER_NETWORK_UPLOAD_RATE_CONTROLLER_H_
+#define WATCHER_NETWORK_UPLOAD_RATE_CONTROLLER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace watcher {
+
+// Picks JPEG quality, resolution scale and frame rate for uploads from the measured throughput and
+// end-to-end latency, to stay under a bandwidth cap and a latency target.
+//
+// Once per control period the controller compares what it sent against the budget
+// (the cap, or 90% of the measured link throughput if lower). Over budget or over the latency target,
+// it backs off multiplicatively: quality first, then resolution, then frame rate. Well under both,
+// it recovers additively in the reverse order.
+//
+// Frames with detections may be admitted at up to twice the current frame rate.
+class UploadRateController {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  struct Settings {
+    int quality;
+    double scale;
+    double fps;
+  };
+
+  UploadRateController() = default;
+
+  // Bytes per second. 0 means no cap other than the measured throughput
+  UploadRateController& bandwidth_cap(double bytes_per_sec);
+  UploadRateController& latency_target(std::chrono::milliseconds target);
+  UploadRateController& quality_range(int min, int max);
+  UploadRateController& scale_range(double min, double max);
+  UploadRateController& fps_range(double min, double max);
+
+  // Whether a frame captured at `now` should be uploaded
+  bool admit(bool has_detection, clock::time_point now = clock::now());
+
+  // Called when an upload of `bytes` completes. `send_time` is from posting to completion and
+  // `latency` from capture to completion
+  void on_sent(size_t bytes, clock::duration send_time, clock::duration latency,
+               clock::time_point now = clock::now());
+
+  // Called when an upload fails or is dropped
+  void on_failed(clock::time_point now = clock::now());
+
+  [[nodiscard]] Settings settings() const;
+
+  // Estimated link throughput in bytes per second. 0 until the first upload completes
+  [[nodiscard]] double throughput() const;
+
+ private:
+  void update(clock::time_point now);
+  void decrease();
+  void increase();
+
+  mutable std::mutex m_;
+
+  double bandwidth_cap_ = 0;
+  double latency_target_ms_ = 1000;
+  int min_quality_ = 40;
+  int max_quality_ = 95;
+  double min_scale_ = 0.25;
+  double max_scale_ = 1.0;
+  double min_fps_ = 1;
+  double max_fps_ = 30;
+
+  double quality_ = 95;
+  double scale_ = 1.0;
+  double fps_ = 30;
+
+  double throughput_ = 0; // EWMA, bytes per second
+  double latency_ms_ = 0; // EWMA
+  bool failed_ = false;
+
+  static constexpr std::chrono::seconds kPeriod{1};
+  clock::time_point period_start_ = clock::now();
+  size_t period_bytes_ = 0;
+
+  clock::time_point last_admit_{};
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_UPLOAD_RATE_CONTROLLER_H_
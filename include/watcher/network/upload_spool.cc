@@ -0,0 +1,400 @@
+#include "watcher/network/upload_spool.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "watcher/network/packet.h"
+#include "watcher/utility/logger.h"
+
+namespace watcher {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t kRecordMagic = 0x5350'4F4C; // "SPOL"
+constexpr uint32_t kFlagEvent = 1u << 0;
+constexpr uint32_t kFlagSent = 1u << 1;
+
+constexpr const char* kSegmentPrefix = "segment_";
+constexpr const char* kSegmentSuffix = ".spool";
+
+// Followed by the packet header (size prefix and `key=value;` pairs) and the data, padded to 8 bytes.
+// The magic is written last, after the rest of the record has been flushed with msync, so a record torn by
+// a crash or power loss is never read back
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t flags;
+  uint64_t seq;
+  int64_t time_ms;
+  uint32_t header_size;
+  uint32_t data_size;
+};
+static_assert(sizeof(RecordHeader) == 32);
+
+size_t RecordSize(size_t header_size, size_t data_size) {
+  return (sizeof(RecordHeader) + header_size + data_size + 7) & ~size_t(7);
+}
+
+// Returns nullptr if there is no complete record at `offset`
+const RecordHeader* RecordAt(const char* map, size_t capacity, size_t offset) {
+  if (offset + sizeof(RecordHeader) > capacity)
+    return nullptr;
+  const auto* record = reinterpret_cast<const RecordHeader*>(map + offset);
+  if (record->magic != kRecordMagic || offset + RecordSize(record->header_size, record->data_size) > capacity)
+    return nullptr;
+  return record;
+}
+
+size_t RecordSize(const RecordHeader* record) {
+  return RecordSize(record->header_size, record->data_size);
+}
+
+// Writes [addr, addr + size) of a shared mapping back to the file and waits for it
+void Sync(char* addr, size_t size) {
+  static const auto page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+  const auto begin = reinterpret_cast<uintptr_t>(addr) & ~(page - 1);
+  const auto end = reinterpret_cast<uintptr_t>(addr) + size;
+  if (::msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC) != 0)
+    Log.w("Failed to sync the spool: ", std::strerror(errno));
+}
+
+std::string SegmentName(uint64_t first_seq) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "%s%020" PRIu64 "%s", kSegmentPrefix, first_seq, kSegmentSuffix);
+  return name;
+}
+
+} // namespace
+
+UploadSpool::UploadSpool(std::string directory, size_t segment_size, size_t max_segments)
+  : directory_(std::move(directory)),
+    segment_size_(std::max<size_t>(segment_size, 64 * 1024)),
+    max_segments_(std::max<size_t>(max_segments, 2))
+{
+  std::error_code ec;
+  fs::create_directories(directory_, ec);
+  if (!fs::is_directory(directory_))
+    throw std::runtime_error("Cannot use " + directory_ + " as the upload spool: " + ec.message());
+
+  recover();
+}
+
+UploadSpool::~UploadSpool() {
+  for (auto& segment : segments_)
+    unmap(segment);
+}
+
+bool UploadSpool::push(const header_type& header, const unsigned char* data, size_t size, bool event) {
+  const auto header_size = Packet::CalcHeaderSize(header);
+  const auto record_size = RecordSize(header_size, size);
+
+  std::lock_guard lck(m_);
+
+  if (record_size > segment_size_) {
+    ++dropped_;
+    Log.e("Frame of ", size, "bytes does not fit in a spool segment");
+    return false;
+  }
+
+  if (segments_.empty() || segments_.back().used + record_size > segments_.back().capacity) {
+    if (!make_room(event)) {
+      ++dropped_;
+      return false;
+    }
+    // The sealed segment is mapped again by front() when its turn comes
+    if (!segments_.empty())
+      unmap(segments_.back());
+    if (!open_segment(next_seq_)) {
+      ++dropped_;
+      return false;
+    }
+  }
+
+  auto& segment = segments_.back();
+  if (!map(segment)) {
+    ++dropped_;
+    return false;
+  }
+
+  RecordHeader record{};
+  record.flags = event ? kFlagEvent : 0;
+  record.seq = next_seq_++;
+  record.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  record.header_size = header_size;
+  record.data_size = static_cast<uint32_t>(size);
+
+  char* dst = segment.map + segment.used;
+  Packet::WriteHeader(dst + sizeof(record), header_size, header);
+  std::memcpy(dst + sizeof(record) + header_size, data, size);
+  std::memcpy(dst, &record, sizeof(record));
+  // Dirty pages of a shared mapping are written back in no particular order
+  Sync(dst, record_size);
+  reinterpret_cast<RecordHeader*>(dst)->magic = kRecordMagic;
+
+  if (segment.unsent == 0)
+    segment.read = segment.used;
+  segment.used += record_size;
+  ++segment.unsent;
+  if (event)
+    ++segment.events;
+  return true;
+}
+
+std::optional<UploadSpool::Record> UploadSpool::front() {
+  std::lock_guard lck(m_);
+  remove_sent();
+
+  for (auto& segment : segments_) {
+    if (segment.unsent == 0)
+      continue;
+    if (!map(segment))
+      return std::nullopt;
+
+    for (auto offset = segment.read; offset < segment.used;) {
+      const auto* record = RecordAt(segment.map, segment.capacity, offset);
+      if (!record)
+        break;
+      offset += RecordSize(record);
+      if (record->flags & kFlagSent)
+        continue;
+
+      const char* header = reinterpret_cast<const char*>(record + 1);
+      const auto* data = reinterpret_cast<const unsigned char*>(header + record->header_size);
+
+      Record result;
+      result.seq = record->seq;
+      result.event = record->flags & kFlagEvent;
+      result.time_ms = record->time_ms;
+      for (const auto& p : tokenize(header + to_byte(kPacketHeaderSizeBit),
+                                    record->header_size - to_byte(kPacketHeaderSizeBit)))
+        result.header.emplace(p.first, p.second);
+      result.data = std::make_shared<std::vector<unsigned char>>(data, data + record->data_size);
+      return result;
+    }
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+void UploadSpool::pop(uint64_t seq) {
+  std::lock_guard lck(m_);
+
+  auto it = std::find_if(segments_.rbegin(), segments_.rend(), [seq](const Segment& s) {
+    return s.first_seq <= seq;
+  });
+  if (it == segments_.rend() || it->unsent == 0 || !map(*it))
+    return;
+
+  auto& segment = *it;
+  for (auto offset = segment.read; offset < segment.used;) {
+    auto* record = const_cast<RecordHeader*>(RecordAt(segment.map, segment.capacity, offset));
+    if (!record)
+      break;
+    offset += RecordSize(record);
+    if (record->seq != seq)
+      continue;
+
+    if (!(record->flags & kFlagSent)) {
+      record->flags |= kFlagSent;
+      --segment.unsent;
+      if (record->flags & kFlagEvent)
+        --segment.events;
+    }
+    break;
+  }
+
+  // Skip over everything sent so far
+  while (segment.read < segment.used) {
+    const auto* record = RecordAt(segment.map, segment.capacity, segment.read);
+    if (!record || !(record->flags & kFlagSent))
+      break;
+    segment.read += RecordSize(record);
+  }
+
+  remove_sent();
+}
+
+bool UploadSpool::empty() const {
+  std::lock_guard lck(m_);
+  return std::all_of(segments_.begin(), segments_.end(), [](const Segment& s) { return s.unsent == 0; });
+}
+
+UploadSpool::Stats UploadSpool::stats() const {
+  std::lock_guard lck(m_);
+  Stats s;
+  for (const auto& segment : segments_) {
+    s.records += segment.unsent;
+    s.bytes += segment.used;
+  }
+  s.segments = segments_.size();
+  s.evicted = evicted_;
+  s.dropped = dropped_;
+  return s;
+}
+
+void UploadSpool::recover() {
+  std::vector<fs::path> paths;
+  for (const auto& entry : fs::directory_iterator(directory_)) {
+    const auto name = entry.path().filename().string();
+    if (entry.is_regular_file() && name.rfind(kSegmentPrefix, 0) == 0 && entry.path().extension() == kSegmentSuffix)
+      paths.emplace_back(entry.path());
+  }
+  std::sort(paths.begin(), paths.end());
+
+  size_t recovered = 0;
+  for (const auto& path : paths) {
+    Segment segment;
+    segment.path = path.string();
+    segment.first_seq = std::strtoull(path.stem().string().c_str() + std::strlen(kSegmentPrefix), nullptr, 10);
+    if (!map(segment))
+      continue;
+
+    bool found_unsent = false;
+    while (const auto* record = RecordAt(segment.map, segment.capacity, segment.used)) {
+      if (!(record->flags & kFlagSent)) {
+        if (!found_unsent)
+          segment.read = segment.used;
+        found_unsent = true;
+        ++segment.unsent;
+        if (record->flags & kFlagEvent)
+          ++segment.events;
+      }
+      next_seq_ = std::max(next_seq_, record->seq + 1);
+      segment.used += RecordSize(record);
+    }
+    if (!found_unsent)
+      segment.read = segment.used;
+
+    unmap(segment);
+    if (segment.unsent == 0) {
+      ::unlink(segment.path.c_str());
+      continue;
+    }
+    recovered += segment.unsent;
+    segments_.emplace_back(std::move(segment));
+  }
+
+  if (recovered > 0)
+    Log.d("Recovered ", recovered, " unsent frames from ", directory_);
+}
+
+bool UploadSpool::open_segment(uint64_t first_seq) {
+  Segment segment;
+  segment.path = (fs::path(directory_) / SegmentName(first_seq)).string();
+  segment.first_seq = first_seq;
+
+  const int fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    Log.e("Failed to create ", segment.path, ": ", std::strerror(errno));
+    return false;
+  }
+  const bool sized = ::ftruncate(fd, static_cast<off_t>(segment_size_)) == 0;
+  ::close(fd);
+  if (!sized) {
+    Log.e("Failed to size ", segment.path, ": ", std::strerror(errno));
+    ::unlink(segment.path.c_str());
+    return false;
+  }
+
+  segments_.emplace_back(std::move(segment));
+  return true;
+}
+
+bool UploadSpool::map(Segment& segment) {
+  if (segment.map)
+    return true;
+
+  segment.fd = ::open(segment.path.c_str(), O_RDWR);
+  struct stat st{};
+  if (segment.fd < 0 || ::fstat(segment.fd, &st) != 0 || st.st_size <= 0) {
+    Log.e("Failed to open ", segment.path, ": ", std::strerror(errno));
+    if (segment.fd >= 0)
+      ::close(segment.fd);
+    segment.fd = -1;
+    return false;
+  }
+
+  void* addr = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+  if (addr == MAP_FAILED) {
+    Log.e("Failed to map ", segment.path, ": ", std::strerror(errno));
+    ::close(segment.fd);
+    segment.fd = -1;
+    return false;
+  }
+
+  segment.map = static_cast<char*>(addr);
+  segment.capacity = st.st_size;
+  return true;
+}
+
+void UploadSpool::unmap(Segment& segment) {
+  if (segment.map) {
+    ::msync(segment.map, segment.capacity, MS_ASYNC);
+    ::munmap(segment.map, segment.capacity);
+    segment.map = nullptr;
+  }
+  if (segment.fd >= 0) {
+    ::close(segment.fd);
+    segment.fd = -1;
+  }
+}
+
+void UploadSpool::remove(std::deque<Segment>::iterator it) {
+  evicted_ += it->unsent;
+  unmap(*it);
+  ::unlink(it->path.c_str());
+  segments_.erase(it);
+}
+
+bool UploadSpool::make_room(bool event) {
+  remove_sent();
+
+  while (segments_.size() >= max_segments_) {
+    const auto it = std::find_if(segments_.begin(), segments_.end(), [](const Segment& s) { return s.events == 0; });
+    if (it != segments_.end()) {
+      Log.d("Spool is full. Evicting ", it->unsent, " frames");
+      remove(it);
+    } else if (!event) {
+      return false;
+    } else {
+      Log.e("Spool is full of event frames. Evicting ", segments_.front().unsent, " frames");
+      remove(segments_.begin());
+    }
+  }
+  return true;
+}
+
+// Fully sent segments are deleted, except the last one, which is still written to
+void UploadSpool::remove_sent() {
+  for (auto it = segments_.begin(); it != segments_.end() && std::next(it) != segments_.end();) {
+    if (it->unsent == 0) {
+      unmap(*it);
+      ::unlink(it->path.c_str());
+      it = segments_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+} // namespace watcher
@@ -0,0 +1,101 @@
+#ifndef WATCHER_NETWORK_UPLOAD_SPOOL_H_
+#define WATCHER_NETWORK_UPLOAD_SPOOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace watcher {
+
+// Store-and-forward queue of encoded frames on disk, so that uploads survive a link outage
+// (and a restart) instead of being dropped.
+//
+// Frames are appended to fixed-size, memory-mapped segment files in `directory`. At most
+// `max_segments` exist, which bounds the disk use; only the segment being written and the one being
+// read are mapped, which bounds the memory use. A sent frame is marked in place, and a segment is
+// deleted once all of its frames are sent.
+//
+// When the budget is full, the oldest segment without event frames is evicted. If every segment holds
+// event frames, a new non-event frame is dropped instead, and only a new event frame evicts the oldest.
+//
+// Thread-safe.
+class UploadSpool {
+ public:
+  using header_type = std::unordered_map<std::string, std::string>;
+
+  struct Record {
+    uint64_t seq = 0;
+    bool event = false;
+    int64_t time_ms = 0; // System clock when pushed
+    header_type header;
+    std::shared_ptr<std::vector<unsigned char>> data;
+  };
+
+  struct Stats {
+    size_t records = 0; // Not sent yet
+    size_t bytes = 0;   // Used in all segments
+    size_t segments = 0;
+    size_t evicted = 0; // Unsent frames lost to eviction
+    size_t dropped = 0; // Frames not stored
+  };
+
+  // Frames left in `directory` by a previous run are recovered. Throws if the directory cannot be used
+  explicit UploadSpool(std::string directory, size_t segment_size = 8 * 1024 * 1024, size_t max_segments = 16);
+  ~UploadSpool();
+
+  UploadSpool(const UploadSpool&) = delete;
+  UploadSpool& operator=(const UploadSpool&) = delete;
+
+  // Returns false if the frame was dropped
+  bool push(const header_type& header, const unsigned char* data, size_t size, bool event);
+
+  // A copy of the oldest unsent frame. It stays in the spool until pop()
+  std::optional<Record> front();
+
+  // Marks the frame as sent. Does nothing if it was evicted in the meantime
+  void pop(uint64_t seq);
+
+  [[nodiscard]] bool empty() const;
+  [[nodiscard]] Stats stats() const;
+
+ private:
+  struct Segment {
+    std::string path;
+    uint64_t first_seq = 0;
+    int fd = -1;
+    char* map = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;      // Bytes of records
+    size_t read = 0;      // Offset of the first unsent record
+    size_t unsent = 0;
+    size_t events = 0;    // Unsent event frames
+  };
+
+  void recover();
+  bool open_segment(uint64_t first_seq);
+  bool map(Segment& segment);
+  void unmap(Segment& segment);
+  void remove(std::deque<Segment>::iterator it);
+  bool make_room(bool event);
+  void remove_sent();
+
+  std::string directory_;
+  size_t segment_size_;
+  size_t max_segments_;
+
+  mutable std::mutex m_;
+  std::deque<Segment> segments_; // Oldest first. The last one is written to
+  uint64_t next_seq_ = 0;
+  size_t evicted_ = 0;
+  size_t dropped_ = 0;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_NETWORK_UPLOAD_SPOOL_H_
@@ -0,0 +1,244 @@
+#include "watcher/offline/offline_runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "opencv2/opencv.hpp"
+
+#include "watcher/detector/movement_detector.h"
+#include "watcher/mock_input/video_input.h"
+#include "watcher/option_controller.h"
+#include "watcher/trace/trace.h"
+#include "watcher/utility/logger.h"
+#include "watcher/utility/thread_name.h"
+
+namespace watcher {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+void AppendNumber(std::string& out, double value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.3f", value);
+  out += buf;
+}
+
+void AppendString(std::string& out, std::string_view value) {
+  out += '"';
+  for (const auto c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out += ' ';
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+std::string ToJson(const std::string& file, uint64_t frame, int64_t time_ms, const MovementDetector::Result& result) {
+  std::string out = "{\"file\":";
+  AppendString(out, file);
+  out += ",\"frame\":" + std::to_string(frame) + ",\"time_ms\":" + std::to_string(time_ms) + ",\"detections\":[";
+  for (size_t i = 0; i < result.detections.size(); ++i) {
+    const auto& d = result.detections[i];
+    if (i != 0)
+      out += ',';
+    out += "{\"label\":";
+    AppendString(out, d.label);
+    out += ",\"score\":";
+    AppendNumber(out, d.score);
+    out += ",\"box\":[";
+    // The model gives [y0, x0, y1, x1]
+    const float box[4] = {d.rect[1], d.rect[0], d.rect[3], d.rect[2]};
+    for (size_t j = 0; j < 4; ++j) {
+      if (j != 0)
+        out += ',';
+      AppendNumber(out, box[j]);
+    }
+    out += "]}";
+  }
+  out += "]}\n";
+  return out;
+}
+
+std::vector<std::string> ListFiles(const std::string& path) {
+  std::error_code ec;
+  if (!fs::is_directory(path, ec))
+    return {path};
+
+  std::vector<std::string> files;
+  for (const auto& entry : fs::directory_iterator(path, ec)) {
+    if (entry.is_regular_file(ec))
+      files.emplace_back(entry.path().string());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+} // namespace
+
+OfflineRunner::OfflineRunner(std::shared_ptr<const AlignedBuffer> model, std::string labelmap)
+  : model_(std::move(model)),
+    labelmap_(std::move(labelmap)),
+    jobs_(std::max(1, static_cast<int>(std::thread::hardware_concurrency()))) {}
+
+OfflineRunner& OfflineRunner::jobs(int n) {
+  jobs_ = std::max(1, n);
+  return *this;
+}
+
+OfflineRunner& OfflineRunner::threads_per_job(int n) {
+  threads_per_job_ = std::max(1, n);
+  return *this;
+}
+
+OfflineRunner& OfflineRunner::gate(std::string model) {
+  gate_ = std::move(model);
+  return *this;
+}
+
+OfflineRunner::Stats OfflineRunner::run(const std::string& path, std::ostream& out) {
+  Stats stats;
+  const auto t0 = std::chrono::steady_clock::now();
+
+  start();
+  try {
+    for (const auto& file : ListFiles(path))
+      run_file(file, out, stats);
+  } catch (...) {
+    stop();
+    throw;
+  }
+  stop();
+
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return stats;
+}
+
+void OfflineRunner::run_file(const std::string& path, std::ostream& out, Stats& stats) {
+  VideoInput video(path);
+  if (!video.is_open()) {
+    Log.w("Skipping ", path, ": cannot be decoded");
+    return;
+  }
+  ++stats.files;
+  const double fps = video.fps() > 0 ? video.fps() : 30;
+  // Frames are numbered from 0 in each file, but tagged with ids unique to the run in the trace
+  const uint64_t first_id = stats.frames + 1;
+
+  // Fresh motion state for every file. The options are fixed for the whole file, for reproducible output
+  MovementDetector detector;
+  if (!gate_.empty())
+    detector.LoadGateModelFromBuffer(gate_.data(), gate_.size());
+  const auto options = OptionController::get().options();
+
+  struct InFlight {
+    uint64_t frame;
+    uint64_t id;
+    int64_t time_ms;
+    cv::Mat image;
+    std::future<Output> output;
+  };
+  std::deque<InFlight> in_flight;
+
+  const auto commit_front = [&]() {
+    auto& f = in_flight.front();
+    auto output = f.output.get();
+    if (const auto result = detector.commit(f.image, f.time_ms, f.id, output.detections,
+                                            std::move(output.labelmap), *options); result) {
+      stats.detections += result->detections.size();
+      out << ToJson(path, f.frame, f.time_ms, *result);
+    }
+    in_flight.pop_front();
+  };
+
+  for (uint64_t frame = 0;; ++frame) {
+    cv::Mat image;
+    video >> image;
+    if (image.empty())
+      break;
+    ++stats.frames;
+    const auto id = first_id + frame;
+    const auto time_ms = static_cast<int64_t>(static_cast<double>(frame) * 1000 / fps);
+
+    while (!in_flight.empty() && in_flight.front().frame + jobs_ <= frame)
+      commit_front();
+
+    if (!detector.screen(image, time_ms, id, *options))
+      continue;
+    ++stats.inferences;
+
+    auto task = std::make_shared<std::packaged_task<Output(ObjectDetectionModel&)>>(
+      [image, id](ObjectDetectionModel& model) {
+        TraceSpan span("inference", id);
+        return Output{model.invoke(image), model.labelmap()};
+      });
+    in_flight.push_back({frame, id, time_ms, image, task->get_future()});
+    {
+      std::lock_guard lck(m_);
+      tasks_.emplace_back([task](ObjectDetectionModel& model) { (*task)(model); });
+    }
+    cv_.notify_one();
+  }
+
+  while (!in_flight.empty())
+    commit_front();
+  out.flush();
+}
+
+void OfflineRunner::start() {
+  stopping_ = false;
+
+  // Built up front, so that a model that fails to load fails run() before any frame is decoded
+  std::vector<std::unique_ptr<ObjectDetectionModel>> models;
+  for (int i = 0; i < jobs_; ++i) {
+    auto model = std::make_unique<ObjectDetectionModel>();
+    model->num_threads(threads_per_job_);
+    model->loadFromBuffer(model_, labelmap_.data(), labelmap_.size());
+    if (!model->is_loaded())
+      throw std::runtime_error("Cannot load the model");
+    models.emplace_back(std::move(model));
+  }
+
+  for (auto& model : models) {
+    workers_.emplace_back([this, interpreter = std::shared_ptr<ObjectDetectionModel>(std::move(model))]() {
+      for (;;) {
+        Task task;
+        {
+          std::unique_lock lck(m_);
+          cv_.wait(lck, [this]() { return stopping_ || !tasks_.empty(); });
+          if (tasks_.empty())
+            return;
+          task = std::move(tasks_.front());
+          tasks_.pop_front();
+        }
+        task(*interpreter);
+      }
+    });
+    SetThreadName(workers_.back(), "offline");
+  }
+}
+
+// Runs the tasks still queued, then joins the workers
+void OfflineRunner::stop() {
+  {
+    std::lock_guard lck(m_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+  workers_.clear();
+}
+
+} // namespace watcher
@@ -0,0 +1,81 @@
+#ifndef WATCHER_OFFLINE_OFFLINE_RUNNER_H_
+#define WATCHER_OFFLINE_OFFLINE_RUNNER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "watcher/detector/object_detection_model.h"
+#include "watcher/utility/aligned_buffer.h"
+
+namespace watcher {
+
+// Runs recorded video through the detection pipeline as fast as the hardware allows, instead of in real time,
+// and writes the detections as JSON lines:
+//
+//   {"file":"a.mp4","frame":120,"time_ms":4000,"detections":[{"label":"person","score":0.873,"box":[...]}]}
+//
+// One line per frame with detections, in frame order. Boxes are [x0, y0, x1, y1] in fractions of the frame size.
+//
+// Decoding, motion and the gate run in order on the calling thread. Frames that pass them are handed to one of
+// `jobs` interpreters, and the results are committed back in frame order. The detector's motion state depends on
+// earlier results, so frame k is screened only after every frame up to k - jobs has been committed, and never
+// after a later one. The output therefore depends on the input, the options and `jobs`, but not on timing;
+// with one job it matches what the live detector would decide.
+class OfflineRunner {
+ public:
+  struct Stats {
+    uint64_t files = 0;
+    uint64_t frames = 0;
+    uint64_t inferences = 0;
+    uint64_t detections = 0;
+    double seconds = 0;
+  };
+
+  OfflineRunner(std::shared_ptr<const AlignedBuffer> model, std::string labelmap);
+
+  // Number of interpreters running at once, and interpreter threads of each. Set before run()
+  OfflineRunner& jobs(int n);
+  OfflineRunner& threads_per_job(int n);
+
+  // Optional gate model, as MovementDetector::LoadGateModelFromBuffer
+  OfflineRunner& gate(std::string model);
+
+  // `path` is a video file, or a directory whose files are processed in name order.
+  // Throws std::runtime_error if the model cannot be loaded
+  Stats run(const std::string& path, std::ostream& out);
+
+ private:
+  struct Output {
+    ObjectDetectionModel::result_type detections;
+    std::shared_ptr<const ObjectDetectionModel::label_table> labelmap;
+  };
+  using Task = std::function<void(ObjectDetectionModel&)>;
+
+  void run_file(const std::string& path, std::ostream& out, Stats& stats);
+  void start();
+  void stop();
+
+  std::shared_ptr<const AlignedBuffer> model_;
+  std::string labelmap_;
+  std::string gate_;
+  int jobs_;
+  int threads_per_job_ = 1;
+
+  std::vector<std::thread> workers_;
+  std::deque<Task> tasks_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_OFFLINE_OFFLINE_RUNNER_H_
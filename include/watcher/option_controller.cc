@@ -0,0 +1,200 @@
+#include "watcher/option_controller.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+
+namespace watcher {
+
+namespace {
+
+using Labels = std::unordered_set<std::string>;
+
+// Parses the value into the options. `labels` are the ones `objects` may name; empty if unknown
+using Parser = std::function<bool(Options&, const std::string& value, const Labels& labels)>;
+
+std::optional<double> ParseNumber(const std::string& value) {
+  if (value.empty())
+    return std::nullopt;
+  char* end = nullptr;
+  errno = 0;
+  const double v = std::strtod(value.c_str(), &end);
+  if (errno != 0 || end != value.c_str() + value.size())
+    return std::nullopt;
+  return v;
+}
+
+template<typename T>
+Parser Number(T Options::* member, double min, double max) {
+  return [member, min, max](Options& o, const std::string& value, const Labels&) {
+    const auto v = ParseNumber(value);
+    if (!v || *v < min || *v > max)
+      return false;
+    o.*member = static_cast<T>(*v);
+    return true;
+  };
+}
+
+// `member` is set to `matched` if the value is `match`, and to the opposite for anything else
+Parser Flag(bool Options::* member, const char* match, bool matched) {
+  return [member, match, matched](Options& o, const std::string& value, const Labels&) {
+    o.*member = (value == match) == matched;
+    return true;
+  };
+}
+
+std::string Trim(const std::string& s) {
+  const auto first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos)
+    return {};
+  return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+const std::unordered_map<std::string, Parser>& Parsers() {
+  static const std::unordered_map<std::string, Parser> parsers = {
+    {"score", Number(&Options::score_threshold, 0, 1)},
+    {"gate", Number(&Options::gate_threshold, 0, 1)},
+    {"objects", [](Options& o, const std::string& value, const Labels& labels) {
+      std::unordered_set<std::string> objects;
+      if (!value.empty()) {
+        std::stringstream ss(value);
+        for (std::string label; std::getline(ss, label, ',');) {
+          label = Trim(label);
+          if (label.empty() || (!labels.empty() && labels.count(label) == 0))
+            return false;
+          objects.emplace(std::move(label));
+        }
+        // "a," leaves an empty label that getline does not return
+        if (value.back() == ',')
+          return false;
+      }
+      o.objects = std::move(objects);
+      return true;
+    }},
+    {"motion_threshold", Number(&Options::motion_threshold, 0, 255)},
+    {"motion_hold", [](Options& o, const std::string& value, const Labels&) {
+      const auto v = ParseNumber(value);
+      if (!v || *v < 0)
+        return false;
+      o.motion_hold = std::chrono::milliseconds(static_cast<int64_t>(*v));
+      return true;
+    }},
+    {"model_threads", Number(&Options::model_threads, 0, 64)},
+    {"quality", Number(&Options::quality, 1, 100)},
+    {"bandwidth", Number(&Options::bandwidth_kbps, 0, 1e9)},
+    {"max_fps", Number(&Options::max_fps, 0.1, 1000)},
+    {"max_scale", Number(&Options::max_scale, 0.05, 1)},
+    {"upload_mode", Flag(&Options::event_upload, "event", true)},
+    {"overlay", Flag(&Options::draw_overlay, "metadata", false)},
+    {"trace", Flag(&Options::trace, "1", true)},
+    {"log_level", [](Options& o, const std::string& value, const Labels&) {
+      static const std::unordered_map<std::string, LogLevel> levels = {
+        {"debug", LogLevel::kDebug},
+        {"info", LogLevel::kInfo},
+        {"warning", LogLevel::kWarning},
+        {"error", LogLevel::kError},
+        {"off", LogLevel::kOff},
+      };
+      const auto it = levels.find(value);
+      if (it == levels.end())
+        return false;
+      o.log_level = it->second;
+      return true;
+    }},
+  };
+  return parsers;
+}
+
+} // namespace
+
+std::vector<std::string> OptionController::keys() {
+  std::vector<std::string> keys;
+  for (const auto& p : Parsers())
+    keys.emplace_back(p.first);
+  return keys;
+}
+
+void OptionController::update(const std::function<void(Options&)>& func) {
+  std::lock_guard lck(write_m_);
+  auto copy = std::make_shared<Options>(*options());
+  func(*copy);
+  store(std::move(copy));
+}
+
+bool OptionController::set(const std::string& key, const std::string& value) {
+  return publish({{key, value}}, Origin::kLocal);
+}
+
+void OptionController::labels(const std::vector<std::string>& labels) {
+  std::lock_guard lck(write_m_);
+  labels_ = Labels(labels.begin(), labels.end());
+  for (const auto& object : options()->objects) {
+    if (labels_.count(object) == 0)
+      Log.w("Option objects names ", object, ", which is not a label of the model");
+  }
+}
+
+bool OptionController::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file)
+    return false;
+
+  std::vector<std::pair<std::string, std::string>> values;
+  for (std::string line; std::getline(file, line);) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+    const auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      Log.w(path, ": expected key=value, got ", line);
+      continue;
+    }
+    values.emplace_back(Trim(line.substr(0, eq)), Trim(line.substr(eq + 1)));
+  }
+  publish(values, Origin::kLocal);
+  return true;
+}
+
+bool OptionController::publish(const std::vector<std::pair<std::string, std::string>>& values, Origin origin) {
+  const auto& parsers = Parsers();
+
+  std::lock_guard lck(write_m_);
+  // Parsers leave the options untouched on invalid values, so nothing is published unless something is valid
+  auto copy = std::make_shared<Options>(*options());
+  bool changed = false;
+  for (const auto& [key, value] : values) {
+    const auto it = parsers.find(key);
+    if (it == parsers.end()) {
+      Log.w("Unknown option ", key);
+      continue;
+    }
+    if (origin == Origin::kLocal && server_keys_.count(key) != 0) {
+      Log.d("Option ", key, " is set by the server. Ignoring ", value);
+      continue;
+    }
+    if (!it->second(*copy, value, labels_)) {
+      Log.w("Invalid value for option ", key, ": ", value);
+      continue;
+    }
+    if (origin == Origin::kServer)
+      server_keys_.insert(key);
+    Log.d("Option ", key, " = ", value);
+    changed = true;
+  }
+  if (!changed)
+    return false;
+
+  store(std::move(copy));
+  return true;
+}
+
+void OptionController::store(options_ptr current) {
+  const auto previous = options();
+  std::atomic_store(&options_, current);
+  listener_(current, previous);
+}
+
+} // namespace watcher
@@ -5,38 +5,114 @@
 #ifndef WATCHER_OPTION_H_
 #define WATCHER_OPTION_H_
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
-#include "watcher/network/protocol.h"
+#include "boost/signals2.hpp"
+
+#include "watcher/utility/logger.h"
 
 namespace watcher {
 
+// Every runtime tunable, by the name of its key in `settings/<key>` and in the options file
+struct Options {
+  // Detection
+  float score_threshold = 0.5f;                       // score
+  float gate_threshold = 0.3f;                        // gate
+  std::unordered_set<std::string> objects;            // objects: comma separated labels of the model. Empty reports all
+  int motion_threshold = 40;                          // motion_threshold: pixel difference that counts as motion
+  std::chrono::milliseconds motion_hold{3000};        // motion_hold: keep running the model this long after motion
+  int model_threads = 0;                              // model_threads: tuner's thread budget. 0 keeps its default
+
+  // Upload
+  int quality = 95;                                   // quality: highest JPEG quality
+  double bandwidth_kbps = 0;                          // bandwidth: cap in kbit/s. 0 removes it
+  double max_fps = 30;                                // max_fps
+  double max_scale = 1.0;                             // max_scale: largest upload resolution, relative to the view
+  bool event_upload = false;                          // upload_mode: event. Anything else is continuous
+
+  // Annotation and diagnostics
+  bool draw_overlay = true;                           // overlay: metadata. Anything else draws pixels
+  bool trace = false;                                 // trace: 1. Anything else is off
+  LogLevel log_level = LogLevel::kDebug;              // log_level: debug, info, warning, error or off
+};
+
+// Owns the current Options. Readers take an immutable snapshot with options(), which is one atomic load and
+// never blocks, so hot paths can call it per frame. Writers copy the snapshot, change the copy and publish it
+// in its place (read-copy-update); a reader keeps the snapshot it loaded for as long as it holds it.
+//
+// Updates come from the server's settings (follow()) or from a `key=value` file (load()), and every key
+// that changes in one update is published together. Once the server has set a key, the file no longer does.
 class OptionController {
  public:
+  using options_ptr = std::shared_ptr<const Options>;
+  using listener = void(const options_ptr& current, const options_ptr& previous);
+
   static OptionController& get() {
     static auto inst = new OptionController();
     return *inst;
   }
 
-  int criteria() const noexcept { return criteria_; }
+  [[nodiscard]] options_ptr options() const noexcept { return std::atomic_load(&options_); }
 
+  // Publishes a copy of the current options changed by `func`
+  void update(const std::function<void(Options&)>& func);
 
-  void fetch() {
-//    protocol_.Get
+  // Parses `value` into the option named `key`. Returns false, changing nothing, if either is invalid
+  bool set(const std::string& key, const std::string& value);
+
+  // `key=value` lines. Empty lines and lines starting with '#' are skipped, and so are keys the server has set.
+  // Returns false if the file cannot be read; invalid lines are logged and skipped
+  bool load(const std::string& path);
+
+  // Labels `objects` may name, i.e. the model's labelmap. Until they are known, any label is accepted
+  void labels(const std::vector<std::string>& labels);
+
+  // Called after every publish, on the thread that published. Publishes are serialized until their
+  // listeners return, so listeners see the snapshots in order, and must not publish themselves
+  boost::signals2::connection subscribe(std::function<listener> func) {
+    return listener_.connect(std::move(func));
   }
 
+  // Subscribes every key to `source.subscribe(key, func)`, e.g. an AsyncVideoClient, so that settings
+  // changed on the server update the options. The source only passes on values the server answered with OK
+  template<typename Source>
+  std::vector<boost::signals2::scoped_connection> follow(Source& source) {
+    std::vector<boost::signals2::scoped_connection> connections;
+    for (const auto& key : keys()) {
+      connections.emplace_back(source.subscribe(key, [this, key](const std::string& value) {
+        publish({{key, value}}, Origin::kServer);
+      }));
+    }
+    return connections;
+  }
+
+  static std::vector<std::string> keys();
+
  private:
+  enum class Origin {
+    kLocal,
+    kServer,
+  };
+
   OptionController() = default;
 
-  float criteria_ = 0.5;
-  std::unordered_set<std::string> detect_obj_;
-  int max_fps_ = 60;
+  bool publish(const std::vector<std::pair<std::string, std::string>>& values, Origin origin);
 
-  std::string model_path_;
-  std::string labelmap_path_;
+  // Stores `current` and notifies listeners. write_m_ must be held
+  void store(options_ptr current);
 
-  Protocol protocol_;
+  options_ptr options_ = std::make_shared<const Options>();
+  std::mutex write_m_;
+  std::unordered_set<std::string> labels_;
+  std::unordered_set<std::string> server_keys_;
+  boost::signals2::signal<listener> listener_;
 };
 
 } // namespace watcher
@@ -0,0 +1,266 @@
+#include "watcher/trace/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace watcher {
+
+namespace {
+
+constexpr size_t kSpansPerThread = 4096; // Power of two
+constexpr size_t kMaxRings = 64;
+
+struct Span {
+  const char* name;
+  uint64_t frame;
+  int64_t start; // Nanoseconds of the steady clock
+  int64_t end;
+  int64_t tid;
+};
+
+int64_t CurrentThreadId() {
+#if __linux__
+  return static_cast<int64_t>(::syscall(SYS_gettid));
+#else
+  return static_cast<int64_t>(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+#endif
+}
+
+int64_t ProcessId() {
+#if __linux__
+  return static_cast<int64_t>(::getpid());
+#else
+  return 1;
+#endif
+}
+
+std::string ThreadName(int64_t tid) {
+#if __linux__
+  std::ifstream file("/proc/self/task/" + std::to_string(tid) + "/comm");
+  std::string name;
+  if (std::getline(file, name) && !name.empty())
+    return name;
+#endif
+  return "thread " + std::to_string(tid);
+}
+
+// Written by its thread only. Each slot is guarded by a sequence number like a seqlock,
+// so dump() can copy the ring while the thread keeps writing and skip the slots it overwrote meanwhile
+class SpanRing {
+ public:
+  SpanRing() : tid_(CurrentThreadId()), slots_(kSpansPerThread) {}
+
+  void push(const char* name, uint64_t frame, int64_t start, int64_t end) noexcept {
+    const auto index = head_.load(std::memory_order_relaxed);
+    auto& slot = slots_[index & (kSpansPerThread - 1)];
+
+    slot.seq.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.frame.store(frame, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.seq.store(index * 2 + 2, std::memory_order_release);
+
+    head_.store(index + 1, std::memory_order_release);
+  }
+
+  void copy(std::vector<Span>& out) const {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto first = head > kSpansPerThread ? head - kSpansPerThread : 0;
+
+    for (auto index = first; index < head; ++index) {
+      const auto& slot = slots_[index & (kSpansPerThread - 1)];
+      const auto seq = slot.seq.load(std::memory_order_acquire);
+      Span span{
+        slot.name.load(std::memory_order_relaxed),
+        slot.frame.load(std::memory_order_relaxed),
+        slot.start.load(std::memory_order_relaxed),
+        slot.end.load(std::memory_order_relaxed),
+        tid_,
+      };
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq != index * 2 + 2 || slot.seq.load(std::memory_order_relaxed) != seq)
+        continue;
+      out.push_back(span);
+    }
+  }
+
+  [[nodiscard]] int64_t tid() const noexcept { return tid_; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> frame{0};
+    std::atomic<int64_t> start{0};
+    std::atomic<int64_t> end{0};
+  };
+
+  int64_t tid_;
+  std::vector<Slot> slots_;
+  alignas(64) std::atomic<uint64_t> head_{0};
+};
+
+std::mutex rings_m;
+std::vector<std::shared_ptr<SpanRing>> rings;
+
+SpanRing& ThisThreadRing() {
+  thread_local std::shared_ptr<SpanRing> ring = []() {
+    auto r = std::make_shared<SpanRing>();
+    std::lock_guard lck(rings_m);
+    // Rings only referenced from here belong to threads that exited. Keep their spans while there is room
+    while (rings.size() >= kMaxRings) {
+      const auto it = std::find_if(rings.begin(), rings.end(), [](const auto& p) { return p.use_count() == 1; });
+      if (it == rings.end())
+        break;
+      rings.erase(it);
+    }
+    rings.emplace_back(r);
+    return r;
+  }();
+  return *ring;
+}
+
+int64_t Nanoseconds(Tracer::clock::time_point tp) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+
+void AppendEscaped(std::string& out, const std::string& value) {
+  for (const auto c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out += ' ';
+    } else {
+      out += c;
+    }
+  }
+}
+
+// Microseconds, the unit of the trace-event format
+void AppendTime(std::string& out, int64_t ns) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%lld.%03lld", static_cast<long long>(ns / 1000), static_cast<long long>(ns % 1000));
+  out += buf;
+}
+
+} // namespace
+
+Tracer& Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::record(const char* name, uint64_t frame, clock::time_point start, clock::time_point end) {
+  ThisThreadRing().push(name, frame, Nanoseconds(start), Nanoseconds(end));
+}
+
+std::string Tracer::dump() const {
+  std::vector<Span> spans;
+  std::vector<int64_t> tids;
+  {
+    std::lock_guard lck(rings_m);
+    for (const auto& ring : rings) {
+      ring->copy(spans);
+      tids.emplace_back(ring->tid());
+    }
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.start < b.start; });
+
+  const auto pid = std::to_string(ProcessId());
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  const auto begin_event = [&]() {
+    if (!first)
+      out += ",\n";
+    first = false;
+    out += "{\"pid\":" + pid + ",";
+  };
+
+  for (const auto tid : tids) {
+    begin_event();
+    out += "\"tid\":" + std::to_string(tid) + ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+    AppendEscaped(out, ThreadName(tid));
+    out += "\"}}";
+  }
+
+  struct FrameSpan {
+    int64_t start;
+    int64_t end;
+    std::vector<const Span*> spans;
+  };
+  std::unordered_map<uint64_t, FrameSpan> frames;
+
+  for (const auto& span : spans) {
+    begin_event();
+    out += "\"tid\":" + std::to_string(span.tid) + ",\"ph\":\"X\",\"cat\":\"stage\",\"name\":\"";
+    AppendEscaped(out, span.name);
+    out += "\",\"ts\":";
+    AppendTime(out, span.start);
+    out += ",\"dur\":";
+    AppendTime(out, span.end - span.start);
+    if (span.frame != 0) {
+      out += ",\"args\":{\"frame\":" + std::to_string(span.frame) + "}";
+      auto [it, inserted] = frames.try_emplace(span.frame, FrameSpan{span.start, span.end, {}});
+      it->second.start = std::min(it->second.start, span.start);
+      it->second.end = std::max(it->second.end, span.end);
+      it->second.spans.emplace_back(&span);
+    }
+    out += "}";
+  }
+
+  for (const auto& [frame, f] : frames) {
+    const auto id = std::to_string(frame);
+
+    // Glass to upload of the frame, on its own track
+    for (const auto& [phase, ts] : {std::make_pair("b", f.start), std::make_pair("e", f.end)}) {
+      begin_event();
+      out += "\"tid\":0,\"ph\":\"";
+      out += phase;
+      out += "\",\"cat\":\"frame\",\"name\":\"frame\",\"id\":" + id + ",\"ts\":";
+      AppendTime(out, ts);
+      out += ",\"args\":{\"frame\":" + id + "}}";
+    }
+
+    // Arrows from stage to stage, in the order they started
+    if (f.spans.size() < 2)
+      continue;
+    for (size_t i = 0; i < f.spans.size(); ++i) {
+      const auto* span = f.spans[i];
+      begin_event();
+      out += "\"tid\":" + std::to_string(span->tid) + ",\"ph\":\"";
+      out += i == 0 ? "s" : i + 1 == f.spans.size() ? "f\",\"bp\":\"e" : "t";
+      out += "\",\"cat\":\"flow\",\"name\":\"frame\",\"id\":" + id + ",\"ts\":";
+      AppendTime(out, span->start);
+      out += "}";
+    }
+  }
+
+  out += "\n]}\n";
+  return out;
+}
+
+bool Tracer::dump(const std::string& path) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << dump();
+  return static_cast<bool>(file);
+}
+
+} // namespace watcher
@@ -0,0 +1,88 @@
+#ifndef WATCHER_UTILITY_ALIGNED_BUFFER_H_
+#define WATCHER_UTILITY_ALIGNED_BUFFER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace watcher {
+
+// Growable byte buffer with aligned storage. Unlike std::string, reserve() allocates exactly once
+// and nothing is zero-filled, so a known-size download can be written in place.
+class AlignedBuffer {
+ public:
+  static constexpr size_t kAlignment = 64;
+
+  AlignedBuffer() = default;
+  explicit AlignedBuffer(size_t capacity) { reserve(capacity); }
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  AlignedBuffer(AlignedBuffer&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)) {}
+
+  AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+    if (this != &other) {
+      release();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      capacity_ = std::exchange(other.capacity_, 0);
+    }
+    return *this;
+  }
+
+  ~AlignedBuffer() { release(); }
+
+  void reserve(size_t new_capacity) {
+    if (new_capacity <= capacity_)
+      return;
+
+    auto new_data = static_cast<char*>(::operator new(new_capacity, std::align_val_t(kAlignment)));
+    if (size_ > 0)
+      std::memcpy(new_data, data_, size_);
+    release_storage();
+    data_ = new_data;
+    capacity_ = new_capacity;
+  }
+
+  void append(const char* src, size_t n) {
+    if (size_ + n > capacity_)
+      reserve(std::max(size_ + n, capacity_ * 2));
+    std::memcpy(data_ + size_, src, n);
+    size_ += n;
+  }
+
+  void clear() noexcept { size_ = 0; }
+
+  [[nodiscard]] char* data() noexcept { return data_; }
+  [[nodiscard]] const char* data() const noexcept { return data_; }
+  [[nodiscard]] size_t size() const noexcept { return size_; }
+  [[nodiscard]] size_t capacity() const noexcept { return capacity_; }
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+ private:
+  void release_storage() noexcept {
+    if (data_)
+      ::operator delete(data_, std::align_val_t(kAlignment));
+  }
+
+  void release() noexcept {
+    release_storage();
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+  char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_UTILITY_ALIGNED_BUFFER_H_
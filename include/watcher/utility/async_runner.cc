@@ -7,6 +7,8 @@
 #include <mutex>
 #include <thread>
 
+#include "watcher/utility/thread_name.h"
+
 namespace watcher {
 
 AsyncRunner::AsyncRunner(bool always_run, async_run run_mode)
@@ -33,6 +35,10 @@ void AsyncRunner::stop() {
   cv_.notify_all();
 }
 
+void AsyncRunner::name(const char* name) {
+  SetThreadName(thread_, name);
+}
+
 void AsyncRunner::RunAsync() {
   std::unique_lock lck(mutex_);
 
@@ -35,6 +35,9 @@ class AsyncRunner {
 
   void stop();
 
+  // Names the worker thread, for top -H and the per-thread CPU metrics
+  void name(const char* name);
+
  private:
   void RunAsync();
 
@@ -18,10 +18,10 @@ namespace watcher {
 
 template<typename ...Args>
 std::string format_string(const char* fmt, const Args&... val) {
-  std::string buffer(100, '\0');
   const auto size = std::snprintf(NULL, 0, fmt, val...);
-  std::snprintf(const_cast<char*>(buffer.data()), size, fmt, val...);
-  buffer.resize(size - 1);
+  std::string buffer(size + 1, '\0');
+  std::snprintf(buffer.data(), buffer.size(), fmt, val...);
+  buffer.resize(size);
   return buffer;
 }
 
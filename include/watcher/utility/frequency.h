@@ -2,12 +2,14 @@
 #define WATCHER_UTILITY_FREQUENCY_H_
 
 #include <chrono>
-#include <deque>
 #include <type_traits>
-#include <utility>
+
+#include "watcher/utility/window_stats.h"
 
 namespace watcher {
 
+// Counts ticks over the last `duration`. tick(), size() and freq() are thread-safe.
+// Only counts are kept; use WindowStats directly to also record values
 template<typename Duration = std::chrono::seconds,
   typename Clock = std::chrono::steady_clock,
   typename TimePoint = std::chrono::time_point<Clock>>
@@ -20,40 +22,38 @@ class Frequency {
   using time_point = TimePoint;
 
   Frequency()
-    : duration_(1) {}
+    : duration_(1), window_(duration_) {}
 
   explicit Frequency(const rep& r)
-    : duration_(r) {}
+    : duration_(r), window_(duration_) {}
 
   explicit Frequency(const duration& duration)
-    : duration_(duration) {}
+    : duration_(duration), window_(duration_) {}
 
   template<typename Rep, typename Period, template<typename, typename> class Duration2,
     std::enable_if_t<
       std::is_constructible<duration, Duration2<Rep, Period>>::value,
     int> = 0>
   explicit Frequency(const Duration2<Rep, Period>& d)
-    : duration_(d) {}
+    : duration_(d), window_(duration_) {}
 
   // record time
   void tick(time_point tp = clock::now()) {
-    emplace_back(std::move(tp));
+    window_.tick(tp);
   }
 
-  // return array size
+  // return the number of ticks in the window
   template<typename T = int>
   T size() const {
     static_assert(std::is_arithmetic<T>::value, "T must be arithmetic type");
-    return static_cast<T>(list_.size());
+    return static_cast<T>(window_.count());
   }
 
-  // get frequency
+  // get ticks per D
   template<typename T = int, typename D = duration>
   T freq() const {
     static_assert(std::is_arithmetic<T>::value, "T must be arithmetic type");
-    if (list_.empty())
-      return static_cast<T>(0);
-    return size<T>() / static_cast<T>(std::chrono::duration_cast<D>(duration_).count());
+    return static_cast<T>(window_.rate() * std::chrono::duration<double>(D(1)).count());
   }
 
   // utility: check if callees time gap has elapsed the duration
@@ -66,26 +66,14 @@ class Frequency {
     return false;
   }
 
- private:
-  template<typename Tp = time_point>
-  void emplace_back(Tp&& tp) {
-    list_.emplace_back(std::forward<Tp>(tp));
-    removeExpired();
-  }
+  using stats_type = WindowStats<clock, 10, false>;
 
-  // list_.empty() == false must be guaranteed
-  void removeExpired() {
-    const auto& last_t = list_.back();
+  // count and rate of the same window
+  [[nodiscard]] const stats_type& stats() const { return window_; }
 
-    auto it = list_.begin();
-    while (it != list_.end() && *it < (last_t - duration_)) {
-      ++it;
-    }
-    list_.erase(list_.begin(), it);
-  }
-
-  std::deque<time_point> list_;
+ private:
   duration duration_;
+  stats_type window_;
   mutable time_point timestamp_{};
 };
 
@@ -0,0 +1,351 @@
+#include "watcher/utility/logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "watcher/utility/thread_name.h"
+#include "watcher/utility/timestamp_formatter.h"
+
+namespace watcher {
+
+namespace {
+
+using system_clock = std::chrono::system_clock;
+
+constexpr size_t kRingSize = 64 * 1024; // Per thread. Power of two
+constexpr auto kPollInterval = std::chrono::milliseconds(2);
+
+struct RecordHeader {
+  uint32_t size;
+  LogLevel level;
+  int64_t time; // Nanoseconds since the epoch
+};
+
+// Single-producer single-consumer byte ring
+class LogRing {
+ public:
+  LogRing() : buffer_(kRingSize) {}
+
+  // Producer
+  bool push(const RecordHeader& header, const char* payload) noexcept {
+    const auto record_size = sizeof(header) + header.size;
+    const auto head = head_.load(std::memory_order_relaxed);
+    const auto tail = tail_.load(std::memory_order_acquire);
+    if (kRingSize - (head - tail) < record_size)
+      return false;
+
+    copy_in(head, reinterpret_cast<const char*>(&header), sizeof(header));
+    copy_in(head + sizeof(header), payload, header.size);
+    head_.store(head + record_size, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer
+  bool pop(RecordHeader& header, std::string& payload) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    const auto head = head_.load(std::memory_order_acquire);
+    if (head == tail)
+      return false;
+
+    copy_out(tail, reinterpret_cast<char*>(&header), sizeof(header));
+    payload.resize(header.size);
+    copy_out(tail + sizeof(header), payload.data(), header.size);
+    tail_.store(tail + sizeof(header) + header.size, std::memory_order_release);
+    return true;
+  }
+
+  [[nodiscard]] bool empty() const noexcept {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  void copy_in(size_t pos, const char* src, size_t size) noexcept {
+    const auto offset = pos & (kRingSize - 1);
+    const auto first = std::min(size, kRingSize - offset);
+    std::memcpy(buffer_.data() + offset, src, first);
+    std::memcpy(buffer_.data(), src + first, size - first);
+  }
+
+  void copy_out(size_t pos, char* dst, size_t size) const noexcept {
+    const auto offset = pos & (kRingSize - 1);
+    const auto first = std::min(size, kRingSize - offset);
+    std::memcpy(dst, buffer_.data() + offset, first);
+    std::memcpy(dst + first, buffer_.data(), size - first);
+  }
+
+  std::vector<char> buffer_;
+  alignas(64) std::atomic_size_t head_{0};
+  alignas(64) std::atomic_size_t tail_{0};
+};
+
+static_assert((kRingSize & (kRingSize - 1)) == 0);
+
+std::atomic<LogLevel> runtime_level{LogLevel::kDebug};
+
+// Set while the backend can take lines. Lines logged during static destruction are written directly
+std::atomic_bool backend_alive{false};
+
+class LogBackend {
+ public:
+  static LogBackend& instance() {
+    static LogBackend backend;
+    return backend;
+  }
+
+  ~LogBackend() {
+    backend_alive = false;
+    {
+      std::lock_guard lck(m_);
+      running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  LogRing& ring() {
+    thread_local std::shared_ptr<LogRing> ring = [this]() {
+      auto r = std::make_shared<LogRing>();
+      std::lock_guard lck(m_);
+      rings_.emplace_back(r);
+      return r;
+    }();
+    return *ring;
+  }
+
+  void dropped() noexcept { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+  void flush() {
+    std::unique_lock lck(m_);
+    const auto target = ++flush_requested_;
+    cv_.notify_all();
+    flushed_cv_.wait(lck, [&]() { return flushed_ >= target || !running_; });
+  }
+
+  Log_t::Stats stats() const {
+    Log_t::Stats s;
+    s.lines = lines_;
+    s.dropped = dropped_;
+    s.bytes = bytes_;
+    s.lines_per_sec = lines_per_sec_;
+    return s;
+  }
+
+  static void Format(std::ostream& os, const std::string& payload) {
+    const char* pos = payload.data();
+    const char* const end = pos + payload.size();
+
+    const auto get = [&](auto& value) {
+      std::memcpy(&value, pos, sizeof(value));
+      pos += sizeof(value);
+    };
+
+    while (pos < end) {
+      const auto type = static_cast<detail::LogArg>(*pos++);
+      switch (type) {
+        case detail::LogArg::kBool: { bool v; get(v); os << v; break; }
+        case detail::LogArg::kChar: { char v; get(v); os << v; break; }
+        case detail::LogArg::kInt: { int64_t v; get(v); os << v; break; }
+        case detail::LogArg::kUInt: { uint64_t v; get(v); os << v; break; }
+        case detail::LogArg::kDouble: { double v; get(v); os << v; break; }
+        case detail::LogArg::kString: {
+          uint32_t size;
+          get(size);
+          os.write(pos, size);
+          pos += size;
+          break;
+        }
+        case detail::LogArg::kPointer: { uintptr_t v; get(v); os << reinterpret_cast<const void*>(v); break; }
+      }
+    }
+  }
+
+  static system_clock::time_point TimePoint(int64_t time) {
+    return system_clock::time_point(std::chrono::duration_cast<system_clock::duration>(std::chrono::nanoseconds(time)));
+  }
+
+ private:
+  struct Line {
+    int64_t time;
+    bool error;
+    std::string text;
+  };
+
+  LogBackend() : thread_([this]() { run(); }) {
+    SetThreadName(thread_, "logger");
+    backend_alive = true;
+  }
+
+  void run() {
+    auto last_rate = std::chrono::steady_clock::now();
+    uint64_t last_lines = 0;
+
+    for (;;) {
+      uint64_t generation;
+      bool running;
+      {
+        std::unique_lock lck(m_);
+        cv_.wait_for(lck, kPollInterval, [&]() { return flush_requested_ > flushed_ || !running_; });
+        generation = flush_requested_;
+        running = running_;
+      }
+
+      drain();
+
+      {
+        std::lock_guard lck(m_);
+        flushed_ = generation;
+      }
+      flushed_cv_.notify_all();
+
+      const auto now = std::chrono::steady_clock::now();
+      if (const auto elapsed = std::chrono::duration<double>(now - last_rate).count(); elapsed >= 1) {
+        const uint64_t lines = lines_;
+        lines_per_sec_ = (lines - last_lines) / elapsed;
+        last_lines = lines;
+        last_rate = now;
+      }
+
+      if (!running)
+        break;
+    }
+  }
+
+  // Lines of all threads are merged by time before being written
+  void drain() {
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+      std::lock_guard lck(m_);
+      // A ring only referenced from here belongs to a thread that exited
+      rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const auto& r) {
+        return r.use_count() == 1 && r->empty();
+      }), rings_.end());
+      rings = rings_;
+    }
+
+    lines_buffer_.clear();
+    RecordHeader header{};
+    for (const auto& ring : rings) {
+      while (ring->pop(header, payload_)) {
+        ss_.str({});
+        ss_ << timestamp_.format(TimePoint(header.time), timestamp_buffer_) << " | ";
+        Format(ss_, payload_);
+        ss_ << '\n';
+        lines_buffer_.push_back({header.time, header.level >= LogLevel::kWarning, ss_.str()});
+      }
+    }
+    if (lines_buffer_.empty())
+      return;
+
+    std::stable_sort(lines_buffer_.begin(), lines_buffer_.end(), [](const Line& a, const Line& b) {
+      return a.time < b.time;
+    });
+
+    out_.clear();
+    err_.clear();
+    size_t bytes = 0;
+    for (const auto& line : lines_buffer_) {
+      (line.error ? err_ : out_) += line.text;
+      bytes += line.text.size();
+    }
+
+    // The only place that may block on the output
+    if (!out_.empty())
+      std::cout.write(out_.data(), static_cast<std::streamsize>(out_.size())).flush();
+    if (!err_.empty())
+      std::cerr.write(err_.data(), static_cast<std::streamsize>(err_.size())).flush();
+
+    lines_ += lines_buffer_.size();
+    bytes_ += bytes;
+  }
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::condition_variable flushed_cv_;
+  bool running_ = true;
+  uint64_t flush_requested_ = 0;
+  uint64_t flushed_ = 0;
+  std::vector<std::shared_ptr<LogRing>> rings_;
+
+  // Logging thread only
+  std::string payload_;
+  std::ostringstream ss_;
+  TimestampFormatter timestamp_{std::chrono::hours(9)};
+  char timestamp_buffer_[TimestampFormatter::kBufferSize];
+  std::vector<Line> lines_buffer_;
+  std::string out_;
+  std::string err_;
+
+  std::atomic<uint64_t> lines_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<double> lines_per_sec_{0};
+
+  std::thread thread_;
+};
+
+} // namespace
+
+namespace detail {
+
+bool LogEnabled(LogLevel level) noexcept {
+  return level >= runtime_level.load(std::memory_order_relaxed);
+}
+
+std::string& LogScratch() {
+  thread_local std::string buf;
+  return buf;
+}
+
+void LogSubmit(LogLevel level, const std::string& encoded) {
+  const RecordHeader header{
+    static_cast<uint32_t>(encoded.size()),
+    level,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(system_clock::now().time_since_epoch()).count(),
+  };
+
+  auto& backend = LogBackend::instance();
+  if (!backend_alive) {
+    char timestamp[TimestampFormatter::kBufferSize];
+    std::ostringstream ss;
+    ss << TimestampFormatter(std::chrono::hours(9)).format(LogBackend::TimePoint(header.time), timestamp) << " | ";
+    LogBackend::Format(ss, encoded);
+    ss << '\n';
+    (level >= LogLevel::kWarning ? std::cerr : std::cout) << ss.str();
+    return;
+  }
+
+  if (sizeof(header) + encoded.size() > kRingSize || !backend.ring().push(header, encoded.data()))
+    backend.dropped();
+}
+
+} // namespace detail
+
+void Log_t::level(LogLevel level) const {
+  runtime_level = level;
+}
+
+LogLevel Log_t::level() const {
+  return runtime_level;
+}
+
+Log_t::Stats Log_t::stats() const {
+  return LogBackend::instance().stats();
+}
+
+void Log_t::flush() const {
+  LogBackend::instance().flush();
+}
+
+} // namespace watcher
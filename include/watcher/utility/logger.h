@@ -5,29 +5,132 @@
 #ifndef WATCHER_UTILITY_LOGGER_H_
 #define WATCHER_UTILITY_LOGGER_H_
 
-#include <chrono>
-#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
-#include "watcher/utility/date_time.h"
+// Lines below this level are compiled out: 0 debug, 1 info, 2 warning, 3 error, 4 nothing
+#ifndef WATCHER_LOG_LEVEL
+#define WATCHER_LOG_LEVEL 0
+#endif
 
 namespace watcher {
 
+enum class LogLevel : uint8_t {
+  kDebug,
+  kInfo,
+  kWarning,
+  kError,
+  kOff,
+};
+
+namespace detail {
+
+enum class LogArg : uint8_t {
+  kBool,
+  kChar,
+  kInt,
+  kUInt,
+  kDouble,
+  kString,
+  kPointer,
+};
+
+bool LogEnabled(LogLevel level) noexcept;
+
+// Per-thread buffer the arguments of one line are encoded into
+std::string& LogScratch();
+
+// Copies the encoded line to this thread's ring. Never blocks; the line is dropped if the ring is full
+void LogSubmit(LogLevel level, const std::string& encoded);
+
+template<typename T>
+void LogPut(std::string& buf, LogArg type, const T& value) {
+  buf.push_back(static_cast<char>(type));
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Arguments are stored as tagged binary values and formatted later on the logging thread.
+// Types without a binary form are formatted here with operator<<
+template<typename T>
+void LogEncode(std::string& buf, const T& value) {
+  using U = std::decay_t<T>;
+
+  if constexpr (std::is_same_v<U, bool>) {
+    LogPut(buf, LogArg::kBool, value);
+  } else if constexpr (std::is_same_v<U, char> || std::is_same_v<U, signed char> || std::is_same_v<U, unsigned char>) {
+    LogPut(buf, LogArg::kChar, static_cast<char>(value));
+  } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+    LogPut(buf, LogArg::kInt, static_cast<int64_t>(value));
+  } else if constexpr (std::is_integral_v<U>) {
+    LogPut(buf, LogArg::kUInt, static_cast<uint64_t>(value));
+  } else if constexpr (std::is_floating_point_v<U>) {
+    LogPut(buf, LogArg::kDouble, static_cast<double>(value));
+  } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    const std::string_view s = value;
+    LogPut(buf, LogArg::kString, static_cast<uint32_t>(s.size()));
+    buf.append(s.data(), s.size());
+  } else if constexpr (std::is_pointer_v<U>) {
+    LogPut(buf, LogArg::kPointer, reinterpret_cast<uintptr_t>(value));
+  } else {
+    thread_local std::ostringstream ss;
+    ss.str({});
+    ss << value;
+    LogEncode(buf, ss.str());
+  }
+}
+
+} // namespace detail
+
+// Asynchronous logger. A call encodes its arguments into a lock-free ring owned by the calling thread,
+// and a background thread formats and writes the lines, so logging never waits for stdout.
+// Debug and info lines go to stdout, warnings and errors to stderr.
+//
+// Levels below WATCHER_LOG_LEVEL cost nothing; levels below level() cost one atomic load.
+// When a thread logs faster than the lines can be written, new lines are dropped and counted.
 class Log_t {
  public:
+  struct Stats {
+    uint64_t lines = 0;       // Written so far
+    uint64_t dropped = 0;     // Lost to full rings
+    uint64_t bytes = 0;       // Written so far
+    double lines_per_sec = 0; // Over the last second
+  };
+
   constexpr Log_t() = default;
 
-  template<typename ...Args> void d(const Args&... args) const { write(std::cout, args...); }
-  template<typename ...Args> void e(const Args&... args) const { write(std::cerr, args...); }
+  template<typename ...Args> void d(const Args&... args) const { write<LogLevel::kDebug>(args...); }
+  template<typename ...Args> void i(const Args&... args) const { write<LogLevel::kInfo>(args...); }
+  template<typename ...Args> void w(const Args&... args) const { write<LogLevel::kWarning>(args...); }
+  template<typename ...Args> void e(const Args&... args) const { write<LogLevel::kError>(args...); }
+
+  // Runtime level. Lines below it are discarded before being encoded
+  void level(LogLevel level) const;
+  [[nodiscard]] LogLevel level() const;
+
+  [[nodiscard]] Stats stats() const;
+
+  // Blocks until every line logged before the call is written
+  void flush() const;
 
  private:
-  template<typename OStream, typename ...Args>
-  static void write(OStream& os, const Args&... args) {
-    std::stringstream ss;
-    ss << DateTime<>::now(std::chrono::hours(9)).to_string() << " | ";
-    (ss << ... << args);
-    ss << '\n';
-    os << ss.str();
+  template<LogLevel level, typename ...Args>
+  static void write(const Args&... args) {
+    if constexpr (static_cast<int>(level) >= WATCHER_LOG_LEVEL) {
+      if (!detail::LogEnabled(level))
+        return;
+
+      auto& buf = detail::LogScratch();
+      buf.clear();
+      (detail::LogEncode(buf, args), ...);
+      detail::LogSubmit(level, buf);
+    } else {
+      ((void)args, ...);
+    }
   }
 };
 
@@ -26,17 +26,17 @@ class RingBuffer {
   >
   store(U&&... args) {
     std::lock_guard lck(m_);
-    container_.emplace(container_.begin() + next(), value_type(std::forward<U>(args)...));
+    container_[next()].emplace(std::forward<U>(args)...);
   }
 
   void store(std::nullopt_t) {
     std::lock_guard lck(m_);
-    container_.emplace(container_.begin() + next(), std::nullopt);
+    container_[next()] = std::nullopt;
   }
 
   void store(std::optional<value_type> o) {
     std::lock_guard lck(m_);
-    container_.emplace(container_.begin() + next(), std::move(o));
+    container_[next()] = std::move(o);
   }
 
   std::optional<const value_type> load() const {
@@ -0,0 +1,28 @@
+#ifndef WATCHER_UTILITY_THREAD_NAME_H_
+#define WATCHER_UTILITY_THREAD_NAME_H_
+
+#include <cstring>
+#include <thread>
+
+#if __linux__
+#include <pthread.h>
+#endif
+
+namespace watcher {
+
+// Shows up in top -H, /proc/<pid>/task/*/comm and the per-thread CPU metrics.
+// Linux keeps at most 15 characters
+inline void SetThreadName(std::thread& thread, const char* name) {
+#if __linux__
+  char buf[16] = {};
+  std::strncpy(buf, name, sizeof(buf) - 1);
+  pthread_setname_np(thread.native_handle(), buf);
+#else
+  (void)thread;
+  (void)name;
+#endif
+}
+
+} // namespace watcher
+
+#endif // WATCHER_UTILITY_THREAD_NAME_H_
@@ -0,0 +1,83 @@
+#ifndef WATCHER_UTILITY_TIMESTAMP_FORMATTER_H_
+#define WATCHER_UTILITY_TIMESTAMP_FORMATTER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+#include "watcher/utility/date_time.h"
+
+namespace watcher {
+
+// Formats time points like DateTime<>::to_string() with its default format, `YYYY-MM-DD-HH:MM:SS:mmm`,
+// into a caller's buffer without allocating.
+//
+// The date and `HH:MM:SS` are formatted once per second and cached; within the same second only the
+// milliseconds are rewritten. Not thread-safe: use one per thread.
+class TimestampFormatter {
+ public:
+  using clock = std::chrono::system_clock;
+
+  static constexpr size_t kLength = 23;
+  static constexpr size_t kBufferSize = kLength + 1; // With the terminating NUL
+
+  explicit TimestampFormatter(clock::duration time_zone = std::chrono::hours(0)) : time_zone_(time_zone) {}
+
+  // Writes kLength characters and a NUL to `dst`, which must hold kBufferSize bytes
+  std::string_view format(clock::time_point tp, char* dst) noexcept {
+    const auto local = tp.time_since_epoch() + time_zone_;
+    const auto second = std::chrono::floor<std::chrono::seconds>(local);
+    if (second.count() != cached_second_)
+      update(tp, second);
+
+    const auto ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(local - second).count());
+    std::memcpy(dst, cached_, kBufferSize);
+    put(dst + 20, ms, 3);
+    return {dst, kLength};
+  }
+
+  std::string_view format(char* dst) noexcept { return format(clock::now(), dst); }
+
+ private:
+  using days = std::chrono::duration<int64_t, std::ratio<86400>>;
+
+  void update(clock::time_point tp, std::chrono::seconds second) noexcept {
+    const auto [y, m, d] = DateTime<>(tp, time_zone_).ymd();
+    const auto seconds_of_day = static_cast<int>((second - std::chrono::floor<days>(second)).count());
+
+    put(cached_, y, 4);
+    cached_[4] = '-';
+    put(cached_ + 5, static_cast<int>(m), 2);
+    cached_[7] = '-';
+    put(cached_ + 8, static_cast<int>(d), 2);
+    cached_[10] = '-';
+    put(cached_ + 11, seconds_of_day / 3600, 2);
+    cached_[13] = ':';
+    put(cached_ + 14, seconds_of_day / 60 % 60, 2);
+    cached_[16] = ':';
+    put(cached_ + 17, seconds_of_day % 60, 2);
+    cached_[19] = ':';
+    cached_[kLength] = '\0';
+
+    cached_second_ = second.count();
+  }
+
+  // Zero-padded to `width` digits
+  static void put(char* dst, int value, int width) noexcept {
+    for (int i = width - 1; i >= 0; --i) {
+      dst[i] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+  }
+
+  clock::duration time_zone_;
+  int64_t cached_second_ = std::numeric_limits<int64_t>::min();
+  char cached_[kBufferSize] = {};
+};
+
+} // namespace watcher
+
+#endif // WATCHER_UTILITY_TIMESTAMP_FORMATTER_H_
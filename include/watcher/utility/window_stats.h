@@ -0,0 +1,243 @@
+#ifndef WATCHER_UTILITY_WINDOW_STATS_H_
+#define WATCHER_UTILITY_WINDOW_STATS_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+
+namespace watcher {
+
+// Event rate and value distribution over a sliding time window.
+//
+// The window is split into `Buckets` slots kept in a fixed ring. Each slot holds a count, a sum and a
+// log-scale histogram (8 bins per power of two, so percentiles are within ~6% of the true value).
+// Recording a sample is O(1) and never allocates; a slot is cleared when the ring wraps around to it.
+// Samples older than the window, relative to the newest one recorded, are dropped.
+// All members are thread-safe.
+//
+// Values are in whatever unit the caller records, e.g. milliseconds for latencies.
+// With `Values` false only events are counted: add() is unavailable and the slots carry no histogram.
+template<typename Clock = std::chrono::steady_clock, size_t Buckets = 10, bool Values = true>
+class WindowStats {
+ public:
+  using clock = Clock;
+  using duration = typename clock::duration;
+  using time_point = typename clock::time_point;
+
+  struct Snapshot {
+    uint64_t count = 0; // Events in the window
+    double rate = 0;    // Events per second
+    // Over the events recorded with a value
+    uint64_t samples = 0;
+    double mean = 0;
+    double min = 0;
+    double max = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+  };
+
+  explicit WindowStats(duration window = std::chrono::seconds(1), time_point now = clock::now())
+    : width_(std::max<duration>(window / static_cast<typename duration::rep>(Buckets), duration(1))),
+      start_(now) {}
+
+  // Records an event without a value; counts towards the rate only
+  void tick(time_point tp = clock::now()) {
+    std::lock_guard lck(m_);
+    if (auto* b = bucket(tp))
+      ++b->count;
+  }
+
+  // Records an event with a value
+  void add(double value, time_point tp = clock::now()) {
+    static_assert(Values, "add() needs a WindowStats that records values");
+    std::lock_guard lck(m_);
+    auto* b = bucket(tp);
+    if (b == nullptr)
+      return;
+    ++b->count;
+    ++b->samples;
+    b->sum += value;
+    b->min = std::min(b->min, value);
+    b->max = std::max(b->max, value);
+    ++b->bins[BinOf(value)];
+  }
+
+  [[nodiscard]] uint64_t count(time_point now = clock::now()) const {
+    std::lock_guard lck(m_);
+    uint64_t n = 0;
+    for_each_live(now, [&](const Bucket& b) { n += b.count; });
+    return n;
+  }
+
+  // Events per second
+  [[nodiscard]] double rate(time_point now = clock::now()) const {
+    return rate(count(now), now);
+  }
+
+  [[nodiscard]] Snapshot snapshot(time_point now = clock::now()) const {
+    Snapshot s;
+    std::array<uint64_t, kBins> bins{};
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    {
+      std::lock_guard lck(m_);
+      for_each_live(now, [&](const Bucket& b) {
+        s.count += b.count;
+        if constexpr (Values) {
+          if (b.samples == 0)
+            return;
+          s.samples += b.samples;
+          sum += b.sum;
+          min = std::min(min, b.min);
+          max = std::max(max, b.max);
+          for (size_t i = 0; i < kBins; ++i)
+            bins[i] += b.bins[i];
+        }
+      });
+    }
+
+    s.rate = rate(s.count, now);
+    if (s.samples == 0)
+      return s;
+
+    s.mean = sum / static_cast<double>(s.samples);
+    s.min = min;
+    s.max = max;
+    s.p50 = Percentile(bins, s.samples, 0.50, min, max);
+    s.p95 = Percentile(bins, s.samples, 0.95, min, max);
+    s.p99 = Percentile(bins, s.samples, 0.99, min, max);
+    return s;
+  }
+
+  void clear(time_point now = clock::now()) {
+    std::lock_guard lck(m_);
+    for (auto& b : buckets_)
+      b.index = kNoIndex;
+    latest_ = kNoIndex;
+    start_ = now;
+  }
+
+  [[nodiscard]] duration window() const { return width_ * static_cast<typename duration::rep>(Buckets); }
+
+ private:
+  static_assert(Buckets >= 2, "WindowStats needs at least two buckets");
+
+  // Bins cover [2^kMinExp, 2^kMaxExp); the first and the last also take everything below and above
+  static constexpr int kSubBins = 8;
+  static constexpr int kMinExp = -16;
+  static constexpr int kMaxExp = 32;
+  static constexpr size_t kBins = (kMaxExp - kMinExp) * kSubBins + 2;
+  static constexpr int64_t kNoIndex = std::numeric_limits<int64_t>::min();
+
+  struct CountBucket {
+    int64_t index = kNoIndex;
+    uint64_t count = 0;
+  };
+
+  struct ValueBucket {
+    int64_t index = kNoIndex;
+    uint64_t count = 0;
+    uint64_t samples = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    std::array<uint32_t, kBins> bins{};
+  };
+
+  using Bucket = std::conditional_t<Values, ValueBucket, CountBucket>;
+
+  static size_t BinOf(double value) noexcept {
+    if (!(value > 0))
+      return 0;
+    int exp;
+    const double mantissa = std::frexp(value, &exp); // value = mantissa * 2^exp, mantissa in [0.5, 1)
+    if (exp <= kMinExp)
+      return 0;
+    if (exp > kMaxExp)
+      return kBins - 1;
+    const auto sub = std::min(static_cast<int>((mantissa - 0.5) * 2 * kSubBins), kSubBins - 1);
+    return 1 + static_cast<size_t>((exp - kMinExp - 1) * kSubBins + sub);
+  }
+
+  // Midpoint of the bin
+  static double ValueOf(size_t bin) noexcept {
+    if (bin == 0)
+      return std::ldexp(0.5, kMinExp + 1);
+    if (bin == kBins - 1)
+      return std::ldexp(1.0, kMaxExp);
+    const auto i = static_cast<int>(bin - 1);
+    const int exp = kMinExp + 1 + i / kSubBins;
+    const double mantissa = 0.5 + (i % kSubBins + 0.5) / (2 * kSubBins);
+    return std::ldexp(mantissa, exp);
+  }
+
+  static double Percentile(const std::array<uint64_t, kBins>& bins, uint64_t total, double q,
+                           double min, double max) noexcept {
+    const auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBins; ++i) {
+      seen += bins[i];
+      if (seen >= std::max<uint64_t>(rank, 1))
+        return std::clamp(ValueOf(i), min, max);
+    }
+    return max;
+  }
+
+  int64_t index_of(time_point tp) const noexcept {
+    return static_cast<int64_t>(tp.time_since_epoch() / width_);
+  }
+
+  // nullptr if `tp` is already out of the window; its slot may hold live data of a later pass
+  Bucket* bucket(time_point tp) {
+    const auto index = index_of(tp);
+    if (latest_ != kNoIndex && index <= latest_ - static_cast<int64_t>(Buckets))
+      return nullptr;
+    latest_ = std::max(latest_, index);
+    auto& b = buckets_[static_cast<size_t>(index % static_cast<int64_t>(Buckets))];
+    if (b.index != index) {
+      b = Bucket{};
+      b.index = index;
+    }
+    return &b;
+  }
+
+  // Buckets of the last `Buckets` slots, the current one included
+  template<typename F>
+  void for_each_live(time_point now, F&& func) const {
+    const auto current = index_of(now);
+    for (const auto& b : buckets_) {
+      if (b.index != kNoIndex && b.index <= current && b.index > current - static_cast<int64_t>(Buckets))
+        func(b);
+    }
+  }
+
+  // The window ends partway into the current slot, and is shorter before it has been filled once
+  double rate(uint64_t count, time_point now) const {
+    const auto current_start = time_point(width_ * index_of(now));
+    auto covered = width_ * static_cast<typename duration::rep>(Buckets - 1) + (now - current_start);
+    {
+      std::lock_guard lck(m_);
+      covered = std::min<duration>(covered, now - start_);
+    }
+    const auto seconds = std::chrono::duration<double>(covered).count();
+    return seconds > 0 ? static_cast<double>(count) / seconds : 0;
+  }
+
+  duration width_;
+  time_point start_;
+  std::array<Bucket, Buckets> buckets_{};
+  int64_t latest_ = kNoIndex;
+  mutable std::mutex m_;
+};
+
+} // namespace watcher
+
+#endif // WATCHER_UTILITY_WINDOW_STATS_H_
@@ -1,8 +1,17 @@
 #include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <utility>
 #include <vector>
 
 # ifdef __APPLE__
@@ -15,8 +24,19 @@
 #include "watcher/detector/movement_detector.h"
 #include "watcher/detector/object_detection_model.h"
 #include "watcher/drawable/drawable.h"
+#include "watcher/metrics/metrics_exporter.h"
+#include "watcher/metrics/process_metrics.h"
 #include "watcher/network/async_video_client.h"
+#include "watcher/network/overlay.h"
+#include "watcher/network/protocol.h"
+#include "watcher/network/tcp_client.h"
+#include "watcher/offline/offline_runner.h"
+#include "watcher/option_controller.h"
+#include "watcher/trace/trace.h"
+#include "watcher/utility/aligned_buffer.h"
 #include "watcher/utility/date_time.h"
+#include "watcher/utility/logger.h"
+#include "watcher/utility/timestamp_formatter.h"
 
 #if __linux__
 constexpr auto kPWD = "/home/pi/embeded_system";
@@ -24,6 +44,14 @@ constexpr auto kPWD = "/home/pi/embeded_system";
 constexpr auto kPWD = "/Users/yonggyulee/CLionProjects/embed";
 #endif
 
+// Set by SIGUSR1. The main loop then dumps the trace
+std::atomic<bool> trace_dump_requested{false};
+
+// Set by SIGHUP. The main loop then reloads the options file
+std::atomic<bool> options_reload_requested{false};
+
+constexpr auto kOptionsFile = "watcher.conf";
+
 enum Key {
   kLEFT = 2,
   kRIGHT = 3,
@@ -32,8 +60,9 @@ enum Key {
   kSPACE = 32,
 };
 
-std::optional<std::pair<std::string, std::string>> load_model_data(std::string url, std::string port) {
-  std::string model_buffer;
+std::optional<std::pair<std::shared_ptr<const watcher::AlignedBuffer>, std::string>>
+load_model_data(std::string url, std::string port) {
+  auto model_buffer = std::make_shared<watcher::AlignedBuffer>();
   std::string labelmap_buffer;
 
   watcher::TcpClient client(url, port);
@@ -51,20 +80,17 @@ std::optional<std::pair<std::string, std::string>> load_model_data(std::string u
   };
 
   for (;;) {
-    auto response = retry_get(3000, [&]() {
-      return protocol.Get(client, "model/model.tflite");
-//      return protocol.Get(client, "model/ssd_mobilenet_v1_1_metadata_1.tflite");
-//      return protocol.Get(client, "model/yolov4-416-fp16.tflite");
+    const auto received = retry_get(3000, [&]() {
+      return protocol.GetInto(client, "model/model.tflite", *model_buffer);
+//      return protocol.GetInto(client, "model/ssd_mobilenet_v1_1_metadata_1.tflite", *model_buffer);
+//      return protocol.GetInto(client, "model/yolov4-416-fp16.tflite", *model_buffer);
     });
 
-    auto it = response.find("data");
-    if (it == response.end()) {
+    if (!received) {
       watcher::Log.d("Failed to load model");
       std::this_thread::sleep_for(std::chrono::seconds(3));
       continue;
     }
-
-    model_buffer = std::move(it->second);
     break;
   }
 
@@ -89,22 +115,30 @@ std::optional<std::pair<std::string, std::string>> load_model_data(std::string u
   return std::make_pair(std::move(model_buffer), std::move(labelmap_buffer));
 }
 
-std::string remove_trailing(const std::string& s) {
-  std::string r = s;
-  if (!r.empty() &&
-    (r[r.size() - 1] == '\r' || r[r.size() - 1] == '\n' ||
-      r[r.size() - 1] == ' ' || r[r.size() - 1] == '\t' ||
-      r[r.size() - 1] == '\0'))
-    r.erase(r.size() - 1);
+// The gate model is optional. Try once, and run without the cascade if the server doesn't have one
+std::string load_gate_model_data(std::string url, std::string port) {
+  try {
+    watcher::TcpClient client(url, port);
+    watcher::Protocol protocol;
+
+    auto response = protocol.Get(client, "model/gate.tflite");
+    if (auto it = response.find("data"); it != response.end()) {
+      return std::move(it->second);
+    }
+  } catch (const std::exception& e) {
+    watcher::Log.e(e.what());
+  }
 
-  return std::move(r);
+  watcher::Log.d("Gate model is not available. Running without the cascade");
+  return {};
 }
 
 bool run(const std::string& url, const std::string& port) {
   cv::Mat view;
-  watcher::RingBuffer<cv::Mat> frames;
+  watcher::RingBuffer<std::pair<cv::Mat, uint64_t>> frames;
   std::atomic<bool> updated{false};
   cv::Mat frame;
+  uint64_t frame_id = 0;
   cv::Mat frame_prev;
   watcher::AsyncCameraController camera;
   camera.open();
@@ -118,15 +152,12 @@ bool run(const std::string& url, const std::string& port) {
     return EXIT_FAILURE;
 
   watcher::MovementDetector detector;
-  detector.LoadModelFromBuffer(model_data->first.data(), model_data->first.size(),
+  detector.LoadModelFromBuffer(model_data->first,
                                model_data->second.data(), model_data->second.size());
 
-  std::mutex inference_result_m;
-  watcher::MovementDetector::result_or_not inference_result;
-  boost::signals2::scoped_connection conn_detector = detector.add_listener([&](const auto& result) {
-    std::lock_guard lck(inference_result_m);
-    inference_result = result;
-  });
+  const auto gate_model_data = load_gate_model_data(url, port);
+  if (!gate_model_data.empty())
+    detector.LoadGateModelFromBuffer(gate_model_data.data(), gate_model_data.size());
 
 //  AsyncObjectDetector model_runner;
 //  model_runner.model().loadFromBuffer(model_data->first.data(), model_data->first.size(),
@@ -135,35 +166,49 @@ bool run(const std::string& url, const std::string& port) {
   std::atomic<bool> restart{false};
 
   watcher::AsyncVideoClient video_client(url, port);
-  boost::signals2::scoped_connection conn_g = video_client.AddGetListener([&](auto response) {
-    auto it = response.find("data");
-    if (it == response.end()) {
-      return;
+  // Opt-in, as it writes to the SD card whenever the link falls behind
+  if (const char* spool = std::getenv("WATCHER_SPOOL"); spool && *spool) {
+    try {
+      video_client.spool(spool);
+    } catch (const std::exception& e) {
+      watcher::Log.e(e.what(), ". Uploading without a spool");
     }
-    const auto r = remove_trailing(it->second);
+  }
+
+  boost::signals2::scoped_connection conn_g = video_client.subscribe("restart", [&](const std::string& r) {
     watcher::Log.d("Loaded option settings/restart : ", r);
 
     restart = (r == "1");
-  }, "settings/restart");
-
-  boost::signals2::scoped_connection conn_s = video_client.AddGetListener([&](auto response) {
-    auto it = response.find("data");
-    if (it == response.end()) {
-      return;
-    }
-    const auto r = remove_trailing(it->second);
-
-    try {
-      const auto s = std::stof(r);
-      if (0 <= s && s <= 1)
-        detector.score_threshold(s);
-    } catch (...) {}
+  });
 
-  }, "settings/score");
+  // Settings changed on the server update the options. Components that keep their own copy of an option
+  // get it here; the detector and the loop below read the snapshot directly
+  auto& option_controller = watcher::OptionController::get();
+  const auto option_connections = option_controller.follow(video_client);
+  const auto apply_options = [&](const watcher::OptionController::options_ptr& options,
+                                 const watcher::OptionController::options_ptr& previous) {
+    video_client.rate_controller()
+      .quality_range(std::min(40, options->quality), options->quality)
+      .bandwidth_cap(options->bandwidth_kbps * 1000 / 8)
+      .fps_range(1, options->max_fps)
+      .scale_range(0.25, options->max_scale);
+    video_client.upload_mode(options->event_upload ?
+      watcher::AsyncVideoClient::UploadMode::kEvent :
+      watcher::AsyncVideoClient::UploadMode::kContinuous);
+    if (!previous || options->trace != previous->trace)
+      watcher::Tracer::instance().enable(options->trace);
+    if (!previous || options->log_level != previous->log_level)
+      watcher::Log.level(options->log_level);
+  };
+  boost::signals2::scoped_connection conn_options = option_controller.subscribe(apply_options);
+  apply_options(option_controller.options(), nullptr);
 
   bool stop = false;
   bool pause = false;
 
+  watcher::TimestampFormatter timestamp(std::chrono::hours(9));
+  char timestamp_buffer[watcher::TimestampFormatter::kBufferSize];
+
   const double scale = 1;
 
   watcher::Text text_fps = watcher::Text()
@@ -186,10 +231,11 @@ bool run(const std::string& url, const std::string& port) {
     .font_face(cv::FONT_HERSHEY_DUPLEX)
     .font_scale(scale * 0.5)
     .thickness(1)
-    .line_type(cv::LINE_AA);
+    .line_type(cv::LINE_AA)
+    .cached(false); // Changes on every frame
 
-  const auto run_detection = [&] (cv::Mat image) {
-    frames.store(std::move(image));
+  const auto run_detection = [&] (cv::Mat image, uint64_t id) {
+    frames.store(std::move(image), id);
     updated = true;
 //    frame = std::move(image);
   };
@@ -204,6 +250,23 @@ bool run(const std::string& url, const std::string& port) {
     if (restart)
       return true;
 
+    if (options_reload_requested.exchange(false)) {
+      if (option_controller.load(kOptionsFile))
+        watcher::Log.i("Reloaded ", kOptionsFile);
+    }
+
+    if (trace_dump_requested.exchange(false)) {
+      const auto path = "trace-" + std::to_string(watcher::DateTime<>::now().milliseconds()) + ".json";
+      std::thread([path]() {
+        if (watcher::Tracer::instance().dump(path))
+          watcher::Log.i("Trace written to ", path);
+      }).detach();
+    }
+
+    std::vector<std::string> detected;
+    watcher::Overlay overlay;
+    const bool draw = option_controller.options()->draw_overlay;
+    watcher::Tracer::clock::time_point annotate_start{};
     if (!pause) {
       if (bool expected = true; !updated.compare_exchange_strong(expected, false)) {
         continue;
@@ -214,46 +277,51 @@ bool run(const std::string& url, const std::string& port) {
         continue;
       }
 
-      if (frame = *frame_or_not; frame.empty()) {
+      if (std::tie(frame, frame_id) = *frame_or_not; frame.empty()) {
         continue;
       }
+      annotate_start = watcher::Tracer::clock::now();
 
       cv::resize(frame, view, {}, 0.5, 0.5);
 
-      detector.feed(frame, watcher::DateTime<>::now().milliseconds());
+      detector.feed(frame, watcher::DateTime<>::now().milliseconds(), frame_id);
+
+      if (const auto result = detector.result(); result) {
+        overlay.detected_frame = result->frame_id;
+        for (const auto& detection: result->detections) {
+          detected.emplace_back(detection.label);
+          overlay.detections.push_back({
+            std::string(detection.label),
+            detection.score,
+            {detection.rect[1], detection.rect[0], detection.rect[3], detection.rect[2]}});
+          if (!draw)
+            continue;
 
-      decltype(inference_result) result_copy;
-      {
-        std::lock_guard lck(inference_result_m);
-        result_copy = inference_result;
-      }
-      if (result_copy) {
-        for (const auto& detection: *result_copy) {
           const cv::Point2f tl(detection.rect[1] * view.cols, detection.rect[0] * view.rows);
           const cv::Point2f br(detection.rect[3] * view.cols, detection.rect[2] * view.rows);
 
           cv::rectangle(view, tl, br, {255, 0, 0}, 2);
 
-          char buf[10];
-          std::sprintf(buf, "(%.1f%%)", detection.score * 100);
-          cv::putText(view,
-                      detection.label + std::string(buf),
-                      cv::Point2d(tl.x, tl.y - 4 * scale),
-                      cv::FONT_ITALIC, 0.5 * scale, {255, 255, 255}, 2);
-          cv::putText(view,
-                      detection.label + std::string(buf),
-                      cv::Point2d(tl.x, tl.y - 4 * scale),
-                      cv::FONT_ITALIC, 0.5 * scale, {0, 0, 0}, 1);
+          char buf[64];
+          // In whole percent, so that a label is drawn from one of a few cached masks
+          std::snprintf(buf, sizeof(buf), "%.*s(%d%%)", static_cast<int>(detection.label.size()),
+                        detection.label.data(), static_cast<int>(std::lround(detection.score * 100)));
+          watcher::BorderedText()
+            .text(buf)
+            .org(cv::Point2d(tl.x, tl.y - 4 * scale))
+            .font_face(cv::FONT_ITALIC)
+            .font_scale(0.5 * scale)
+            .color({0, 0, 0})
+            .draw(view);
         }
       }
     }
-    const auto now = watcher::DateTime<>::now().time_zone(std::chrono::hours(9)).to_string();
+    // A view into timestamp_buffer, which lives until the frame is fed
+    const auto now = timestamp.format(timestamp_buffer);
 
-    text_criteria.text("Criteria: " + std::to_string(detector.score_threshold()));
-    text_inference.text("Inference: " + std::to_string(detector.inference_time()) + "ms");
-    text_fps.text("FPS: " + std::to_string(camera.fps()));
-    text_time.text(now)
-      .org({5, view.rows - 30 * int(scale)});
+    overlay.criteria = detector.score_threshold();
+    overlay.inference_ms = static_cast<int>(detector.inference_time());
+    overlay.fps = camera.fps();
 
     decltype(bbox) bbox_copy;
     {
@@ -261,12 +329,29 @@ bool run(const std::string& url, const std::string& port) {
       bbox_copy = bbox;
     }
     for (const auto& rect : bbox_copy) {
-      cv::rectangle(view, cv::Point(rect.tl() / 2), cv::Point(rect.br()/2), {0,0,220}, 1);
+      const float w = frame.cols, h = frame.rows;
+      overlay.motion.push_back({rect.x / w, rect.y / h, (rect.x + rect.width) / w, (rect.y + rect.height) / h});
+    }
+
+    if (draw) {
+      text_criteria.text("Criteria: " + std::to_string(overlay.criteria));
+      text_inference.text("Inference: " + std::to_string(overlay.inference_ms) + "ms");
+      text_fps.text("FPS: " + std::to_string(overlay.fps));
+      // Into the string's existing storage rather than a new one
+      text_time.text().assign(now);
+      text_time.org({5, view.rows - 30 * int(scale)});
+
+      for (const auto& rect : bbox_copy) {
+        cv::rectangle(view, cv::Point(rect.tl() / 2), cv::Point(rect.br()/2), {0,0,220}, 1);
+      }
+
+      watcher::draw(view, text_criteria, text_inference, text_fps, text_time);
     }
 
-    watcher::draw(view, text_criteria, text_inference, text_fps, text_time);
+    if (!pause && watcher::Tracer::enabled())
+      watcher::Tracer::instance().record("annotate", frame_id, annotate_start, watcher::Tracer::clock::now());
 
-    video_client.feed(view, now, std::vector<std::string>());
+    video_client.feed(view, now, std::move(detected), !bbox_copy.empty(), frame_id, std::move(overlay));
 
 # ifdef __APPLE__
     cv::imshow("Raspberry Pi", view);
@@ -299,17 +384,153 @@ bool run(const std::string& url, const std::string& port) {
   return false;
 }
 
+bool read_file(const std::string& path, watcher::AlignedBuffer& buffer) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  char chunk[64 * 1024];
+  while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0)
+    buffer.append(chunk, static_cast<size_t>(file.gcount()));
+  return !buffer.empty();
+}
+
+void print_usage() {
+  std::cerr << "Usage: [URL] [PORT] [METRICS_PORT]" << std::endl;
+  std::cerr << "       --offline PATH [--jobs N] [--threads N] [--output FILE] [--model FILE] [--labelmap FILE] [--gate FILE]" << std::endl;
+}
+
+// watcher --offline PATH [--jobs N] [--threads N] [--output FILE] [--model FILE] [--labelmap FILE] [--gate FILE]
+int run_offline(int argc, char* argv[]) {
+  std::unordered_map<std::string, std::string> args = {
+    {"--jobs", "0"},
+    {"--threads", "1"},
+    {"--model", "model/model.tflite"},
+    {"--labelmap", "model/labelmap.txt"},
+  };
+  // Every flag takes a value. Unknown or incomplete ones fail the run rather than silently falling back to defaults
+  static const std::unordered_set<std::string> flags = {
+    "--offline", "--jobs", "--threads", "--output", "--model", "--labelmap", "--gate",
+  };
+  for (int i = 1; i < argc; i += 2) {
+    if (flags.count(argv[i]) == 0 || i + 1 == argc) {
+      std::cerr << (flags.count(argv[i]) == 0 ? "Unknown option " : "Missing value for ") << argv[i] << std::endl;
+      print_usage();
+      return EXIT_FAILURE;
+    }
+    args[argv[i]] = argv[i + 1];
+  }
+
+  int jobs = 0;
+  int threads = 1;
+  try {
+    jobs = std::stoi(args["--jobs"]);
+    threads = std::stoi(args["--threads"]);
+  } catch (const std::exception&) {
+    std::cerr << "--jobs and --threads take a number" << std::endl;
+    print_usage();
+    return EXIT_FAILURE;
+  }
+
+  const auto model = std::make_shared<watcher::AlignedBuffer>();
+  if (!read_file(args["--model"], *model)) {
+    watcher::Log.e("Cannot read model ", args["--model"]);
+    return EXIT_FAILURE;
+  }
+  watcher::AlignedBuffer labelmap;
+  if (!read_file(args["--labelmap"], labelmap)) {
+    watcher::Log.e("Cannot read labelmap ", args["--labelmap"]);
+    return EXIT_FAILURE;
+  }
+
+  watcher::OfflineRunner runner(model, std::string(labelmap.data(), labelmap.size()));
+  runner.threads_per_job(threads);
+  if (jobs > 0)
+    runner.jobs(jobs);
+  if (args.count("--gate")) {
+    watcher::AlignedBuffer gate;
+    if (!read_file(args["--gate"], gate)) {
+      watcher::Log.e("Cannot read gate model ", args["--gate"]);
+      return EXIT_FAILURE;
+    }
+    runner.gate(std::string(gate.data(), gate.size()));
+  }
+
+  std::ofstream file;
+  if (args.count("--output")) {
+    file.open(args["--output"]);
+    if (!file) {
+      watcher::Log.e("Cannot write ", args["--output"]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  watcher::OptionController::get().load(kOptionsFile);
+  watcher::Tracer::instance().enable(watcher::OptionController::get().options()->trace);
+
+  try {
+    const auto stats = runner.run(args["--offline"], args.count("--output") ? file : std::cout);
+    watcher::Log.i("Offline: ", stats.files, " files, ", stats.frames, " frames, ", stats.inferences,
+                   " inferences, ", stats.detections, " detections in ", stats.seconds, "s (",
+                   stats.seconds > 0 ? static_cast<double>(stats.frames) / stats.seconds : 0, " fps)");
+    if (stats.files == 0) {
+      watcher::Log.e("No video could be decoded from ", args["--offline"]);
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception& e) {
+    watcher::Log.e("Offline run failed: ", e.what());
+    return EXIT_FAILURE;
+  }
+
+  if (watcher::OptionController::get().options()->trace)
+    watcher::Tracer::instance().dump("trace-offline.json");
+  return 0;
+}
+
 int main(int argc, char* argv[]) {
   std::string url;
   std::string port;
+  int metrics_port = 9464;
 
-  if (argc != 3) {
-    std::cerr << "Usage: [URL] [PORT]" << std::endl;
+  if (argc >= 3 && std::string(argv[1]) == "--offline")
+    return run_offline(argc, argv);
+
+  if (argc != 3 && argc != 4) {
+    print_usage();
     return EXIT_FAILURE;
   }
 
   url = argv[1];
   port = argv[2];
+  if (argc == 4) {
+    try {
+      size_t end = 0;
+      metrics_port = std::stoi(argv[3], &end);
+      if (argv[3][end] != '\0' || metrics_port < 1 || metrics_port > 65535)
+        throw std::out_of_range(argv[3]);
+    } catch (const std::exception&) {
+      std::cerr << "METRICS_PORT must be a number from 1 to 65535" << std::endl;
+      print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Server settings, once fetched, take precedence over both
+  watcher::OptionController::get().load(kOptionsFile);
+  if (const char* trace = std::getenv("WATCHER_TRACE"); trace && std::string(trace) == "1")
+    watcher::OptionController::get().set("trace", "1");
+  std::signal(SIGUSR1, [](int) { trace_dump_requested = true; });
+  std::signal(SIGHUP, [](int) { options_reload_requested = true; });
+
+  // Outlive the restarts of run(), so counters keep counting across them
+  watcher::ProcessMetrics process_metrics;
+  watcher::MetricsExporter metrics_exporter;
+  metrics_exporter.snapshot("metrics.prom");
+  try {
+    const char* metrics_address = std::getenv("WATCHER_METRICS_ADDRESS");
+    metrics_exporter.listen(static_cast<uint16_t>(metrics_port), metrics_address ? metrics_address : "127.0.0.1");
+  } catch (const std::exception& e) {
+    watcher::Log.e("Cannot serve metrics on port ", metrics_port, ": ", e.what());
+  }
 
   while (true) {
     if (run(url, port)) {
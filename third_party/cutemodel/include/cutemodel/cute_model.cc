@@ -37,6 +37,11 @@ CuteModel& CuteModel::setUseGPU(bool use) & {
   return *this;
 }
 
+CuteModel& CuteModel::setUseXNNPack(bool use) & {
+  pImpl->setUseXNNPack(use);
+  return *this;
+}
+
 void CuteModel::build() {
   return pImpl->build();
 }
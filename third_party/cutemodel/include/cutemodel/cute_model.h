@@ -38,6 +38,7 @@ class CuteModel {
 
   CuteModel& setNumThreads(int num) &;
   CuteModel& setUseGPU(bool use) &;
+  CuteModel& setUseXNNPack(bool use) &;
 
   void build();
   bool isBuilt() const;
@@ -60,10 +60,17 @@ class CuteModel::Impl {
     #endif
   }
 
+  // No-op if XNNPACK is disabled at compile time
+  void setUseXNNPack(bool use) {
+    use_xnn = use;
+  }
+
   void build() {
 #if USE_XNN_DELEGATE
-    xnn_delegate.reset(TfLiteXNNPackDelegateCreate(&xnn_options));
-    TfLiteInterpreterOptionsAddDelegate(options.get(), xnn_delegate.get());
+    if (use_xnn) {
+      xnn_delegate.reset(TfLiteXNNPackDelegateCreate(&xnn_options));
+      TfLiteInterpreterOptionsAddDelegate(options.get(), xnn_delegate.get());
+    }
 #endif
     interpreter.reset(TfLiteInterpreterCreate(model.get(), options.get()));
     if (interpreter == nullptr) return;
@@ -180,6 +187,7 @@ class CuteModel::Impl {
   std::unique_ptr<TfLiteInterpreterOptions, decltype(&TfLiteInterpreterOptionsDelete)> options{nullptr, TfLiteInterpreterOptionsDelete};
   std::unique_ptr<TfLiteInterpreter, decltype(&TfLiteInterpreterDelete)> interpreter{nullptr, &TfLiteInterpreterDelete};
 
+  bool use_xnn = true;
 #if USE_XNN_DELEGATE
   TfLiteXNNPackDelegateOptions xnn_options = TfLiteXNNPackDelegateOptionsDefault();
   std::unique_ptr<TfLiteDelegate, decltype(&TfLiteXNNPackDelegateDelete)> xnn_delegate{nullptr, &TfLiteXNNPackDelegateDelete};
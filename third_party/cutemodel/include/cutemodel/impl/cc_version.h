@@ -47,6 +47,10 @@ class CuteModel::Impl {
     // We currently do not use GPU in Android and Web
   }
 
+  void setUseXNNPack(bool use) {
+    // Delegates are not supported in this version
+  }
+
   void build() {
   }
 
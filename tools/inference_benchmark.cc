@@ -0,0 +1,286 @@
+// Sweeps ObjectDetectionModel configurations over a fixed set of frames and
+// reports latency percentiles per configuration.
+//
+// Usage:
+//   inference_benchmark --model=a.tflite[,b.tflite...] --input=<image dir | video>
+//                       [--labelmap=labelmap.txt] [--threads=1,2,4] [--xnnpack=1,0]
+//                       [--frames=100] [--warmup=3] [--iterations=200]
+//                       [--format=csv|json] [--output=path]
+//
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+#include "tensorflow/lite/c/c_api.h"
+
+#include "watcher/detector/object_detection_model.h"
+#include "watcher/mock_input/video_input.h"
+
+namespace {
+
+struct Config {
+  std::string model;
+  int num_threads;
+  bool use_xnnpack;
+};
+
+struct Report {
+  Config config;
+  std::string input_type;
+  double build_ms = 0;
+  double warmup_ms = 0;
+  double p50_ms = 0;
+  double p90_ms = 0;
+  double p99_ms = 0;
+  double mean_ms = 0;
+  double preprocess_ms = 0;
+  double invoke_ms = 0;
+  double postprocess_ms = 0;
+  long peak_rss_kb = 0;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point from, clock_type::time_point to = clock_type::now()) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+std::vector<std::string> split(const std::string& s, char sep = ',') {
+  std::vector<std::string> tokens;
+  std::stringstream ss(s);
+  std::string token;
+  while (std::getline(ss, token, sep)) {
+    if (!token.empty())
+      tokens.emplace_back(std::move(token));
+  }
+  return tokens;
+}
+
+std::vector<int> split_int(const std::string& s) {
+  std::vector<int> values;
+  for (const auto& token : split(s))
+    values.emplace_back(std::stoi(token));
+  return values;
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open())
+    throw std::runtime_error("Failed to open " + path);
+  return {std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+}
+
+// ru_maxrss is reported in kilobytes on Linux and in bytes on macOS
+long peak_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+// Decode everything up front so that decoding is not part of the measurement
+std::vector<cv::Mat> load_frames(const std::string& input, size_t max_frames) {
+  std::vector<cv::Mat> frames;
+
+  std::vector<cv::String> files;
+  cv::glob(input, files, false);
+
+  if (files.size() > 1 || (files.size() == 1 && files[0] != input)) {
+    for (const auto& file : files) {
+      if (frames.size() >= max_frames)
+        break;
+      if (auto image = cv::imread(file, cv::IMREAD_COLOR); !image.empty())
+        frames.emplace_back(std::move(image));
+    }
+    return frames;
+  }
+
+  watcher::VideoInput video(input);
+  while (frames.size() < max_frames) {
+    cv::Mat frame;
+    video >> frame;
+    if (frame.empty())
+      break;
+    frames.emplace_back(std::move(frame));
+  }
+  return frames;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  const auto idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+Report run(const Config& config, const std::string& model_buffer, const std::string& labelmap_buffer,
+           const std::vector<cv::Mat>& frames, int warmup, int iterations) {
+  Report report;
+  report.config = config;
+
+  auto t0 = clock_type::now();
+  watcher::ObjectDetectionModel model;
+  model.num_threads(config.num_threads)
+       .use_xnnpack(config.use_xnnpack)
+       .loadFromBuffer(model_buffer.data(), model_buffer.size(),
+                       labelmap_buffer.data(), labelmap_buffer.size());
+  report.build_ms = elapsed_ms(t0);
+  report.input_type = TfLiteTypeGetName(model.input_type());
+
+  t0 = clock_type::now();
+  for (int i = 0; i < warmup; ++i)
+    model.invoke(frames[i % frames.size()]);
+  report.warmup_ms = elapsed_ms(t0);
+
+  std::vector<double> latency;
+  latency.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    t0 = clock_type::now();
+    model.invoke(frames[i % frames.size()]);
+    latency.emplace_back(elapsed_ms(t0));
+
+    const auto& profile = model.last_profile();
+    report.preprocess_ms += profile.preprocess_ms;
+    report.invoke_ms += profile.invoke_ms;
+    report.postprocess_ms += profile.postprocess_ms;
+  }
+
+  if (iterations > 0) {
+    report.preprocess_ms /= iterations;
+    report.invoke_ms /= iterations;
+    report.postprocess_ms /= iterations;
+    for (const auto l : latency)
+      report.mean_ms += l;
+    report.mean_ms /= iterations;
+  }
+
+  std::sort(latency.begin(), latency.end());
+  report.p50_ms = percentile(latency, 0.50);
+  report.p90_ms = percentile(latency, 0.90);
+  report.p99_ms = percentile(latency, 0.99);
+  report.peak_rss_kb = peak_rss_kb();
+
+  return report;
+}
+
+void write_csv(std::ostream& os, const std::vector<Report>& reports) {
+  os << "model,input_type,threads,xnnpack,build_ms,warmup_ms,mean_ms,p50_ms,p90_ms,p99_ms,"
+        "preprocess_ms,invoke_ms,postprocess_ms,peak_rss_kb\n";
+  for (const auto& r : reports) {
+    os << r.config.model << ',' << r.input_type << ','
+       << r.config.num_threads << ',' << r.config.use_xnnpack << ','
+       << r.build_ms << ',' << r.warmup_ms << ',' << r.mean_ms << ','
+       << r.p50_ms << ',' << r.p90_ms << ',' << r.p99_ms << ','
+       << r.preprocess_ms << ',' << r.invoke_ms << ',' << r.postprocess_ms << ','
+       << r.peak_rss_kb << '\n';
+  }
+}
+
+void write_json(std::ostream& os, const std::vector<Report>& reports) {
+  os << "[\n";
+  for (size_t i = 0; i < reports.size(); ++i) {
+    const auto& r = reports[i];
+    os << "  {"
+       << "\"model\": \"" << r.config.model << "\", "
+       << "\"input_type\": \"" << r.input_type << "\", "
+       << "\"threads\": " << r.config.num_threads << ", "
+       << "\"xnnpack\": " << (r.config.use_xnnpack ? "true" : "false") << ", "
+       << "\"build_ms\": " << r.build_ms << ", "
+       << "\"warmup_ms\": " << r.warmup_ms << ", "
+       << "\"mean_ms\": " << r.mean_ms << ", "
+       << "\"p50_ms\": " << r.p50_ms << ", "
+       << "\"p90_ms\": " << r.p90_ms << ", "
+       << "\"p99_ms\": " << r.p99_ms << ", "
+       << "\"preprocess_ms\": " << r.preprocess_ms << ", "
+       << "\"invoke_ms\": " << r.invoke_ms << ", "
+       << "\"postprocess_ms\": " << r.postprocess_ms << ", "
+       << "\"peak_rss_kb\": " << r.peak_rss_kb
+       << '}' << (i + 1 < reports.size() ? "," : "") << '\n';
+  }
+  os << "]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::unordered_map<std::string, std::string> args = {
+    {"labelmap", ""},
+    {"threads", "1,2,3,4"},
+    {"xnnpack", "1,0"},
+    {"frames", "100"},
+    {"warmup", "3"},
+    {"iterations", "200"},
+    {"format", "csv"},
+    {"output", ""},
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      std::cerr << "Invalid argument: " << arg << '\n';
+      return EXIT_FAILURE;
+    }
+    args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+  }
+
+  if (args["model"].empty() || args["input"].empty()) {
+    std::cerr << "Usage: inference_benchmark --model=a.tflite[,b.tflite] --input=<image dir | video> "
+                 "[--labelmap=path] [--threads=1,2,4] [--xnnpack=1,0] [--frames=N] [--warmup=N] "
+                 "[--iterations=N] [--format=csv|json] [--output=path]\n";
+    return EXIT_FAILURE;
+  }
+
+  const auto frames = load_frames(args["input"], std::stoul(args["frames"]));
+  if (frames.empty()) {
+    std::cerr << "No frames could be read from " << args["input"] << '\n';
+    return EXIT_FAILURE;
+  }
+
+  const auto labelmap_buffer = args["labelmap"].empty() ? std::string() : read_file(args["labelmap"]);
+  const auto warmup = std::stoi(args["warmup"]);
+  const auto iterations = std::stoi(args["iterations"]);
+
+  std::vector<Report> reports;
+  for (const auto& model_path : split(args["model"])) {
+    const auto model_buffer = read_file(model_path);
+
+    for (const auto use_xnnpack : split_int(args["xnnpack"])) {
+      for (const auto num_threads : split_int(args["threads"])) {
+        const Config config{model_path, num_threads, use_xnnpack != 0};
+        reports.emplace_back(run(config, model_buffer, labelmap_buffer, frames, warmup, iterations));
+
+        const auto& r = reports.back();
+        std::cerr << model_path << " threads=" << num_threads << " xnnpack=" << use_xnnpack
+                  << " p50=" << r.p50_ms << "ms p99=" << r.p99_ms << "ms\n";
+      }
+    }
+  }
+
+  std::ofstream ofs;
+  if (!args["output"].empty())
+    ofs.open(args["output"]);
+  std::ostream& os = ofs.is_open() ? ofs : std::cout;
+
+  if (args["format"] == "json")
+    write_json(os, reports);
+  else
+    write_csv(os, reports);
+
+  return EXIT_SUCCESS;
+}
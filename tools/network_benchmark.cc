@@ -0,0 +1,310 @@
+// Uploads frames to a stand-in server and reports frames/s, MB/s and per-frame latency
+// for each client and header format.
+//
+// Without --host, a StandinServer is started in-process on a free port, and --delay_ms and
+// --bandwidth_kbps are applied to it. With --host, configure those on the remote standin_server.
+//
+// Latency is from posting a frame until it is written (--ack=0, frames are pipelined), or until
+// a follow-up GET returns, which the server answers only after reading the whole frame (--ack=1).
+//
+// Usage:
+//   network_benchmark [--host=127.0.0.1 --port=7000] [--frames=200] [--size=50000,200000]
+//                     [--client=sync,async] [--header=text,binary] [--ack=0]
+//                     [--delay_ms=0] [--bandwidth_kbps=0] [--format=csv|json] [--output=path]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "watcher/network/async_client.h"
+#include "watcher/network/network_engine.h"
+#include "watcher/network/packet_header.h"
+#include "watcher/network/protocol.h"
+#include "watcher/network/standin_server.h"
+#include "watcher/network/tcp_client.h"
+
+namespace {
+
+struct Config {
+  std::string client;
+  std::string header;
+  size_t size;
+};
+
+struct Report {
+  Config config;
+  size_t frames = 0;
+  size_t server_frames = 0;
+  double seconds = 0;
+  double fps = 0;
+  double mbps = 0;
+  double mean_ms = 0;
+  double p50_ms = 0;
+  double p90_ms = 0;
+  double p99_ms = 0;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point from, clock_type::time_point to = clock_type::now()) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+std::vector<std::string> split(const std::string& s, char sep = ',') {
+  std::vector<std::string> tokens;
+  std::stringstream ss(s);
+  std::string token;
+  while (std::getline(ss, token, sep)) {
+    if (!token.empty())
+      tokens.emplace_back(std::move(token));
+  }
+  return tokens;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  const auto idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+watcher::HeaderFormat to_header_format(const std::string& name) {
+  return name == "binary" ? watcher::HeaderFormat::kBinary : watcher::HeaderFormat::kText;
+}
+
+// Random bytes, so that nothing along the way can compress them
+std::vector<unsigned char> make_payload(size_t size) {
+  std::vector<unsigned char> payload(size);
+  std::mt19937 gen(size);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (auto& c : payload)
+    c = static_cast<unsigned char>(dist(gen));
+  return payload;
+}
+
+// Frames the server has received so far, from its `stats` answer
+size_t server_frames(const std::string& host, const std::string& port) {
+  watcher::TcpClient client(host, port);
+  watcher::Protocol protocol;
+  const auto response = protocol.Get(client, "stats");
+  const auto data = response.find("data");
+  if (data == response.end())
+    return 0;
+
+  const auto pos = data->second.find("frames=");
+  return pos == std::string::npos ? 0 : std::stoull(data->second.substr(pos + 7));
+}
+
+const watcher::Protocol::key_value_pair kFrameHeader = {
+  {kHeaderFileFormat, ".jpg"},
+  {kHeaderStreamIndex, "0"},
+};
+
+std::vector<double> run_sync(const Config& config, const std::string& host, const std::string& port,
+                             const std::vector<unsigned char>& payload, size_t frames, bool ack) {
+  watcher::TcpClient client(host, port);
+  watcher::Protocol protocol;
+  protocol.header_format(to_header_format(config.header));
+
+  std::vector<double> latency;
+  latency.reserve(frames);
+  for (size_t i = 0; i < frames; ++i) {
+    const auto t0 = clock_type::now();
+    protocol.WritePost(client, reinterpret_cast<const char*>(payload.data()), payload.size(), kFrameHeader);
+    if (ack)
+      (void)protocol.Get(client, "stats");
+    latency.emplace_back(elapsed_ms(t0));
+  }
+  return latency;
+}
+
+std::vector<double> run_async(const Config& config, const std::string& host, const std::string& port,
+                              const std::vector<unsigned char>& payload, size_t frames, bool ack) {
+  watcher::NetworkEngine engine;
+  auto client = watcher::AsyncClient::create(engine, host, port, frames);
+  client->header_format(to_header_format(config.header));
+
+  const auto data = std::make_shared<const std::vector<unsigned char>>(payload);
+  const auto timeout = std::chrono::seconds(60);
+
+  std::vector<double> latency(frames);
+  if (ack) {
+    for (size_t i = 0; i < frames; ++i) {
+      const auto t0 = clock_type::now();
+      client->Post(data, kFrameHeader, timeout, [](const boost::system::error_code&, auto) {});
+      (void)client->Get("stats", timeout).get();
+      latency[i] = elapsed_ms(t0);
+    }
+    return latency;
+  }
+
+  // Everything is queued at once, so the latency includes the time spent waiting in the queue
+  std::promise<void> all_done;
+  size_t remaining = frames;
+  for (size_t i = 0; i < frames; ++i) {
+    const auto t0 = clock_type::now();
+    client->Post(data, kFrameHeader, timeout,
+                 [&, i, t0](const boost::system::error_code& error, auto) {
+      if (error)
+        std::cerr << "Frame " << i << " failed: " << error.message() << '\n';
+      latency[i] = elapsed_ms(t0);
+      if (--remaining == 0)
+        all_done.set_value();
+    });
+  }
+  all_done.get_future().wait();
+  return latency;
+}
+
+Report run(const Config& config, const std::string& host, const std::string& port, size_t frames, bool ack) {
+  Report report;
+  report.config = config;
+  report.frames = frames;
+
+  const auto payload = make_payload(config.size);
+  const auto before = server_frames(host, port);
+
+  const auto t0 = clock_type::now();
+  auto latency = config.client == "async"
+    ? run_async(config, host, port, payload, frames, ack)
+    : run_sync(config, host, port, payload, frames, ack);
+
+  // Without an ack, written frames may still sit in socket buffers. The run ends when the server has them
+  const auto deadline = clock_type::now() + std::chrono::seconds(30);
+  while ((report.server_frames = server_frames(host, port) - before) < frames && clock_type::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  report.seconds = elapsed_ms(t0) / 1000;
+
+  report.fps = frames / report.seconds;
+  report.mbps = frames * config.size / report.seconds * 0.000'001;
+  for (const auto l : latency)
+    report.mean_ms += l;
+  report.mean_ms /= std::max<size_t>(1, latency.size());
+
+  std::sort(latency.begin(), latency.end());
+  report.p50_ms = percentile(latency, 0.50);
+  report.p90_ms = percentile(latency, 0.90);
+  report.p99_ms = percentile(latency, 0.99);
+
+  return report;
+}
+
+void write_csv(std::ostream& os, const std::vector<Report>& reports) {
+  os << "client,header,size,frames,server_frames,seconds,fps,mbps,mean_ms,p50_ms,p90_ms,p99_ms\n";
+  for (const auto& r : reports) {
+    os << r.config.client << ',' << r.config.header << ',' << r.config.size << ','
+       << r.frames << ',' << r.server_frames << ',' << r.seconds << ','
+       << r.fps << ',' << r.mbps << ',' << r.mean_ms << ','
+       << r.p50_ms << ',' << r.p90_ms << ',' << r.p99_ms << '\n';
+  }
+}
+
+void write_json(std::ostream& os, const std::vector<Report>& reports) {
+  os << "[\n";
+  for (size_t i = 0; i < reports.size(); ++i) {
+    const auto& r = reports[i];
+    os << "  {"
+       << "\"client\": \"" << r.config.client << "\", "
+       << "\"header\": \"" << r.config.header << "\", "
+       << "\"size\": " << r.config.size << ", "
+       << "\"frames\": " << r.frames << ", "
+       << "\"server_frames\": " << r.server_frames << ", "
+       << "\"seconds\": " << r.seconds << ", "
+       << "\"fps\": " << r.fps << ", "
+       << "\"mbps\": " << r.mbps << ", "
+       << "\"mean_ms\": " << r.mean_ms << ", "
+       << "\"p50_ms\": " << r.p50_ms << ", "
+       << "\"p90_ms\": " << r.p90_ms << ", "
+       << "\"p99_ms\": " << r.p99_ms
+       << '}' << (i + 1 < reports.size() ? "," : "") << '\n';
+  }
+  os << "]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::unordered_map<std::string, std::string> args = {
+    {"host", ""},
+    {"port", "7000"},
+    {"frames", "200"},
+    {"size", "50000,200000"},
+    {"client", "sync,async"},
+    {"header", "text,binary"},
+    {"ack", "0"},
+    {"delay_ms", "0"},
+    {"bandwidth_kbps", "0"},
+    {"format", "csv"},
+    {"output", ""},
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: network_benchmark [--host=h --port=p] [--frames=N] [--size=a,b] "
+                   "[--client=sync,async] [--header=text,binary] [--ack=0|1] [--delay_ms=N] "
+                   "[--bandwidth_kbps=N] [--format=csv|json] [--output=path]\n";
+      return EXIT_FAILURE;
+    }
+    args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+  }
+
+  std::unique_ptr<watcher::StandinServer> server;
+  std::string host = args["host"];
+  std::string port = args["port"];
+  if (host.empty()) {
+    watcher::StandinServer::Options options;
+    options.port = 0;
+    options.delay = std::chrono::milliseconds(std::stoi(args["delay_ms"]));
+    options.bandwidth = std::stod(args["bandwidth_kbps"]) * 1000 / 8;
+
+    server = std::make_unique<watcher::StandinServer>(options);
+    server->start();
+    host = "127.0.0.1";
+    port = std::to_string(server->port());
+  } else if (args["delay_ms"] != "0" || args["bandwidth_kbps"] != "0") {
+    std::cerr << "--delay_ms and --bandwidth_kbps only apply to the in-process server\n";
+  }
+
+  const auto frames = std::stoul(args["frames"]);
+  const auto ack = args["ack"] == "1";
+
+  std::vector<Report> reports;
+  for (const auto& size : split(args["size"])) {
+    for (const auto& client : split(args["client"])) {
+      for (const auto& header : split(args["header"])) {
+        const Config config{client, header, std::stoul(size)};
+        reports.emplace_back(run(config, host, port, frames, ack));
+
+        const auto& r = reports.back();
+        std::cerr << client << " header=" << header << " size=" << size
+                  << " " << r.fps << "fps " << r.mbps << "MB/s p50=" << r.p50_ms << "ms p99=" << r.p99_ms
+                  << "ms received=" << r.server_frames << '/' << r.frames << '\n';
+      }
+    }
+  }
+
+  std::ofstream ofs;
+  if (!args["output"].empty())
+    ofs.open(args["output"]);
+  std::ostream& os = ofs.is_open() ? ofs : std::cout;
+
+  if (args["format"] == "json")
+    write_json(os, reports);
+  else
+    write_csv(os, reports);
+
+  return EXIT_SUCCESS;
+}
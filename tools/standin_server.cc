@@ -0,0 +1,87 @@
+// Local stand-in for the remote server. Serves the model, labelmap and settings from a directory
+// and accepts uploaded frames.
+//
+// Usage:
+//   standin_server [--port=7000] [--root=.] [--save=<dir>] [--delay_ms=0] [--bandwidth_kbps=0]
+//
+// Layout of the root directory:
+//   model/model.tflite, model/labelmap.txt, settings/<key> (one value per file)
+//
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "watcher/network/standin_server.h"
+
+namespace {
+
+std::atomic_bool interrupted = false;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::unordered_map<std::string, std::string> args = {
+    {"port", "7000"},
+    {"root", "."},
+    {"save", ""},
+    {"delay_ms", "0"},
+    {"bandwidth_kbps", "0"},
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: standin_server [--port=7000] [--root=.] [--save=dir] [--delay_ms=N] [--bandwidth_kbps=N]\n";
+      return EXIT_FAILURE;
+    }
+    args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+  }
+
+  watcher::StandinServer::Options options;
+  options.port = static_cast<unsigned short>(std::stoi(args["port"]));
+  options.root = args["root"];
+  options.save_dir = args["save"];
+  options.delay = std::chrono::milliseconds(std::stoi(args["delay_ms"]));
+  options.bandwidth = std::stod(args["bandwidth_kbps"]) * 1000 / 8;
+
+  watcher::StandinServer server(options);
+  try {
+    server.start();
+  } catch (const std::exception& e) {
+    std::cerr << "Failed to start: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  std::signal(SIGINT, [](int) { interrupted = true; });
+  std::signal(SIGTERM, [](int) { interrupted = true; });
+
+  auto last = server.stats();
+  auto last_time = std::chrono::steady_clock::now();
+  while (!interrupted) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto seconds = std::chrono::duration<double>(now - last_time).count();
+    if (seconds < 5)
+      continue;
+
+    const auto s = server.stats();
+    if (s.requests != last.requests || s.frames != last.frames) {
+      std::cerr << "frames=" << s.frames << " (" << (s.frames - last.frames) / seconds << "/s) "
+                << "requests=" << s.requests << ' '
+                << "in=" << (s.bytes_received - last.bytes_received) / seconds * 0.000'001 << "MB/s\n";
+    }
+    last = s;
+    last_time = now;
+  }
+
+  server.stop();
+  return EXIT_SUCCESS;
+}